@@ -7,6 +7,7 @@ extern "C" {
 enum vrtld_init_flags {
   VRTLD_INITIALIZED     = 1,  /* library is operational */
   VRTLD_NO_SCE_EXPORTS  = 2,  /* don't search main module's exports table */
+  VRTLD_RELOC_CACHE     = 4,  /* cache import resolution results in a file next to each module */
   VRTLD_TARGET2_IS_GOT  = 32, /* assume TARGET2 relocs are GOT-relative and fix them */
   VRTLD_TARGET2_IS_ABS  = 64, /* assume TARGET2 relocs are ABS32 and fix them */
 };
@@ -14,8 +15,8 @@ enum vrtld_init_flags {
 enum vrtld_dlopen_flags {
   VRTLD_LOCAL  = 0,  /* don't use this module's symbols when resolving others */
   VRTLD_GLOBAL = 1,  /* use this module's symbols when resolving others */
-  VRTLD_NOW    = 0,  /* finalize loading before dlopen() returns */
-  VRTLD_LAZY   = 2,  /* finalize loading only after dlsym() is called */
+  VRTLD_NOW    = 0,  /* resolve all imports before dlopen() returns */
+  VRTLD_LAZY   = 2,  /* resolve function imports through the PLT when they're first called */
 };
 
 typedef struct vrtld_export {
@@ -23,6 +24,14 @@ typedef struct vrtld_export {
   void *addr_rx;     /* executable address */
 } vrtld_export_t;
 
+/* prebuilt symbol table, see vrtld_add_exports() in vrtld_shim.cmake */
+typedef struct vrtld_symtab {
+  const void *symtab;           /* Elf32_Sym array starting with the NULL symbol; all symbols are SHN_ABS */
+  const char *strtab;           /* string table for symtab */
+  const unsigned int *gnuhash;  /* GNU-style hash table for symtab */
+  unsigned int num_syms;        /* number of entries in symtab */
+} vrtld_symtab_t;
+
 /* this is just Dl_info */
 typedef struct vrtld_dl_info {
   const char *dli_fname;  /* pathname of shared object that contains address */
@@ -31,6 +40,72 @@ typedef struct vrtld_dl_info {
   void *dli_saddr;        /* exact address of symbol named in dli_sname */
 } vrtld_dl_info_t;
 
+/* load phases timed by the loader */
+enum vrtld_stats_phase {
+  VRTLD_PHASE_IO,     /* reading from the file */
+  VRTLD_PHASE_ALLOC,  /* allocating address space and memblocks */
+  VRTLD_PHASE_COPY,   /* copying and zeroing write protected segments */
+  VRTLD_PHASE_RELOC,  /* applying relocations */
+  VRTLD_PHASE_FLUSH,  /* flushing caches */
+  VRTLD_PHASE_INIT,   /* running init_array */
+  VRTLD_NUM_PHASES
+};
+
+/* kinds of relocations counted by the loader */
+enum vrtld_stats_reloc {
+  VRTLD_RELOC_RELATIVE,   /* R_ARM_RELATIVE, including DT_RELR */
+  VRTLD_RELOC_ABS32,      /* R_ARM_ABS32 */
+  VRTLD_RELOC_GLOB_DAT,   /* R_ARM_GLOB_DAT */
+  VRTLD_RELOC_JUMP_SLOT,  /* R_ARM_JUMP_SLOT bound immediately or on first call */
+  VRTLD_RELOC_LAZY,       /* R_ARM_JUMP_SLOT deferred until first call */
+  VRTLD_RELOC_TARGET2,    /* R_ARM_TARGET2 fixed up because of VRTLD_TARGET2_* */
+  VRTLD_RELOC_TLS,        /* R_ARM_TLS_DTPMOD32, R_ARM_TLS_DTPOFF32 and R_ARM_TLS_TPOFF32 */
+  VRTLD_RELOC_OTHER,      /* everything else */
+  VRTLD_NUM_RELOC_TYPES
+};
+
+/* where global symbol lookups were resolved */
+enum vrtld_stats_source {
+  VRTLD_SOURCE_OVERRIDE,  /* override exports */
+  VRTLD_SOURCE_SCE,       /* main module's SCE exports */
+  VRTLD_SOURCE_MODULE,    /* main module's aux exports, a GLOBAL module or a dependency of the importer */
+  VRTLD_SOURCE_LOADER,    /* the loader's own helpers, like __tls_get_addr */
+  VRTLD_NUM_SOURCES
+};
+
+/* number of hash chain length buckets; the last one counts everything at least that long */
+#define VRTLD_STATS_CHAIN_HIST 16
+
+typedef struct vrtld_module_stats {
+  unsigned long long time_us[VRTLD_NUM_PHASES];     /* time spent in each phase, in microseconds */
+  unsigned int relocs[VRTLD_NUM_RELOC_TYPES];       /* relocations processed by type */
+  unsigned int lookup_hits[VRTLD_NUM_SOURCES];      /* global symbol lookups by where they were found */
+  unsigned int lookup_misses;                       /* global symbol lookups that found nothing */
+  unsigned int lookups_saved;                       /* global symbol lookups skipped because they were already done */
+  unsigned int lookups_cached;                      /* global symbol lookups skipped because the reloc cache had them */
+  unsigned int chain_hist[VRTLD_STATS_CHAIN_HIST];  /* number of hash chains of each length */
+} vrtld_module_stats_t;
+
+typedef struct vrtld_stats {
+  vrtld_module_stats_t total;     /* sum over every module since vrtld_init(); chain_hist is for the global symbol table */
+  unsigned int num_modules;       /* modules currently loaded */
+  unsigned int vma_total;         /* size of the address window */
+  unsigned int vma_used;          /* address space in use */
+  unsigned int vma_largest_free;  /* largest free block of address space */
+  unsigned int vma_free_blocks;   /* number of free blocks of address space */
+  unsigned int exidx_cache_hits;  /* see vrtld_get_exidx_cache_stats() */
+  unsigned int exidx_cache_misses;
+} vrtld_stats_t;
+
+/* receives chunks of trace JSON from vrtld_trace_dump(); return a negative value to stop */
+typedef int (*vrtld_trace_write_t)(const void *data, unsigned int size, void *userdata);
+
+/* pending vrtld_dlopen_async() request */
+typedef struct vrtld_async vrtld_async_t;
+
+/* called from the loader thread when a request is done; result is 1 if it's ready to finish, -1 if it failed */
+typedef void (*vrtld_async_cb_t)(int result, void *userdata);
+
 #define VRTLD_EXPORT_SYMBOL(sym) { #sym, (void *)&sym }
 #define VRTLD_EXPORT(name, addr) { name, addr }
 
@@ -43,14 +118,38 @@ int vrtld_init(const unsigned int flags);
 void vrtld_quit(void);
 /* returns the `flags` value with which library was initialized, or 0 if it wasn't */
 unsigned int vrtld_init_flags(void);
-/* set the aux exports table */
+/* set the virtual address range modules are loaded into; NULL resets it to the default;
+   call before vrtld_init() or while no modules are loaded */
+int vrtld_set_address_window(void *start, const unsigned int size);
+/* set the directories DT_NEEDED libraries are looked up in, separated by ';'; NULL clears it
+   needed libraries that can't be found are assumed to be provided by the main module */
+int vrtld_set_search_path(const char *path);
+/* set the aux exports table; in host builds the addresses have to fit in 32 bits, so link with -no-pie */
 int vrtld_set_main_exports(const vrtld_export_t *exp, const int numexp);
+/* set a prebuilt aux exports table; it is used as is and must stay valid until vrtld_quit() */
+int vrtld_set_main_symtab(const vrtld_symtab_t *tab);
 
-/* these function mostly the same as the equivalent dlfcn stuff */
+/* modules that use __thread must be built with -mtp=soft; the ones loaded before any thread
+   first touches TLS get static blocks, so initial-exec TLS only works in those */
+/* these function mostly the same as the equivalent dlfcn stuff;
+   dlsym and dladdr can run on any number of threads at once, even while something is being loaded */
 void *vrtld_dlopen(const char *fname, int flags);
 int vrtld_dlclose(void *handle);
 void *vrtld_dlsym(void *__restrict handle, const char *__restrict symname);
-/* return current error and reset the error flag */
+/* look up `count` symbols at once, in the same order as vrtld_dlsym(); missing ones are set to NULL in `out`
+   and flagged in `out_missing` if it's not NULL, which must have room for (count + 31) / 32 words;
+   doesn't touch dlerror() for missing symbols; returns the number of missing symbols, or -1 on error */
+int vrtld_dlsym_many(void *handle, const char *const *names, void **out, const unsigned int count, unsigned int *out_missing);
+/* load and relocate a module on the loader thread; the returned ticket must always be passed to vrtld_async_finish() */
+vrtld_async_t *vrtld_dlopen_async(const char *fname, int flags, vrtld_async_cb_t cb, void *userdata);
+/* returns 0 while the request is still loading, 1 once it's ready to finish and -1 if it failed */
+int vrtld_async_poll(vrtld_async_t *ticket);
+/* block until the request is done; returns 1 if it's ready to finish and -1 if it failed */
+int vrtld_async_wait(vrtld_async_t *ticket);
+/* wait for the request, run the module's constructors on the calling thread and free the ticket;
+   returns the handle, or NULL if loading failed; all tickets must be finished before vrtld_quit() */
+void *vrtld_async_finish(vrtld_async_t *ticket);
+/* return the calling thread's current error and reset its error flag */
 const char *vrtld_dlerror(void);
 /* reverse lookup symbol name by its address */
 int vrtld_dladdr(void *addr, vrtld_dl_info_t *info);
@@ -63,6 +162,22 @@ void *vrtld_get_base(void *handle);
 unsigned int vrtld_get_size(void *handle);
 /* get module's exidx table, if any */
 void *vrtld_get_exidx(void *handle, unsigned int *out_count);
+/* get hit and miss counts of the unwinder's PC -> exidx entry cache */
+void vrtld_get_exidx_cache_stats(unsigned int *out_hits, unsigned int *out_misses);
+/* get free space, largest free block and number of free blocks in the address window */
+void vrtld_get_address_window_stats(unsigned int *out_free, unsigned int *out_largest_free, unsigned int *out_free_blocks);
+/* get loader statistics */
+void vrtld_get_stats(vrtld_stats_t *out);
+/* get statistics for one module; chain_hist is for the module's own hash table */
+int vrtld_get_module_stats(void *handle, vrtld_module_stats_t *out);
+/* start recording load events into a ring of the last `capacity` events (0 picks a default); clears previous events */
+int vrtld_trace_enable(unsigned int capacity);
+/* stop recording and drop all recorded events */
+void vrtld_trace_disable(void);
+/* write the recorded events as Chrome trace JSON; timestamps are in microseconds of process time */
+int vrtld_trace_dump(vrtld_trace_write_t write, void *userdata);
+/* get number of global symbol lookups that were skipped while relocating module, because the import was already resolved */
+unsigned int vrtld_get_lookups_saved(void *handle);
 
 #ifdef VRTLD_LIBDL_COMPAT
 
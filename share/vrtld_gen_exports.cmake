@@ -0,0 +1,168 @@
+# generates a C source file with a prebuilt vrtld export table
+# usage: cmake -DINPUT=<file> -DOUTPUT=<file.c> [-DFORMAT=LIST|ELF] [-DNM=<nm>] [-DOVERRIDE=ON] -P vrtld_gen_exports.cmake
+#   LIST: INPUT is a text file with one symbol name per line; empty lines and lines starting with # are ignored
+#   ELF:  INPUT is an ELF object or archive; all defined global symbols are exported
+#   OVERRIDE: emit __vrtld_override_exports instead of __vrtld_prebuilt_exports
+
+# string(HEX) needs 3.18
+cmake_minimum_required(VERSION 3.18)
+
+if(NOT DEFINED INPUT OR NOT DEFINED OUTPUT)
+  message(FATAL_ERROR "vrtld_gen_exports: INPUT and OUTPUT must be set")
+endif()
+
+if(NOT DEFINED FORMAT)
+  set(FORMAT LIST)
+endif()
+
+# collect symbol names
+set(names)
+if(FORMAT STREQUAL "ELF")
+  if(NOT NM)
+    set(NM nm)
+  endif()
+  execute_process(
+    COMMAND "${NM}" -g -P --defined-only "${INPUT}"
+    OUTPUT_VARIABLE nm_out
+    RESULT_VARIABLE nm_res
+  )
+  if(NOT nm_res EQUAL 0)
+    message(FATAL_ERROR "vrtld_gen_exports: `${NM}` failed on `${INPUT}`")
+  endif()
+  string(REPLACE "\n" ";" nm_lines "${nm_out}")
+  foreach(line IN LISTS nm_lines)
+    # POSIX format is `name type value size`; archives also have `archive[member]:` lines
+    if(line MATCHES "^([^ ]+) ([TDBRVWGS]) ")
+      list(APPEND names "${CMAKE_MATCH_1}")
+    endif()
+  endforeach()
+elseif(FORMAT STREQUAL "LIST")
+  file(STRINGS "${INPUT}" list_lines)
+  foreach(line IN LISTS list_lines)
+    string(STRIP "${line}" line)
+    if(line AND NOT line MATCHES "^#")
+      list(APPEND names "${line}")
+    endif()
+  endforeach()
+else()
+  message(FATAL_ERROR "vrtld_gen_exports: unknown FORMAT `${FORMAT}`")
+endif()
+
+list(REMOVE_DUPLICATES names)
+list(LENGTH names num_names)
+if(num_names EQUAL 0)
+  message(FATAL_ERROR "vrtld_gen_exports: no symbols found in `${INPUT}`")
+endif()
+
+set(out "/* generated by vrtld_gen_exports.cmake from ${INPUT}; do not edit */\n\n")
+string(APPEND out "#include <stddef.h>\n#include <elf.h>\n#include <vrtld.h>\n\n")
+
+# declare everything by its link name, so that C++ symbols work too
+set(i 0)
+foreach(name IN LISTS names)
+  string(APPEND out "extern char vrtld_exp_${i} __asm__(\"${name}\");\n")
+  math(EXPR i "${i} + 1")
+endforeach()
+string(APPEND out "\n")
+
+if(OVERRIDE)
+  # the override table is indexed at runtime along with everything else in the global symbol table
+  string(APPEND out "static const vrtld_export_t vrtld_override_table[] = {\n")
+  set(i 0)
+  foreach(name IN LISTS names)
+    string(APPEND out "  { \"${name}\", &vrtld_exp_${i} },\n")
+    math(EXPR i "${i} + 1")
+  endforeach()
+  string(APPEND out "};\n\n")
+  string(APPEND out "const vrtld_export_t *__vrtld_override_exports = vrtld_override_table;\n")
+  string(APPEND out "const size_t __vrtld_num_override_exports = ${num_names};\n")
+  file(WRITE "${OUTPUT}" "${out}")
+  return()
+endif()
+
+# GNU hash parameters, roughly the same as what ld picks
+math(EXPR nbucket "${num_names} / 2")
+if(nbucket LESS 1)
+  set(nbucket 1)
+endif()
+set(bloom_bits 32)
+set(bloom_shift 5)
+math(EXPR bloom_want "${num_names} * 8")
+while(bloom_bits LESS bloom_want)
+  math(EXPR bloom_bits "${bloom_bits} * 2")
+  math(EXPR bloom_shift "${bloom_shift} + 1")
+endwhile()
+math(EXPR bloom_size "${bloom_bits} / 32")
+math(EXPR bloom_last "${bloom_size} - 1")
+foreach(w RANGE ${bloom_last})
+  set(bloom_${w} 0)
+endforeach()
+
+# hash everything and sort it into buckets
+set(i 0)
+foreach(name IN LISTS names)
+  string(HEX "${name}" hex)
+  string(LENGTH "${hex}" hexlen)
+  set(h 5381)
+  set(pos 0)
+  while(pos LESS hexlen)
+    string(SUBSTRING "${hex}" ${pos} 2 byte)
+    math(EXPR h "(${h} * 33 + 0x${byte}) & 0xFFFFFFFF")
+    math(EXPR pos "${pos} + 2")
+  endwhile()
+  set(hash_${i} ${h})
+  math(EXPR b "${h} % ${nbucket}")
+  list(APPEND bucket_${b} ${i})
+  math(EXPR w "(${h} / 32) & (${bloom_size} - 1)")
+  math(EXPR bloom_${w} "${bloom_${w}} | (1 << (${h} % 32)) | (1 << ((${h} >> ${bloom_shift}) % 32))")
+  math(EXPR i "${i} + 1")
+endforeach()
+
+# lay out symbols in bucket order; symbol 0 is the NULL symbol
+set(symtab "  { 0, 0, 0, 0, 0, SHN_UNDEF },\n")
+set(strtab "  \"\\0\"\n")
+set(buckets "")
+set(chains "")
+set(symidx 1)
+set(stroff 1)
+math(EXPR nbucket_last "${nbucket} - 1")
+foreach(b RANGE ${nbucket_last})
+  if(NOT DEFINED bucket_${b})
+    string(APPEND buckets "  0,\n")
+    continue()
+  endif()
+  string(APPEND buckets "  ${symidx},\n")
+  list(LENGTH bucket_${b} blen)
+  set(n 0)
+  foreach(i IN LISTS bucket_${b})
+    list(GET names ${i} name)
+    math(EXPR n "${n} + 1")
+    if(n EQUAL blen)
+      math(EXPR chainval "${hash_${i}} | 1" OUTPUT_FORMAT HEXADECIMAL)
+    else()
+      math(EXPR chainval "${hash_${i}} & 0xFFFFFFFE" OUTPUT_FORMAT HEXADECIMAL)
+    endif()
+    string(APPEND chains "  ${chainval}u,\n")
+    string(APPEND symtab "  { ${stroff}, (Elf32_Addr)&vrtld_exp_${i}, 0, ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE), 0, SHN_ABS },\n")
+    string(APPEND strtab "  \"${name}\\0\"\n")
+    string(LENGTH "${name}" namelen)
+    math(EXPR stroff "${stroff} + ${namelen} + 1")
+    math(EXPR symidx "${symidx} + 1")
+  endforeach()
+endforeach()
+
+set(bloom "")
+foreach(w RANGE ${bloom_last})
+  math(EXPR bw "${bloom_${w}}" OUTPUT_FORMAT HEXADECIMAL)
+  string(APPEND bloom "  ${bw}u,\n")
+endforeach()
+
+string(APPEND out "static const Elf32_Sym vrtld_prebuilt_symtab[] = {\n${symtab}};\n\n")
+string(APPEND out "static const char vrtld_prebuilt_strtab[] =\n${strtab};\n\n")
+string(APPEND out "static const unsigned int vrtld_prebuilt_gnuhash[] = {\n")
+string(APPEND out "  ${nbucket}, 1, ${bloom_size}, ${bloom_shift},\n")
+string(APPEND out "  /* bloom */\n${bloom}  /* buckets */\n${buckets}  /* chains */\n${chains}};\n\n")
+string(APPEND out "const vrtld_symtab_t __vrtld_prebuilt_exports = {\n")
+string(APPEND out "  vrtld_prebuilt_symtab,\n  vrtld_prebuilt_strtab,\n  vrtld_prebuilt_gnuhash,\n  ${symidx},\n};\n")
+
+file(WRITE "${OUTPUT}" "${out}")
@@ -10,3 +10,33 @@ set(CMAKE_MODULE_LINKER_FLAGS "-fPIC -shared -nostdlib -Wl,--unresolved-symbols=
 
 # warn user about all of this
 message("!! vrtld dynamic linking support enabled.")
+
+# generator for prebuilt export tables
+set(VRTLD_GEN_EXPORTS "${CMAKE_CURRENT_LIST_DIR}/vrtld_gen_exports.cmake")
+
+# vrtld_add_exports(<target> <LIST|ELF> <file> [OVERRIDE])
+# generate a prebuilt export table from a symbol list or an ELF object/archive and add it to <target>;
+# without OVERRIDE it becomes the main module's export table, which vrtld_init() adopts as is
+function(vrtld_add_exports target format input)
+  # the generator script needs it, better to find out now than at build time
+  if(CMAKE_VERSION VERSION_LESS 3.18)
+    message(FATAL_ERROR "vrtld_add_exports() requires CMake 3.18 or newer")
+  endif()
+  cmake_parse_arguments(ARG "OVERRIDE" "" "" ${ARGN})
+  get_filename_component(input "${input}" ABSOLUTE)
+  if(ARG_OVERRIDE)
+    set(output "${CMAKE_CURRENT_BINARY_DIR}/${target}_vrtld_override_exports.c")
+  else()
+    set(output "${CMAKE_CURRENT_BINARY_DIR}/${target}_vrtld_exports.c")
+  endif()
+  add_custom_command(
+    OUTPUT "${output}"
+    COMMAND "${CMAKE_COMMAND}"
+      "-DINPUT=${input}" "-DOUTPUT=${output}" "-DFORMAT=${format}" "-DNM=${CMAKE_NM}" "-DOVERRIDE=${ARG_OVERRIDE}"
+      -P "${VRTLD_GEN_EXPORTS}"
+    DEPENDS "${input}" "${VRTLD_GEN_EXPORTS}"
+    COMMENT "Generating vrtld export table from ${input}"
+    VERBATIM
+  )
+  target_sources(${target} PRIVATE "${output}")
+endfunction()
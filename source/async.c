@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "vrtld.h"
+#include "util.h"
+#include "loader.h"
+#include "async.h"
+
+#define ASYNC_LOADER_STACK 0x20000
+
+enum async_state {
+  ASYNC_FAILED  = -1,
+  ASYNC_PENDING = 0,
+  ASYNC_READY   = 1,
+};
+
+struct vrtld_async {
+  struct vrtld_async *next;
+  char *fname;
+  int flags;
+  vrtld_async_cb_t cb;
+  void *userdata;
+  int state;
+  dso_t *mod;
+  char error[256];
+};
+
+// guards everything below
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+// signaled when there's something in the queue or the loader should quit
+static pthread_cond_t async_queue_cond = PTHREAD_COND_INITIALIZER;
+// signaled when a ticket is done
+static pthread_cond_t async_done_cond = PTHREAD_COND_INITIALIZER;
+
+static vrtld_async_t *async_head;
+static vrtld_async_t *async_tail;
+static pthread_t async_thread;
+static int async_running;
+static int async_quit;
+static int async_loading; // the loader thread has taken a ticket off the queue and isn't done with it
+
+// must be called with async_lock held
+static void async_complete(vrtld_async_t *ticket, dso_t *mod, const char *error) {
+  ticket->mod = mod;
+  ticket->state = mod ? ASYNC_READY : ASYNC_FAILED;
+  if (!mod)
+    snprintf(ticket->error, sizeof(ticket->error), "%s", error ? error : "unknown error");
+  pthread_cond_broadcast(&async_done_cond);
+}
+
+static void *async_loader(void *arg) {
+  (void)arg;
+
+  pthread_mutex_lock(&async_lock);
+
+  for (;;) {
+    while (!async_head && !async_quit)
+      pthread_cond_wait(&async_queue_cond, &async_lock);
+    if (async_quit)
+      break;
+
+    vrtld_async_t *ticket = async_head;
+    async_head = ticket->next;
+    if (!async_head)
+      async_tail = NULL;
+    async_loading = 1;
+    pthread_mutex_unlock(&async_lock);
+
+    // everything except the constructors happens here; the error is per thread, and whatever
+    // the previous ticket left in it is not this one's
+    vrtld_dlerror();
+    vrtld_loader_lock();
+    dso_t *mod = vrtld_dso_open(ticket->fname, ticket->flags);
+    const char *error = mod ? NULL : vrtld_dlerror();
+    vrtld_loader_unlock();
+
+    // the ticket can be freed as soon as it's marked as done, so grab the callback first
+    const vrtld_async_cb_t cb = ticket->cb;
+    void *userdata = ticket->userdata;
+    pthread_mutex_lock(&async_lock);
+    async_complete(ticket, mod, error);
+    async_loading = 0;
+    pthread_mutex_unlock(&async_lock);
+
+    if (cb)
+      cb(mod ? ASYNC_READY : ASYNC_FAILED, userdata);
+
+    pthread_mutex_lock(&async_lock);
+  }
+
+  pthread_mutex_unlock(&async_lock);
+
+  return NULL;
+}
+
+// must be called with async_lock held
+static int async_start(void) {
+  if (async_running)
+    return 0;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, ASYNC_LOADER_STACK);
+  const int res = pthread_create(&async_thread, &attr, async_loader, NULL);
+  pthread_attr_destroy(&attr);
+  if (res)
+    return -1;
+
+  async_quit = 0;
+  async_running = 1;
+
+  return 0;
+}
+
+void vrtld_async_quit(void) {
+  pthread_mutex_lock(&async_lock);
+
+  if (!async_running) {
+    pthread_mutex_unlock(&async_lock);
+    return;
+  }
+
+  async_quit = 1;
+  pthread_cond_broadcast(&async_queue_cond);
+  pthread_mutex_unlock(&async_lock);
+
+  pthread_join(async_thread, NULL);
+
+  // fail whatever didn't get loaded; the owners still have to finish their tickets
+  pthread_mutex_lock(&async_lock);
+  vrtld_async_t *ticket = async_head;
+  async_head = async_tail = NULL;
+  async_running = 0;
+  while (ticket) {
+    vrtld_async_t *next = ticket->next;
+    const vrtld_async_cb_t cb = ticket->cb;
+    void *userdata = ticket->userdata;
+    async_complete(ticket, NULL, "loader was shut down");
+    if (cb)
+      cb(ASYNC_FAILED, userdata);
+    ticket = next;
+  }
+  pthread_mutex_unlock(&async_lock);
+}
+
+int vrtld_async_busy(void) {
+  pthread_mutex_lock(&async_lock);
+  const int busy = async_head || async_loading;
+  pthread_mutex_unlock(&async_lock);
+  return busy;
+}
+
+vrtld_async_t *vrtld_dlopen_async(const char *fname, int flags, vrtld_async_cb_t cb, void *userdata) {
+  if (!fname) {
+    vrtld_set_error("dlopen_async(): NULL fname");
+    return NULL;
+  }
+
+  vrtld_async_t *ticket = calloc(1, sizeof(*ticket));
+  if (!ticket) {
+    vrtld_set_error("dlopen_async(): could not allocate ticket");
+    return NULL;
+  }
+
+  ticket->fname = vrtld_strdup(fname);
+  if (!ticket->fname) {
+    vrtld_set_error("dlopen_async(): could not allocate ticket");
+    free(ticket);
+    return NULL;
+  }
+
+  ticket->flags = flags;
+  ticket->cb = cb;
+  ticket->userdata = userdata;
+  ticket->state = ASYNC_PENDING;
+
+  pthread_mutex_lock(&async_lock);
+
+  if (async_start()) {
+    pthread_mutex_unlock(&async_lock);
+    vrtld_set_error("dlopen_async(): could not start loader thread");
+    free(ticket->fname);
+    free(ticket);
+    return NULL;
+  }
+
+  if (async_tail)
+    async_tail->next = ticket;
+  else
+    async_head = ticket;
+  async_tail = ticket;
+  pthread_cond_signal(&async_queue_cond);
+
+  pthread_mutex_unlock(&async_lock);
+
+  return ticket;
+}
+
+int vrtld_async_poll(vrtld_async_t *ticket) {
+  if (!ticket) {
+    vrtld_set_error("async_poll(): NULL ticket");
+    return ASYNC_FAILED;
+  }
+
+  pthread_mutex_lock(&async_lock);
+  const int state = ticket->state;
+  pthread_mutex_unlock(&async_lock);
+
+  return state;
+}
+
+int vrtld_async_wait(vrtld_async_t *ticket) {
+  if (!ticket) {
+    vrtld_set_error("async_wait(): NULL ticket");
+    return ASYNC_FAILED;
+  }
+
+  pthread_mutex_lock(&async_lock);
+  while (ticket->state == ASYNC_PENDING)
+    pthread_cond_wait(&async_done_cond, &async_lock);
+  const int state = ticket->state;
+  pthread_mutex_unlock(&async_lock);
+
+  return state;
+}
+
+void *vrtld_async_finish(vrtld_async_t *ticket) {
+  if (!ticket) {
+    vrtld_set_error("async_finish(): NULL ticket");
+    return NULL;
+  }
+
+  dso_t *mod = NULL;
+  if (vrtld_async_wait(ticket) == ASYNC_READY) {
+    // constructors run on whatever thread finishes the ticket
+    mod = ticket->mod;
+    vrtld_loader_lock();
+    if (vrtld_dso_init(mod)) {
+      vrtld_dlclose(mod);
+      mod = NULL;
+    }
+    vrtld_loader_unlock();
+  } else {
+    vrtld_set_error("%s", ticket->error);
+  }
+
+  free(ticket->fname);
+  free(ticket);
+
+  return mod;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// stops the loader thread and fails everything that's still queued
+void vrtld_async_quit(void);
+// whether any ticket is still queued or being loaded
+int vrtld_async_busy(void);
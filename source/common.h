@@ -1,9 +1,11 @@
 #pragma once
 
-#include <vitasdk.h>
 #include <stdint.h>
 #include <elf.h>
 
+#include "vrtld.h"
+#include "platform.h"
+
 enum dso_flags_internal {
   // states
   MOD_RELOCATED   = 1 << 17,
@@ -11,16 +13,17 @@ enum dso_flags_internal {
   MOD_INITIALIZED = 1 << 19,
   // additional flags
   MOD_OWN_SYMTAB  = 1 << 24,
+  MOD_VISITING    = 1 << 25, // set while walking the dependency graph
 };
 
 typedef struct dso_seg {
-  SceUID blkid;
+  plat_block_t blk;
   void *base;
   void *page;
   void *end;
   uint32_t size;
   uint32_t align;
-  uint32_t pflags;
+  uint32_t prot;
 } dso_seg_t;
 
 typedef struct dso {
@@ -40,6 +43,7 @@ typedef struct dso {
 
   char *dynstrtab;
   uint32_t *hashtab;
+  uint32_t *gnuhashtab;
 
   int (**init_array)(void);
   uint32_t num_init;
@@ -50,9 +54,32 @@ typedef struct dso {
   void *exidx;
   uint32_t num_exidx;
 
+  Elf32_Rel *jmprel;
+  uint32_t num_jmprel;
+  uintptr_t *jmprel_got;
+
   Elf32_Rel *extab_rel;
   uint32_t num_extab_rel;
 
+  void *tls_image;      // initial contents of the TLS block, followed by tls_memsz - tls_filesz zeroes
+  uint32_t tls_filesz;
+  uint32_t tls_memsz;
+  uint32_t tls_align;
+  uint32_t tls_modid;   // index in the DTV + 1, or 0 if it has no TLS or isn't relocated yet
+  uint32_t tls_offset;  // offset of the static block from the thread pointer, or 0 if it doesn't have one
+
+  vrtld_module_stats_t stats;
+  uint64_t ident; // content hash, only calculated if VRTLD_RELOC_CACHE is set
+
+  struct gsym *gsyms;
+  uint32_t num_gsyms;
+
+  struct dso_symaddr *addrmap; // defined symbols sorted by address, built on first reverse lookup
+  uint32_t num_addrmap;
+
+  struct dso **deps; // DT_NEEDED modules this one holds a reference to
+  uint32_t num_deps;
+
   struct dso *next;
   struct dso *prev;
 } dso_t;
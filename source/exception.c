@@ -3,30 +3,105 @@
 #include "common.h"
 #include "vrtld.h"
 #include "util.h"
+#include "modmap.h"
+#include "loader.h"
+#include "exception.h"
+
+// number of cached PC -> exidx entry mappings; must be a power of 2
+#define EXIDX_CACHE_SIZE 256
 
 // own exidx section
 extern uintptr_t __exidx_start;
 extern uintptr_t __exidx_end;
 
+typedef struct exidx_entry {
+  uint32_t fnoffset; // prel31 offset to the start of the function
+  uint32_t content;
+} exidx_entry_t;
+
+// each slot is (entry address << 32) | pc, so that it can be read and written atomically
+static uint64_t exidx_cache[EXIDX_CACHE_SIZE];
+static uint32_t exidx_cache_hits;
+static uint32_t exidx_cache_misses;
+
+static inline uint32_t exidx_cache_slot(const uintptr_t pc) {
+  // instructions are at least 2-byte aligned, so skip the lowest bit
+  return (((uint32_t)(pc >> 1) * 2654435761u) >> 24) & (EXIDX_CACHE_SIZE - 1);
+}
+
+static inline uintptr_t exidx_fn_addr(const exidx_entry_t *entry) {
+  // sign extend the prel31 offset
+  const int32_t ofs = (int32_t)(entry->fnoffset << 1) >> 1;
+  return (uintptr_t)&entry->fnoffset + ofs;
+}
+
+static const exidx_entry_t *exidx_search(const exidx_entry_t *table, const uint32_t count, const uintptr_t pc) {
+  // find the last entry that starts at or before pc
+  uint32_t lo = 0, hi = count;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    if (exidx_fn_addr(&table[mid]) <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo ? &table[lo - 1] : NULL;
+}
+
+void vrtld_exidx_cache_flush(void) {
+  for (uint32_t i = 0; i < EXIDX_CACHE_SIZE; ++i)
+    __atomic_store_n(&exidx_cache[i], 0, __ATOMIC_RELAXED);
+}
+
+void vrtld_get_exidx_cache_stats(unsigned int *out_hits, unsigned int *out_misses) {
+  if (out_hits) *out_hits = __atomic_load_n(&exidx_cache_hits, __ATOMIC_RELAXED);
+  if (out_misses) *out_misses = __atomic_load_n(&exidx_cache_misses, __ATOMIC_RELAXED);
+}
+
 void *__gnu_Unwind_Find_exidx(void *pc, uint32_t *pcount) __attribute__((used));
 
 void *__gnu_Unwind_Find_exidx(void *pc, uint32_t *pcount) {
-  // find which loaded module this belongs to
-  const dso_t *mod = NULL;
-  for (mod = vrtld_dsolist.next; mod; mod = mod->next) {
-    if (pc >= mod->base && pc < mod->base + mod->size)
-      break;
+  const uintptr_t upc = (uintptr_t)pc;
+  const uint32_t slot = exidx_cache_slot(upc);
+
+  // the unwinder is fine with a table that only has the entry it's looking for
+  const uint64_t cached = __atomic_load_n(&exidx_cache[slot], __ATOMIC_RELAXED);
+  if (cached && (uint32_t)cached == (uint32_t)upc) {
+    __atomic_fetch_add(&exidx_cache_hits, 1, __ATOMIC_RELAXED);
+    *pcount = 1;
+    return (void *)(uintptr_t)(cached >> 32);
   }
 
+  __atomic_fetch_add(&exidx_cache_misses, 1, __ATOMIC_RELAXED);
+
+  // find which loaded module this belongs to; the lock keeps it from being unloaded until we're done
+  vrtld_lookup_lock();
+  const dso_t *mod = modmap_find(pc);
+
+  const exidx_entry_t *table;
+  uint32_t count;
   if (mod && mod->exidx) {
-    void *start = mod->exidx;
-    *pcount = mod->num_exidx;
-    return start;
+    table = mod->exidx;
+    count = mod->num_exidx;
+  } else {
+    // if this is not from a DSO, default to main exidx
+    const uintptr_t start = (uintptr_t)&__exidx_start;
+    const uintptr_t end = (uintptr_t)&__exidx_end;
+    table = (const exidx_entry_t *)start;
+    count = (end - start) / 8;
   }
 
-  // if this is not from a DSO, default to main exidx
-  const uintptr_t start = (uintptr_t)&__exidx_start;
-  const uintptr_t end = (uintptr_t)&__exidx_end;
-  *pcount = (end - start) / 8;
-  return (void *)start;
+  const exidx_entry_t *entry = exidx_search(table, count, upc);
+  if (!entry) {
+    vrtld_lookup_unlock();
+    // let the unwinder figure it out
+    *pcount = count;
+    return (void *)table;
+  }
+
+  __atomic_store_n(&exidx_cache[slot], ((uint64_t)(uintptr_t)entry << 32) | (uint32_t)upc, __ATOMIC_RELAXED);
+  vrtld_lookup_unlock();
+
+  *pcount = 1;
+  return (void *)entry;
 }
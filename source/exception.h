@@ -0,0 +1,4 @@
+#pragma once
+
+// drop all cached unwind entries; must be called whenever a module is unloaded
+void vrtld_exidx_cache_flush(void);
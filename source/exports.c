@@ -8,6 +8,9 @@
 #include "vrtld.h"
 #include "util.h"
 #include "exports.h"
+#include "gsym.h"
+#include "lookup.h"
+#include "loader.h"
 
 int vrtld_symtab_from_exports(
   const vrtld_export_t *exp,
@@ -16,22 +19,23 @@ int vrtld_symtab_from_exports(
   char **out_strtab,
   uint32_t **out_hashtab
 ) {
-  const uintptr_t base = (uintptr_t)&_start;
   const uint32_t nchain = numexp + 1; // + NULL symbol
   const uint32_t nbucket = nchain * 2 + 1; // FIXME: is this even right
   char *strtab = NULL;
   Elf32_Sym *symtab = NULL;
   uint32_t *hashtab = NULL;
 
-  if (!exp || !numexp || !out_symtab || !out_strtab || !out_hashtab)
+  if (!exp || numexp <= 0 || !out_symtab || !out_strtab || !out_hashtab) {
+    vrtld_set_error("vrtld_set_main_exports(): empty export table");
     return -1;
+  }
 
   // bucket array + chain array + two ints for lengths
   hashtab = calloc(nchain + nbucket + 2, sizeof(uint32_t));
-  if (!hashtab) goto _error;
+  if (!hashtab) goto _nomem;
 
   symtab = calloc(nchain, sizeof(Elf32_Sym));
-  if (!symtab) goto _error;
+  if (!symtab) goto _nomem;
 
   // calculate string table size
   size_t strtabsz = 1; // for undefined symname, "\0"
@@ -39,7 +43,7 @@ int vrtld_symtab_from_exports(
     strtabsz += 1 + strlen(exp[i].name);
 
   strtab = malloc(strtabsz);
-  if (!strtab) goto _error;
+  if (!strtab) goto _nomem;
 
   // first entry is an empty string
   size_t strptr = 1;
@@ -48,11 +52,22 @@ int vrtld_symtab_from_exports(
   // the rest are just symbol names packed together
   // fill symtab while we're at it
   for (int i = 0; i < numexp; ++i) {
+#if UINTPTR_MAX > UINT32_MAX
+    // st_value is only 32 bits wide; on a 64-bit host the program has to be linked with -no-pie
+    // to keep its exports below 4GB
+    if ((uintptr_t)exp[i].addr_rx > UINT32_MAX) {
+      vrtld_set_error("Export `%s` is at %p, which doesn't fit in an ELF32 symbol", exp[i].name, exp[i].addr_rx);
+      goto _error;
+    }
+#endif
     const size_t slen = strlen(exp[i].name) + 1;
     memcpy(strtab + strptr, exp[i].name, slen);
     symtab[i + 1].st_name = strptr;
-    symtab[i + 1].st_shndx = SHN_ABS; // who fucking knows if this is correct
-    symtab[i + 1].st_value = (uintptr_t)exp[i].addr_rx - base;
+    // these are absolute addresses, so that they don't get relocated by the main module base
+    symtab[i + 1].st_shndx = SHN_ABS;
+    // the global symbol table only takes global symbols
+    symtab[i + 1].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+    symtab[i + 1].st_value = (uintptr_t)exp[i].addr_rx;
     strptr += slen;
   }
   // should be filled by now
@@ -88,6 +103,8 @@ int vrtld_symtab_from_exports(
 
   return 0;
 
+_nomem:
+  vrtld_set_error("Could not allocate symbol table for %d exports", numexp);
 _error:
   free(hashtab);
   free(symtab);
@@ -95,34 +112,144 @@ _error:
   return -1;
 }
 
+// must be called with the lookup lock held exclusively
+static void vrtld_free_main_symtab(void) {
+  gsym_remove(&vrtld_dsolist);
+  vrtld_free_addrmap(&vrtld_dsolist);
+  if (vrtld_dsolist.flags & MOD_OWN_SYMTAB) {
+    free(vrtld_dsolist.dynsym);
+    free(vrtld_dsolist.dynstrtab);
+    free(vrtld_dsolist.hashtab);
+    vrtld_dsolist.flags &= ~MOD_OWN_SYMTAB;
+  }
+  vrtld_dsolist.dynsym = NULL;
+  vrtld_dsolist.dynstrtab = NULL;
+  vrtld_dsolist.hashtab = NULL;
+  vrtld_dsolist.gnuhashtab = NULL;
+  vrtld_dsolist.num_dynsym = 0;
+  vrtld_dsolist.ident = 0;
+}
+
+// lookups trust the GNU hash table of a prebuilt symtab completely, so make sure it's one;
+// returns what's wrong with it, or NULL if nothing is
+static const char *vrtld_check_symtab(const vrtld_symtab_t *tab) {
+  if (!tab || !tab->symtab || !tab->strtab || !tab->gnuhash || tab->num_syms <= 1)
+    return "missing tables or symbols";
+
+  const uint32_t nbuckets = tab->gnuhash[0];
+  const uint32_t symoffset = tab->gnuhash[1];
+  const uint32_t bloom_size = tab->gnuhash[2];
+  if (!nbuckets || !symoffset || symoffset >= tab->num_syms || !bloom_size || (bloom_size & (bloom_size - 1)))
+    return "malformed GNU hash header";
+
+  // every hashed symbol has to be in the chain of its own bucket, with the chains laid out back to back
+  // in bucket order; that's what the sorting done by vrtld_add_exports() is for
+  const Elf32_Sym *syms = tab->symtab;
+  const uint32_t *buckets = &tab->gnuhash[4 + bloom_size];
+  const uint32_t *chain = &buckets[nbuckets];
+  uint32_t next = symoffset;
+  for (uint32_t b = 0; b < nbuckets; ++b) {
+    if (!buckets[b])
+      continue;
+    if (buckets[b] != next)
+      return "symbols are not sorted by hash bucket";
+    for (;;) {
+      if (next >= tab->num_syms)
+        return "a hash chain runs past the last symbol";
+      const uint32_t hash = vrtld_gnu_hash((const uint8_t *)tab->strtab + syms[next].st_name);
+      if (hash % nbuckets != b || (hash | 1) != (chain[next - symoffset] | 1))
+        return "symbols are not sorted by hash bucket";
+      if (chain[next++ - symoffset] & 1)
+        break;
+    }
+  }
+  if (next != tab->num_syms)
+    return "some symbols aren't in any hash chain";
+
+  return NULL;
+}
+
+int vrtld_set_main_symtab(const vrtld_symtab_t *tab) {
+  const char *invalid = vrtld_check_symtab(tab);
+  if (invalid) {
+    DEBUG_PRINTF("vrtld_set_main_symtab(%p): invalid table: %s\n", tab, invalid);
+    vrtld_set_error("vrtld_set_main_symtab(): invalid table: %s", invalid);
+    return -1;
+  }
+
+  DEBUG_PRINTF("vrtld_set_main_symtab(%p): set main DSO table (%u)\n", tab, tab->num_syms);
+
+  // lookups might be going on, so the swap has to be done while nobody is looking
+  vrtld_loader_lock();
+  vrtld_lookup_lock_exclusive();
+
+  vrtld_free_main_symtab();
+
+  // everything is already laid out and hashed, so just point the main module at it
+  vrtld_dsolist.num_dynsym = tab->num_syms;
+  vrtld_dsolist.dynsym = (Elf32_Sym *)tab->symtab;
+  vrtld_dsolist.dynstrtab = (char *)tab->strtab;
+  vrtld_dsolist.gnuhashtab = (uint32_t *)tab->gnuhash;
+
+  vrtld_dsolist.flags |= VRTLD_GLOBAL;
+  const int ret = gsym_add(&vrtld_dsolist);
+  if (ret) {
+    vrtld_free_main_symtab();
+    vrtld_set_error("Could not add main exports to the global symbol table");
+  }
+
+  vrtld_lookup_unlock();
+  vrtld_loader_unlock();
+
+  return ret;
+}
+
 int vrtld_set_main_exports(const vrtld_export_t *exp, const int numexp) {
   Elf32_Sym *symtab = NULL;
   uint32_t *hashtab = NULL;
   char *strtab = NULL;
+  int tried = 0;
+
+  // prefer the prebuilt table if there is one and we didn't get a custom table
+  if (exp == NULL && &__vrtld_prebuilt_exports) {
+    DEBUG_PRINTF("vrtld_set_main_exports(%p, %d): __vrtld_prebuilt_exports detected\n", exp, numexp);
+    if (vrtld_set_main_symtab(&__vrtld_prebuilt_exports) == 0)
+      return 0;
+    tried = 1;
+  }
 
   if (exp != NULL) {
     // if we got a custom export table, turn it into a symtab and use it
-    if (vrtld_symtab_from_exports(exp, numexp, &symtab, &strtab, &hashtab) == 0)
-      vrtld_dsolist.flags |= MOD_OWN_SYMTAB; // to free it later
+    vrtld_symtab_from_exports(exp, numexp, &symtab, &strtab, &hashtab);
+    tried = 1;
   }
 
   // didn't get a custom table, try the user-defined exports table
   if (symtab == NULL) {
     if (&__vrtld_exports && &__vrtld_num_exports && __vrtld_exports) {
-      DEBUG_PRINTF("vrtld_set_main_exports(%p, %d): __vrtld_exports=%p detected (%u)\n", exp, numexp, __vrtld_exports, __vrtld_num_exports);
-      if (vrtld_symtab_from_exports(__vrtld_exports, __vrtld_num_exports, &symtab, &strtab, &hashtab) == 0)
-        vrtld_dsolist.flags |= MOD_OWN_SYMTAB; // to free it later
+      DEBUG_PRINTF("vrtld_set_main_exports(%p, %d): __vrtld_exports=%p detected (%u)\n", exp, numexp, __vrtld_exports, (unsigned)__vrtld_num_exports);
+      vrtld_symtab_from_exports(__vrtld_exports, __vrtld_num_exports, &symtab, &strtab, &hashtab);
+      tried = 1;
     }
   }
 
-  // didn't get anything -- bail
+  // didn't get anything -- bail; a table that couldn't be converted has already said why
   if (symtab == NULL) {
     DEBUG_PRINTF("vrtld_set_main_exports(%p, %d): failed\n", exp, numexp);
+    if (!tried)
+      vrtld_set_error("vrtld_set_main_exports(): no export table given and none built in");
     return -1;
   }
 
   DEBUG_PRINTF("vrtld_set_main_exports(%p, %d): set main DSO table\n", exp, numexp);
 
+  vrtld_loader_lock();
+  vrtld_lookup_lock_exclusive();
+
+  // the old table is going away, so take it out of the global symbol table first
+  vrtld_free_main_symtab();
+
+  vrtld_dsolist.flags |= MOD_OWN_SYMTAB; // to free it later
   vrtld_dsolist.num_dynsym = hashtab[1]; // nchain == number of symbols
   vrtld_dsolist.dynsym = symtab;
   vrtld_dsolist.hashtab = hashtab;
@@ -130,6 +257,15 @@ int vrtld_set_main_exports(const vrtld_export_t *exp, const int numexp) {
 
   // we now have symbols for other libs to use, so we need to mark ourselves as GLOBAL
   vrtld_dsolist.flags |= VRTLD_GLOBAL;
+  const int ret = gsym_add(&vrtld_dsolist);
+  if (ret) {
+    // frees the tables we just made as well
+    vrtld_free_main_symtab();
+    vrtld_set_error("Could not add main exports to the global symbol table");
+  }
 
-  return 0;
+  vrtld_lookup_unlock();
+  vrtld_loader_unlock();
+
+  return ret;
 }
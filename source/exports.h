@@ -8,6 +8,9 @@
 extern __attribute__((weak)) const vrtld_export_t *__vrtld_exports;
 extern __attribute__((weak)) const size_t __vrtld_num_exports;
 
+// optional prebuilt global exports, generated by vrtld_add_exports(); preferred over __vrtld_exports
+extern __attribute__((weak)) const vrtld_symtab_t __vrtld_prebuilt_exports;
+
 // optional user-defined global exports that will override everything
 extern __attribute__((weak)) const vrtld_export_t *__vrtld_override_exports;
 extern __attribute__((weak)) const size_t __vrtld_num_override_exports;
@@ -21,3 +24,4 @@ int vrtld_symtab_from_exports(
 );
 
 int vrtld_set_main_exports(const vrtld_export_t *exp, const int numexp);
+int vrtld_set_main_symtab(const vrtld_symtab_t *tab);
@@ -0,0 +1,234 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <elf.h>
+
+#include "common.h"
+#include "vrtld.h"
+#include "util.h"
+#include "exports.h"
+#include "lookup.h"
+#include "gsym.h"
+#include "tls.h"
+
+// a chained hash table holding every symbol that other modules can resolve against;
+// each chain is kept sorted by priority, so the first match is always the right one.
+// the lowest bit of the stored GNU hash is always set, so that the hashes can be taken
+// straight from a module's .gnu.hash chains, where that bit marks the end of a chain
+
+#define GSYM_MIN_BUCKETS 1024
+
+#define GSYM_HASH(name) (vrtld_gnu_hash((const uint8_t *)(name)) | 1)
+#define GSYM_BUCKET(hash, num_buckets) (((hash) >> 1) & ((num_buckets) - 1))
+
+// override table beats everything, then main module, then the newest loaded module
+#define GSYM_PRIO_OVERRIDE UINT32_MAX
+#define GSYM_PRIO_MAIN     (UINT32_MAX - 1)
+
+typedef struct gsym {
+  struct gsym *next;
+  const char *name;
+  void *addr;
+  uint32_t hash;
+  uint32_t prio;
+} gsym_t;
+
+static gsym_t **gsym_buckets;
+static uint32_t gsym_num_buckets;
+static uint32_t gsym_count;
+static uint32_t gsym_serial;
+
+static gsym_t *gsym_overrides;
+static uint32_t gsym_num_overrides;
+
+static void gsym_link(gsym_t **buckets, const uint32_t num_buckets, gsym_t *gs) {
+  gsym_t **p = &buckets[GSYM_BUCKET(gs->hash, num_buckets)];
+  // insert after everything with the same or higher priority
+  while (*p && (*p)->prio >= gs->prio)
+    p = &(*p)->next;
+  gs->next = *p;
+  *p = gs;
+}
+
+static void gsym_unlink(gsym_t *gs) {
+  gsym_t **p = &gsym_buckets[GSYM_BUCKET(gs->hash, gsym_num_buckets)];
+  while (*p && *p != gs)
+    p = &(*p)->next;
+  if (*p)
+    *p = gs->next;
+  gs->next = NULL;
+}
+
+static int gsym_reserve(const uint32_t count) {
+  uint32_t num_buckets = gsym_num_buckets ? gsym_num_buckets : GSYM_MIN_BUCKETS;
+  while (num_buckets < count)
+    num_buckets <<= 1;
+
+  if (num_buckets == gsym_num_buckets)
+    return 0;
+
+  gsym_t **buckets = calloc(num_buckets, sizeof(*buckets));
+  if (!buckets) {
+    // we can live with longer chains if there's already a table
+    DEBUG_PRINTF("gsym_reserve(%u): could not allocate %u buckets\n", count, num_buckets);
+    return gsym_buckets ? 0 : -1;
+  }
+
+  // rehash whatever we already have
+  for (uint32_t i = 0; i < gsym_num_buckets; ++i) {
+    gsym_t *gs = gsym_buckets[i];
+    while (gs) {
+      gsym_t *next = gs->next;
+      gsym_link(buckets, num_buckets, gs);
+      gs = next;
+    }
+  }
+
+  free(gsym_buckets);
+  gsym_buckets = buckets;
+  gsym_num_buckets = num_buckets;
+
+  DEBUG_PRINTF("gsym_reserve(%u): table now has %u buckets\n", count, num_buckets);
+
+  return 0;
+}
+
+static void gsym_insert(gsym_t *gs, const char *name, const uint32_t hash, void *addr, const uint32_t prio) {
+  gs->name = name;
+  gs->addr = addr;
+  gs->hash = hash;
+  gs->prio = prio;
+  gsym_link(gsym_buckets, gsym_num_buckets, gs);
+  gsym_count++;
+}
+
+static inline int gsym_is_export(const Elf32_Sym *sym) {
+  const int bind = ELF32_ST_BIND(sym->st_info);
+  // TLS symbols don't have an address to put in here
+  return sym->st_shndx != SHN_UNDEF && sym->st_name && (bind == STB_GLOBAL || bind == STB_WEAK)
+    && ELF32_ST_TYPE(sym->st_info) != STT_TLS;
+}
+
+int gsym_add(dso_t *mod) {
+  if (mod->gsyms || !mod->dynsym || !mod->dynstrtab)
+    return 0;
+
+  uint32_t num = 0;
+  for (uint32_t i = 1; i < mod->num_dynsym; ++i)
+    num += gsym_is_export(&mod->dynsym[i]);
+
+  if (!num)
+    return 0;
+
+  if (gsym_reserve(gsym_count + num))
+    return -1;
+
+  mod->gsyms = calloc(num, sizeof(gsym_t));
+  if (!mod->gsyms) {
+    DEBUG_PRINTF("`%s`: could not allocate %u global symbols\n", mod->name, num);
+    return -1;
+  }
+
+  // if the module has a GNU hashtab, we already know the hashes of everything past symoffset
+  const uint32_t *gnuchain = NULL;
+  uint32_t gnuoffset = mod->num_dynsym;
+  if (mod->gnuhashtab) {
+    gnuoffset = mod->gnuhashtab[1];
+    gnuchain = &mod->gnuhashtab[4 + mod->gnuhashtab[2] + mod->gnuhashtab[0]];
+  }
+
+  const uint32_t prio = (mod == &vrtld_dsolist) ? GSYM_PRIO_MAIN : ++gsym_serial;
+  for (uint32_t i = 1, n = 0; i < mod->num_dynsym; ++i) {
+    const Elf32_Sym *sym = &mod->dynsym[i];
+    if (gsym_is_export(sym)) {
+      const char *name = mod->dynstrtab + sym->st_name;
+      const uint32_t hash = (i >= gnuoffset) ? (gnuchain[i - gnuoffset] | 1) : GSYM_HASH(name);
+      gsym_insert(&mod->gsyms[n++], name, hash, vrtld_sym_addr(mod, sym), prio);
+    }
+  }
+  mod->num_gsyms = num;
+
+  DEBUG_PRINTF("`%s`: added %u global symbols\n", mod->name, num);
+
+  return 0;
+}
+
+void gsym_remove(dso_t *mod) {
+  if (!mod->gsyms)
+    return;
+
+  for (uint32_t i = 0; i < mod->num_gsyms; ++i)
+    gsym_unlink(&mod->gsyms[i]);
+
+  gsym_count -= mod->num_gsyms;
+  free(mod->gsyms);
+  mod->gsyms = NULL;
+  mod->num_gsyms = 0;
+}
+
+int gsym_add_overrides(void) {
+  if (gsym_overrides)
+    return 0;
+
+  if (!(&__vrtld_override_exports && &__vrtld_num_override_exports && __vrtld_override_exports))
+    return 0;
+
+  const uint32_t num = __vrtld_num_override_exports;
+  if (!num || gsym_reserve(gsym_count + num))
+    return -1;
+
+  gsym_overrides = calloc(num, sizeof(gsym_t));
+  if (!gsym_overrides)
+    return -1;
+
+  for (uint32_t i = 0; i < num; ++i) {
+    const vrtld_export_t *exp = &__vrtld_override_exports[i];
+    gsym_insert(&gsym_overrides[i], exp->name, GSYM_HASH(exp->name), exp->addr_rx, GSYM_PRIO_OVERRIDE);
+  }
+  gsym_num_overrides = num;
+
+  DEBUG_PRINTF("gsym_add_overrides(): added %u override symbols\n", num);
+
+  return 0;
+}
+
+void gsym_clear(void) {
+  free(gsym_overrides);
+  gsym_overrides = NULL;
+  gsym_num_overrides = 0;
+  free(gsym_buckets);
+  gsym_buckets = NULL;
+  gsym_num_buckets = 0;
+  gsym_count = 0;
+}
+
+void *gsym_lookup(const char *symname, int *out_is_override) {
+  if (!gsym_buckets)
+    return NULL;
+
+  const uint32_t hash = GSYM_HASH(symname);
+  for (const gsym_t *gs = gsym_buckets[GSYM_BUCKET(hash, gsym_num_buckets)]; gs; gs = gs->next) {
+    if (gs->hash == hash && !strcmp(symname, gs->name)) {
+      if (out_is_override)
+        *out_is_override = (gs->prio == GSYM_PRIO_OVERRIDE);
+      return gs->addr;
+    }
+  }
+
+  return NULL;
+}
+
+uint32_t gsym_priority(const dso_t *mod) {
+  // all symbols of a module are inserted with the same priority
+  return mod->gsyms ? mod->gsyms[0].prio : 0;
+}
+
+void gsym_chain_hist(uint32_t *hist, const uint32_t num_hist) {
+  memset(hist, 0, sizeof(*hist) * num_hist);
+  for (uint32_t i = 0; i < gsym_num_buckets; ++i) {
+    uint32_t len = 0;
+    for (const gsym_t *gs = gsym_buckets[i]; gs; gs = gs->next)
+      ++len;
+    hist[(len < num_hist) ? len : num_hist - 1]++;
+  }
+}
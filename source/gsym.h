@@ -0,0 +1,17 @@
+#pragma once
+
+#include "common.h"
+
+// global symbol table: exports of all GLOBAL modules plus the override table
+
+int gsym_add(dso_t *mod);
+void gsym_remove(dso_t *mod);
+int gsym_add_overrides(void);
+void gsym_clear(void);
+
+void *gsym_lookup(const char *symname, int *out_is_override);
+
+// where a module's symbols rank in lookups, higher wins; 0 if it has none in the table
+uint32_t gsym_priority(const dso_t *mod);
+
+void gsym_chain_hist(uint32_t *hist, const uint32_t num_hist);
@@ -3,9 +3,8 @@
 #include <malloc.h>
 #include <limits.h>
 #include <elf.h>
-#include <assert.h>
-#include <vitasdk.h>
-#include <kubridge.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "vrtld.h"
 #include "loader.h"
@@ -14,56 +13,160 @@
 #include "reloc.h"
 #include "lookup.h"
 #include "vma.h"
+#include "gsym.h"
+#include "modmap.h"
+#include "pathtab.h"
+#include "exception.h"
+#include "stats.h"
+#include "trace.h"
+#include "tls.h"
 
-#ifndef SCE_KERNEL_MEMBLOCK_TYPE_USER_RX
-#define SCE_KERNEL_MEMBLOCK_TYPE_USER_RX 0x0C20D050
-#endif
+// segments that can't be written to directly are read in chunks of this size
+#define DSO_READ_CHUNK 0x10000
 
-#ifndef SCE_KERNEL_MEMBLOCK_TYPE_USER_R
-#define SCE_KERNEL_MEMBLOCK_TYPE_USER_R SCE_KERNEL_MEMBLOCK_TYPE_USER_MAIN_R
-#endif
+// source for zeroing write-protected memory
+static const uint8_t dso_zero_page[ALIGN_PAGE];
+
+// max threads that read dependencies at the same time
+#define DSO_LOAD_WORKERS 4
+#define DSO_LOAD_WORKER_STACK 0x10000
 
 // total modules loaded
 static int vrtld_num_modules = 0;
 
+// guards the address space allocator and the module counter while dependencies are loading
+static pthread_mutex_t dso_load_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// serializes everything that changes the module list; recursive, since constructors can dlopen
+static pthread_mutex_t dso_list_lock;
+static pthread_once_t dso_list_lock_once = PTHREAD_ONCE_INIT;
+// thread that holds dso_list_lock and how many times it took it, so that constructors can be told apart
+static uint32_t dso_list_owner;
+static uint32_t dso_list_depth;
+
+// guards the module list and everything indexed from it against lookups; only taken for writing
+// by whoever holds dso_list_lock, and only while modules are being linked or unlinked
+static pthread_rwlock_t dso_list_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+// directories to look for DT_NEEDED libraries in, separated by ';'
+static char *dso_search_path = NULL;
+
+// a module that is being read from disk by one of the workers
+typedef struct dso_job {
+  char *path;
+  char *modname;
+  struct stat st;
+  int has_st;
+  dso_t *mod;
+} dso_job_t;
+
+typedef struct dso_batch {
+  dso_job_t *jobs;
+  uint32_t num_jobs;
+  uint32_t next_job;
+} dso_batch_t;
+
+// helper threads for one dso_load_deps() call, started on the first level that needs them
+// and reused for every level after that
+typedef struct dso_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t work; // there's a new batch, or it's time to quit
+  pthread_cond_t done; // the last busy worker is done with the batch
+  pthread_t threads[DSO_LOAD_WORKERS];
+  uint32_t num_threads;
+  dso_batch_t *batch;
+  uint32_t serial;     // bumped for every new batch
+  uint32_t busy;       // workers that haven't finished the current batch yet
+  int quit;
+} dso_pool_t;
+
+// a dependency that is waiting for its job to finish
+typedef struct dso_edge {
+  dso_t *from;
+  uint32_t job;
+} dso_edge_t;
+
 static inline uint32_t dso_convert_pflags(const uint32_t pflags) {
   switch (pflags) {
-    case PF_R:        return SCE_KERNEL_MEMBLOCK_TYPE_USER_R;
-    case PF_R | PF_X: return SCE_KERNEL_MEMBLOCK_TYPE_USER_RX;
-    default:          return SCE_KERNEL_MEMBLOCK_TYPE_USER_RW; // assume rw
-  }
-}
-
-static int dso_alloc_seg_memblock(dso_seg_t *seg) {
-  SceKernelAllocMemBlockKernelOpt opt;
-  memset(&opt, 0, sizeof(opt));
-  opt.size = sizeof(opt);
-  opt.attr = 0x1;
-  opt.field_C = (uintptr_t)seg->page;
-  const SceUID blkid = kuKernelAllocMemBlock("dso_seg", seg->pflags, seg->size, &opt);
-  if (blkid >= 0) {
-    // the segment should be where we expect it to be
-    void *outptr = NULL;
-    sceKernelGetMemBlockBase(blkid, &outptr);
-    assert(outptr == seg->page);
-    seg->blkid = blkid;
-    // zero it out; unfortunately there's no kuKernelCpuUnrestrictedMemset
-    uint8_t *zero = calloc(1, seg->size);
-    if (zero) {
-      kuKernelCpuUnrestrictedMemcpy(seg->page, zero, seg->size);
-      free(zero);
-    }
-    return SCE_TRUE;
+    case PF_R:        return PLAT_PROT_R;
+    case PF_R | PF_X: return PLAT_PROT_RX;
+    default:          return PLAT_PROT_RW; // assume rw
   }
-  return SCE_FALSE;
 }
 
-static dso_t *dso_load(const char *filename, const char *modname) {
-  size_t file_size = 0;
-  Elf32_Ehdr *ehdr = NULL;
+static void dso_zero_range(const dso_seg_t *seg, uint8_t *start, uint8_t *end) {
+  if (start >= end)
+    return;
+
+  if (seg->prot == PLAT_PROT_RW) {
+    memset(start, 0, end - start);
+    return;
+  }
+
+  // unfortunately there's no unrestricted memset
+  while (start < end) {
+    const size_t size = (size_t)(end - start) < sizeof(dso_zero_page) ? (size_t)(end - start) : sizeof(dso_zero_page);
+    plat_write_protected(start, dso_zero_page, size);
+    start += size;
+  }
+}
+
+static void dso_zero_seg(const dso_seg_t *seg, const Elf32_Phdr *phdr) {
+  // only the parts that aren't going to be read from the file: the padding before
+  // the segment start and everything after p_filesz, which includes the BSS
+  dso_zero_range(seg, seg->page, seg->base);
+  dso_zero_range(seg, (uint8_t *)seg->base + phdr->p_filesz, seg->end);
+}
+
+static int dso_read_at(FILE *fd, const size_t offset, void *dst, const size_t size) {
+  if (!size)
+    return 0;
+  if (fseek(fd, offset, SEEK_SET) != 0)
+    return -1;
+  return (fread(dst, size, 1, fd) == 1) ? 0 : -1;
+}
+
+static void *dso_read_alloc(FILE *fd, const size_t offset, const size_t size) {
+  void *buf = malloc(size ? size : 1);
+  if (buf && dso_read_at(fd, offset, buf, size)) {
+    free(buf);
+    buf = NULL;
+  }
+  return buf;
+}
+
+static int dso_read_seg(dso_t *mod, FILE *fd, const dso_seg_t *seg, const Elf32_Phdr *phdr, uint8_t *chunk) {
+  uint64_t t = stats_now();
+
+  // RW segments can be read straight into place
+  if (seg->prot == PLAT_PROT_RW) {
+    const int ret = dso_read_at(fd, phdr->p_offset, seg->base, phdr->p_filesz);
+    stats_add_time(mod, VRTLD_PHASE_IO, t);
+    return ret;
+  }
+
+  // everything else is write protected, so it has to go through a bounce buffer
+  for (size_t ofs = 0; ofs < phdr->p_filesz; ofs += DSO_READ_CHUNK) {
+    const size_t size = (phdr->p_filesz - ofs < DSO_READ_CHUNK) ? (phdr->p_filesz - ofs) : DSO_READ_CHUNK;
+    if (dso_read_at(fd, phdr->p_offset + ofs, chunk, size))
+      return -1;
+    stats_add_time(mod, VRTLD_PHASE_IO, t);
+    t = stats_now();
+    plat_write_protected((uint8_t *)seg->base + ofs, chunk, size);
+    stats_add_time(mod, VRTLD_PHASE_COPY, t);
+    t = stats_now();
+  }
+
+  return 0;
+}
+
+static dso_t *dso_load_file(const char *filename, const char *modname) {
+  Elf32_Ehdr ehdr;
   Elf32_Phdr *phdr = NULL;
   Elf32_Shdr *shdr = NULL;
   char *shstrtab = NULL;
+  uint8_t *chunk = NULL;
+  uint64_t t = stats_now();
 
   FILE *fd = fopen(filename, "rb");
   if (!fd) {
@@ -71,54 +174,57 @@ static dso_t *dso_load(const char *filename, const char *modname) {
     return NULL;
   }
 
-  fseek(fd, 0, SEEK_END);
-  file_size = ftell(fd);
-  fseek(fd, 0, SEEK_SET);
-
-  DEBUG_PRINTF("`%s`: total elf size is %u\n", modname, file_size);
-
-  ehdr = memalign(ALIGN_PAGE, file_size);
-  if (!ehdr) {
-    vrtld_set_error("Could not allocate %u bytes for `%s`", file_size, modname);
-    fclose(fd);
-    return NULL;
-  }
-
   dso_t *mod = calloc(1, sizeof(dso_t));
   if (!mod) {
     vrtld_set_error("Could not allocate dynmod header");
-    free(ehdr);
     fclose(fd);
     return NULL;
   }
 
-  fread(ehdr, file_size, 1, fd);
-  fclose(fd);
-
-  if (memcmp(ehdr, ELFMAG, SELFMAG) != 0) {
+  // only read the headers for now, the segments are read straight into their memblocks later
+  if (dso_read_at(fd, 0, &ehdr, sizeof(ehdr)) || memcmp(&ehdr, ELFMAG, SELFMAG) != 0) {
     vrtld_set_error("`%s` is not a valid ELF file", modname);
     goto err_free_so;
   }
 
-  if (ehdr->e_type != ET_DYN) {
+  if (ehdr.e_type != ET_DYN) {
     vrtld_set_error("`%s` is not a shared library", modname);
     goto err_free_so;
   }
 
-  phdr = (Elf32_Phdr *)((uintptr_t)ehdr + ehdr->e_phoff);
-  shdr = (Elf32_Shdr *)((uintptr_t)ehdr + ehdr->e_shoff);
-  shstrtab = (char *)((uintptr_t)ehdr + shdr[ehdr->e_shstrndx].sh_offset);
+  phdr = dso_read_alloc(fd, ehdr.e_phoff, ehdr.e_phnum * sizeof(Elf32_Phdr));
+  shdr = dso_read_alloc(fd, ehdr.e_shoff, ehdr.e_shnum * sizeof(Elf32_Shdr));
+  if (!phdr || !shdr || ehdr.e_shstrndx >= ehdr.e_shnum) {
+    vrtld_set_error("Could not read ELF headers of `%s`", modname);
+    goto err_free_so;
+  }
+
+  if (vrtld_init_flags() & VRTLD_RELOC_CACHE) {
+    mod->ident = vrtld_hash64(VRTLD_HASH64_INIT, &ehdr, sizeof(ehdr));
+    mod->ident = vrtld_hash64(mod->ident, phdr, ehdr.e_phnum * sizeof(Elf32_Phdr));
+  }
+
+  shstrtab = dso_read_alloc(fd, shdr[ehdr.e_shstrndx].sh_offset, shdr[ehdr.e_shstrndx].sh_size);
+  if (!shstrtab) {
+    vrtld_set_error("Could not read section names of `%s`", modname);
+    goto err_free_so;
+  }
+
+  stats_add_time(mod, VRTLD_PHASE_IO, t);
 
   // calculate total size of the LOAD segments (overshoot it by a ton actually)
   // total size = size of last load segment + vaddr of last load segment
   size_t max_align = ALIGN_PAGE;
-  for (size_t i = 0; i < ehdr->e_phnum; i++) {
+  int need_chunk = 0;
+  for (size_t i = 0; i < ehdr.e_phnum; i++) {
     if (phdr[i].p_type == PT_LOAD && phdr[i].p_memsz) {
       const size_t this_size = phdr[i].p_vaddr + phdr[i].p_memsz;
       if (phdr[i].p_align > max_align)
         max_align = phdr[i].p_align;
       if (this_size > mod->size)
         mod->size = this_size;
+      if (dso_convert_pflags(phdr[i].p_flags) != PLAT_PROT_RW)
+        need_chunk = 1;
       mod->num_segs++;
     }
   }
@@ -128,12 +234,24 @@ static dso_t *dso_load(const char *filename, const char *modname) {
 
   DEBUG_PRINTF("`%s`: reserving %u bytes; %u segs total\n", modname, mod->size, mod->num_segs);
 
+  if (need_chunk) {
+    chunk = malloc(DSO_READ_CHUNK);
+    if (!chunk) {
+      vrtld_set_error("Could not allocate read buffer for `%s`", modname);
+      goto err_free_so;
+    }
+  }
+
   // allocate that much virtual address space
+  t = stats_now();
+  pthread_mutex_lock(&dso_load_lock);
   mod->base = vma_alloc(mod->size);
+  pthread_mutex_unlock(&dso_load_lock);
   if (!mod->base) {
     vrtld_set_error("Could not allocate %u bytes of virtual address space for `%s`", mod->size, modname);
     goto err_free_load;
   }
+  stats_add_time(mod, VRTLD_PHASE_ALLOC, t);
 
   // collect segments
   mod->segs = calloc(mod->num_segs, sizeof(*mod->segs));
@@ -142,32 +260,47 @@ static dso_t *dso_load(const char *filename, const char *modname) {
     goto err_free_load;
   }
 
-  for (size_t i = 0, n = 0; i < ehdr->e_phnum; i++) {
+  for (size_t i = 0, n = 0; i < ehdr.e_phnum; i++) {
     if (phdr[i].p_type == PT_LOAD && phdr[i].p_memsz) {
-      mod->segs[n].pflags = dso_convert_pflags(phdr[i].p_flags);
+      mod->segs[n].prot = dso_convert_pflags(phdr[i].p_flags);
       mod->segs[n].align = (phdr[i].p_align < ALIGN_PAGE) ? ALIGN_PAGE : phdr[i].p_align;
-      mod->segs[n].base = (void *)((Elf32_Addr)mod->base + phdr[i].p_vaddr);
-      mod->segs[n].page = (void *)ALIGN_DN((Elf32_Addr)mod->segs[n].base, ALIGN_PAGE);
-      mod->segs[n].end = (void *)ALIGN_UP((Elf32_Addr)mod->segs[n].base + phdr[i].p_memsz, ALIGN_PAGE);
-      mod->segs[n].size = (Elf32_Addr)mod->segs[n].end - (Elf32_Addr)mod->segs[n].page;
-      // allocate space for a copy of the segment and zero it out
-      if (!dso_alloc_seg_memblock(&mod->segs[n])) {
-        vrtld_set_error("Could not allocate %u bytes for segment %u\n", mod->segs[n].size, n);
+      mod->segs[n].base = (void *)((uintptr_t)mod->base + phdr[i].p_vaddr);
+      mod->segs[n].page = (void *)ALIGN_DN((uintptr_t)mod->segs[n].base, ALIGN_PAGE);
+      mod->segs[n].end = (void *)ALIGN_UP((uintptr_t)mod->segs[n].base + phdr[i].p_memsz, ALIGN_PAGE);
+      mod->segs[n].size = (uintptr_t)mod->segs[n].end - (uintptr_t)mod->segs[n].page;
+      // allocate space for a copy of the segment
+      t = stats_now();
+      mod->segs[n].blk = plat_map(mod->segs[n].page, mod->segs[n].size, mod->segs[n].prot);
+      if (!mod->segs[n].blk) {
+        vrtld_set_error("Could not allocate %u bytes for segment %u", (unsigned)mod->segs[n].size, (unsigned)n);
         goto err_free_load;
       }
-      const intptr_t diff = (Elf32_Addr)mod->segs[n].base - (Elf32_Addr)mod->segs[n].page;
-      mod->segs[n].base = (void *)((Elf32_Addr)mod->segs[n].page + diff);
+      stats_add_time(mod, VRTLD_PHASE_ALLOC, t);
+      const intptr_t diff = (uintptr_t)mod->segs[n].base - (uintptr_t)mod->segs[n].page;
+      mod->segs[n].base = (void *)((uintptr_t)mod->segs[n].page + diff);
       mod->segs[n].end = mod->segs[n].page + mod->segs[n].size;
-      // fill it in
-      kuKernelCpuUnrestrictedMemcpy(mod->segs[n].base, (void *)((uintptr_t)ehdr + phdr[i].p_offset), phdr[i].p_filesz);
-      phdr[i].p_vaddr = (Elf32_Addr)mod->segs[n].base;
+      // fill it in and zero out the rest
+      t = stats_now();
+      dso_zero_seg(&mod->segs[n], &phdr[i]);
+      stats_add_time(mod, VRTLD_PHASE_COPY, t);
+      if (dso_read_seg(mod, fd, &mod->segs[n], &phdr[i], chunk)) {
+        vrtld_set_error("Could not read segment %u of `%s`", (unsigned)n, modname);
+        goto err_free_load;
+      }
+      if (mod->ident)
+        mod->ident = vrtld_hash64(mod->ident, mod->segs[n].base, phdr[i].p_filesz);
       ++n;
     } else if (phdr[i].p_type == PT_DYNAMIC) {
       // remember the dynamic seg
-      mod->dynamic = (Elf32_Dyn *)((Elf32_Addr)mod->base + phdr[i].p_vaddr);
+      mod->dynamic = (Elf32_Dyn *)((uintptr_t)mod->base + phdr[i].p_vaddr);
+    } else if (phdr[i].p_type == PT_TLS) {
+      mod->tls_image = (void *)((uintptr_t)mod->base + phdr[i].p_vaddr);
+      mod->tls_filesz = phdr[i].p_filesz;
+      mod->tls_memsz = phdr[i].p_memsz;
+      mod->tls_align = phdr[i].p_align;
     } else if (phdr[i].p_type == PT_ARM_EXIDX) {
-      mod->exidx = (void *)((Elf32_Addr)mod->base + phdr[i].p_vaddr);
-      mod->num_exidx = phdr->p_memsz / 8;
+      mod->exidx = (void *)((uintptr_t)mod->base + phdr[i].p_vaddr);
+      mod->num_exidx = phdr[i].p_memsz / 8;
     }
   }
 
@@ -179,30 +312,31 @@ static dso_t *dso_load(const char *filename, const char *modname) {
   }
 
   // find special sections
-  for (int i = 0; i < ehdr->e_shnum; i++) {
+  for (int i = 0; i < ehdr.e_shnum; i++) {
     const char *sh_name = shstrtab + shdr[i].sh_name;
     if (!strcmp(sh_name, ".dynsym")) {
-      mod->dynsym = (Elf32_Sym *)((Elf32_Addr)mod->base + shdr[i].sh_addr);
+      mod->dynsym = (Elf32_Sym *)((uintptr_t)mod->base + shdr[i].sh_addr);
       mod->num_dynsym = shdr[i].sh_size / sizeof(Elf32_Sym);
     } else if (!strcmp(sh_name, ".dynstr")) {
-      mod->dynstrtab = (char *)((Elf32_Addr)mod->base + shdr[i].sh_addr);
+      mod->dynstrtab = (char *)((uintptr_t)mod->base + shdr[i].sh_addr);
     } else if (!strcmp(sh_name, ".hash")) {
       // optional: if there's no hashtab, linear lookup will be used
-      mod->hashtab = (uint32_t *)((Elf32_Addr)mod->base + shdr[i].sh_addr);
+      mod->hashtab = (uint32_t *)((uintptr_t)mod->base + shdr[i].sh_addr);
+    } else if (!strcmp(sh_name, ".gnu.hash")) {
+      // optional: preferred over .hash if both are present
+      mod->gnuhashtab = (uint32_t *)((uintptr_t)mod->base + shdr[i].sh_addr);
     } else if (!strcmp(sh_name, ".init_array")) {
-      mod->init_array = (void *)((Elf32_Addr)mod->base + shdr[i].sh_addr);
-      mod->num_init = shdr[i].sh_size / sizeof(void *);
+      mod->init_array = (void *)((uintptr_t)mod->base + shdr[i].sh_addr);
+      mod->num_init = shdr[i].sh_size / sizeof(Elf32_Addr);
     } else if (!strcmp(sh_name, ".fini_array")) {
-      mod->fini_array = (void *)((Elf32_Addr)mod->base + shdr[i].sh_addr);
-      mod->num_fini = shdr[i].sh_size / sizeof(void *);
+      mod->fini_array = (void *)((uintptr_t)mod->base + shdr[i].sh_addr);
+      mod->num_fini = shdr[i].sh_size / sizeof(Elf32_Addr);
     } else if (!strcmp(sh_name, ".rel.ARM.extab")) {
       if (vrtld_init_flags() & (VRTLD_TARGET2_IS_GOT | VRTLD_TARGET2_IS_ABS)) {
         // make a copy of this for later, we'll need to fixup any TARGET2 relocs in there
-        mod->extab_rel = malloc(shdr[i].sh_size);
-        if (mod->extab_rel) {
-          memcpy(mod->extab_rel, (uint8_t *)ehdr + shdr[i].sh_offset, shdr[i].sh_size);
+        mod->extab_rel = dso_read_alloc(fd, shdr[i].sh_offset, shdr[i].sh_size);
+        if (mod->extab_rel)
           mod->num_extab_rel = shdr[i].sh_size / shdr[i].sh_entsize;
-        }
       }
     } else if (!strcmp(sh_name, ".text")) {
       // useful for gdb
@@ -217,37 +351,78 @@ static dso_t *dso_load(const char *filename, const char *modname) {
 
   mod->name = vrtld_strdup(modname);
   mod->flags = MOD_MAPPED;
+  pthread_mutex_lock(&dso_load_lock);
   vrtld_num_modules++;
+  pthread_mutex_unlock(&dso_load_lock);
 
-  free(ehdr); // don't need this no more
+  // don't need these no more
+  fclose(fd);
+  free(chunk);
+  free(shstrtab);
+  free(shdr);
+  free(phdr);
 
   return mod;
 
 err_free_load:
+  pthread_mutex_lock(&dso_load_lock);
   vma_free(mod->base);
-  for (size_t i = 0; i < mod->num_segs; ++i)
-    sceKernelFreeMemBlock(mod->segs[i].blkid);
+  pthread_mutex_unlock(&dso_load_lock);
+  for (size_t i = 0; mod->segs && i < mod->num_segs; ++i) {
+    plat_unmap(mod->segs[i].blk, mod->segs[i].page, mod->segs[i].size);
+  }
+  free(mod->extab_rel);
 err_free_so:
+  fclose(fd);
+  free(chunk);
+  free(shstrtab);
+  free(shdr);
+  free(phdr);
   free(mod->segs);
-  free(ehdr);
   free(mod);
 
   return NULL;
 }
 
-static void dso_initialize(dso_t *mod) {
-  if (mod->init_array) {
+static dso_t *dso_load(const char *filename, const char *modname) {
+  const uint64_t t = trace_begin();
+  dso_t *mod = dso_load_file(filename, modname);
+  trace_end(t, TRACE_DSO_LOAD, modname, mod ? mod->size : 0, -1);
+  return mod;
+}
+
+// runs the constructors; a GLOBAL module only goes into the global symbol table after that,
+// so nothing that's relocated in the meantime can bind to it before it's ready
+static int dso_initialize(dso_t *mod) {
+  const uint64_t t = stats_now();
+  if (PLAT_CAN_EXECUTE && mod->init_array) {
     DEBUG_PRINTF("`%s`: init array %p has %u entries\n", mod->name, mod->init_array, mod->num_init);
     for (size_t i = 0; i < mod->num_init; ++i) {
-      if (mod->init_array[i])
+      if (mod->init_array[i]) {
+        const uint64_t tt = trace_begin();
         mod->init_array[i]();
+        trace_end(tt, TRACE_INIT, mod->name, 0, i);
+      }
     }
   }
   mod->flags |= MOD_INITIALIZED;
+  stats_add_time(mod, VRTLD_PHASE_INIT, t);
+
+  if (mod->flags & VRTLD_GLOBAL) {
+    vrtld_lookup_lock_exclusive();
+    const int ret = gsym_add(mod);
+    vrtld_lookup_unlock();
+    if (ret) {
+      vrtld_set_error("`%s`: Could not add symbols to the global symbol table", mod->name);
+      return -1;
+    }
+  }
+
+  return 0;
 }
 
 static void dso_finalize(dso_t *mod) {
-  if (mod->fini_array) {
+  if (PLAT_CAN_EXECUTE && mod->fini_array) {
     DEBUG_PRINTF("`%s`: fini array %p has %u entries\n", mod->name, mod->fini_array, mod->num_fini);
     for (int i = (int)mod->num_fini - 1; i >= 0; --i) {
       if (mod->fini_array[i])
@@ -259,33 +434,63 @@ static void dso_finalize(dso_t *mod) {
   mod->flags &= ~MOD_INITIALIZED;
 }
 
-static void dso_link(dso_t *mod) {
+// must be called with the lookup lock held exclusively
+static void dso_unlink_locked(dso_t *mod) {
+  gsym_remove(mod);
+  modmap_remove(mod);
+  if (mod->prev)
+    mod->prev->next = mod->next;
+  if (mod->next)
+    mod->next->prev = mod->prev;
+  mod->next = NULL;
+  mod->prev = NULL;
+}
+
+static int dso_link(dso_t *mod) {
+  vrtld_lookup_lock_exclusive();
   mod->next = vrtld_dsolist.next;
   mod->prev = &vrtld_dsolist;
   if (vrtld_dsolist.next)
     vrtld_dsolist.next->prev = mod;
   vrtld_dsolist.next = mod;
+  // dladdr() and the unwinder only find modules through the map
+  const int ret = modmap_insert(mod);
+  if (ret) {
+    vrtld_set_error("`%s`: Could not add module to the address map", mod->name);
+    // half linked modules would be found by some lookups and not others
+    dso_unlink_locked(mod);
+  }
+  vrtld_lookup_unlock();
+  return ret;
 }
 
 static void dso_unlink(dso_t *mod) {
-  if (mod->prev)
-    mod->prev->next = mod->next;
-  if (mod->next)
-    mod->next->prev = mod->prev;
-  mod->next = NULL;
-  mod->prev = NULL;
+  vrtld_lookup_lock_exclusive();
+  dso_unlink_locked(mod);
+  vrtld_lookup_unlock();
 }
 
-static int dso_relocate_and_init(dso_t *mod, int ignore_undef) {
-  if (!(mod->flags & MOD_RELOCATED) && vrtld_relocate(mod, ignore_undef, 0))
-    return -1;
-  if (!(mod->flags & MOD_INITIALIZED)) {
-    // flush caches before trying to run any code
+static int dso_relocate(dso_t *mod, int ignore_undef) {
+  if (!(mod->flags & MOD_RELOCATED)) {
+    // TLS relocs need to know where the block is going to be
+    if (mod->tls_memsz && !mod->tls_modid && tls_register(mod))
+      return -1;
+    uint64_t t = stats_now();
+    const uint64_t tt = trace_begin();
+    const int ret = vrtld_relocate(mod, ignore_undef, 0);
+    trace_end(tt, TRACE_RELOCATE, mod->name, mod->size, -1);
+    stats_add_time(mod, VRTLD_PHASE_RELOC, t);
+    if (ret)
+      return -1;
+    // flush caches before anything tries to run any code
     DEBUG_PRINTF("`%s`: flushing cache range %p - %p\n", mod->name, mod->segs[0].base, (char *)mod->segs[0].base + mod->segs[0].size);
-    kuKernelFlushCaches(mod->segs[0].base, mod->segs[0].size);
-    dso_initialize(mod);
+    t = stats_now();
+    plat_flush_caches(mod->segs[0].base, mod->segs[0].size);
+    stats_add_time(mod, VRTLD_PHASE_FLUSH, t);
   }
-  dso_link(mod);
+  // handles and dladdr() work from here on; other modules only see it once dso_initialize() is done
+  if (!mod->prev && dso_link(mod))
+    return -1;
   return 0;
 }
 
@@ -303,10 +508,23 @@ static int dso_unload(dso_t *mod) {
 
   // unmap and free all segs
   for (size_t i = 0; i < mod->num_segs; ++i)
-    sceKernelFreeMemBlock(mod->segs[i].blkid);
+    plat_unmap(mod->segs[i].blk, mod->segs[i].page, mod->segs[i].size);
 
   // release virtual address range
+  pthread_mutex_lock(&dso_load_lock);
   vma_free(mod->base);
+  pthread_mutex_unlock(&dso_load_lock);
+
+  // forget all the paths it was opened by
+  pathtab_remove(mod);
+
+  // give back its TLS module id
+  tls_unregister(mod);
+
+#ifdef WITH_EXCEPTION_SUPPORT
+  // the unwinder might have cached entries from this module's exidx
+  vrtld_exidx_cache_flush();
+#endif
 
   // if we own the symtab, free it
   if (mod->flags & MOD_OWN_SYMTAB) {
@@ -315,25 +533,534 @@ static int dso_unload(dso_t *mod) {
     free(mod->hashtab);
   }
 
+  pthread_mutex_lock(&dso_load_lock);
   vrtld_num_modules--;
+  pthread_mutex_unlock(&dso_load_lock);
   DEBUG_PRINTF("`%s`: unloaded\n", mod->name);
 
+  dso_t **deps = mod->deps;
+  const uint32_t num_deps = mod->num_deps;
+
+  // keep its counters in the totals
+  stats_retire(mod);
+
   // free everything else
+  vrtld_free_addrmap(mod);
+  free(mod->gsyms);
   free(mod->segs);
   free(mod->name);
   free(mod);
 
+  // drop the references to our dependencies; this might unload them as well
+  for (uint32_t i = num_deps; i > 0; --i)
+    vrtld_dlclose(deps[i - 1]);
+  free(deps);
+
+  return 0;
+}
+
+static void *dso_load_worker(void *arg) {
+  dso_batch_t *batch = arg;
+  for (;;) {
+    const uint32_t i = __atomic_fetch_add(&batch->next_job, 1, __ATOMIC_RELAXED);
+    if (i >= batch->num_jobs)
+      break;
+    dso_job_t *job = &batch->jobs[i];
+    job->mod = dso_load(job->path, job->modname);
+  }
+  return NULL;
+}
+
+static void *dso_pool_worker(void *arg) {
+  dso_pool_t *pool = arg;
+  uint32_t seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->quit && pool->serial == seen)
+      pthread_cond_wait(&pool->work, &pool->lock);
+    if (pool->quit)
+      break;
+    seen = pool->serial;
+    dso_batch_t *batch = pool->batch;
+    pthread_mutex_unlock(&pool->lock);
+
+    dso_load_worker(batch);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->busy == 0)
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+static void dso_pool_init(dso_pool_t *pool) {
+  memset(pool, 0, sizeof(*pool));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+}
+
+static void dso_pool_free(dso_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (uint32_t i = 0; i < pool->num_threads; ++i)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->work);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+static void dso_load_batch(dso_pool_t *pool, dso_job_t *jobs, const uint32_t num_jobs) {
+  dso_batch_t batch = { jobs, num_jobs, 0 };
+
+  // the calling thread takes jobs too, so it only needs helpers if there's more than one;
+  // nothing can be waiting on the pool between batches, so it can grow without the lock
+  if (num_jobs > 1) {
+    const uint32_t want = (num_jobs - 1 < DSO_LOAD_WORKERS) ? num_jobs - 1 : DSO_LOAD_WORKERS;
+    if (pool->num_threads < want) {
+      pthread_attr_t attr;
+      pthread_attr_init(&attr);
+      pthread_attr_setstacksize(&attr, DSO_LOAD_WORKER_STACK);
+      while (pool->num_threads < want && pthread_create(&pool->threads[pool->num_threads], &attr, dso_pool_worker, pool) == 0)
+        ++pool->num_threads;
+      pthread_attr_destroy(&attr);
+    }
+  }
+
+  DEBUG_PRINTF("dso_load_batch(): loading %u modules on %u extra threads\n", num_jobs, pool->num_threads);
+
+  if (num_jobs > 1 && pool->num_threads) {
+    pthread_mutex_lock(&pool->lock);
+    pool->batch = &batch;
+    pool->busy = pool->num_threads;
+    pool->serial++;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  dso_load_worker(&batch);
+
+  if (num_jobs > 1 && pool->num_threads) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy)
+      pthread_cond_wait(&pool->done, &pool->lock);
+    pool->batch = NULL;
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+static void dso_free_job(dso_job_t *job) {
+  free(job->path);
+  free(job->modname);
+  job->path = NULL;
+  job->modname = NULL;
+}
+
+// looks for a DT_NEEDED library in the search path and fills in job if it's found
+static int dso_find_needed(const char *name, dso_job_t *job) {
+  char pathbuf[1024];
+  const char *path = NULL;
+
+  memset(job, 0, sizeof(*job));
+
+  if (strchr(name, '/')) {
+    // already a path
+    if (stat(name, &job->st) == 0)
+      path = name;
+  } else {
+    const size_t namelen = strlen(name);
+    for (const char *dir = dso_search_path; dir && *dir; ) {
+      const char *sep = strchr(dir, ';');
+      size_t dirlen = sep ? (size_t)(sep - dir) : strlen(dir);
+      if (dirlen && dir[dirlen - 1] == '/')
+        --dirlen;
+      if (dirlen && dirlen + namelen + 2 <= sizeof(pathbuf)) {
+        memcpy(pathbuf, dir, dirlen);
+        pathbuf[dirlen] = '/';
+        memcpy(pathbuf + dirlen + 1, name, namelen + 1);
+        if (stat(pathbuf, &job->st) == 0) {
+          path = pathbuf;
+          break;
+        }
+      }
+      if (!sep)
+        break;
+      dir = sep + 1;
+    }
+  }
+
+  if (!path)
+    return -1;
+
+  job->has_st = 1;
+  job->path = vrtld_strdup(path);
+
+  char realbuf[1024] = { 0 };
+  const char *modname = realpath(path, realbuf);
+  job->modname = vrtld_strdup(modname ? modname : path);
+
+  if (!job->path || !job->modname) {
+    dso_free_job(job);
+    return -1;
+  }
+
   return 0;
 }
 
-static inline int dso_get_addr_info(void *addr, const dso_t *mod, vrtld_dl_info_t *info) {
+static int dso_add_dep(dso_t *mod, dso_t *dep) {
+  dso_t **deps = realloc(mod->deps, (mod->num_deps + 1) * sizeof(*deps));
+  if (!deps) {
+    vrtld_set_error("Could not allocate dependency list for `%s`", mod->name);
+    return -1;
+  }
+  mod->deps = deps;
+  mod->deps[mod->num_deps++] = dep;
+  dep->refcount++;
+  return 0;
+}
+
+// makes mod and everything it depends on visible to everyone, like a VRTLD_GLOBAL dlopen() of a module
+// that's already loaded does; modules that aren't initialized yet get into the global symbol table when they are
+static int dso_make_global(dso_t *mod) {
+  // dependencies of GLOBAL modules are always GLOBAL themselves
+  if (mod->flags & VRTLD_GLOBAL)
+    return 0;
+
+  mod->flags |= VRTLD_GLOBAL;
+  if (mod->flags & MOD_INITIALIZED) {
+    vrtld_lookup_lock_exclusive();
+    const int ret = gsym_add(mod);
+    vrtld_lookup_unlock();
+    if (ret) {
+      mod->flags &= ~VRTLD_GLOBAL;
+      vrtld_set_error("`%s`: Could not add symbols to the global symbol table", mod->name);
+      return -1;
+    }
+  }
+
+  for (uint32_t i = 0; i < mod->num_deps; ++i) {
+    if (dso_make_global(mod->deps[i]))
+      return -1;
+  }
+
+  return 0;
+}
+
+// whether target is in the dependency graph of mod; marks everything it visits with MOD_VISITING,
+// so dso_clear_visiting() has to be called on mod afterwards
+static int dso_reaches(dso_t *mod, const dso_t *target) {
+  if (mod == target)
+    return 1;
+  if (mod->flags & MOD_VISITING)
+    return 0;
+  mod->flags |= MOD_VISITING;
+  for (uint32_t i = 0; i < mod->num_deps; ++i) {
+    if (dso_reaches(mod->deps[i], target))
+      return 1;
+  }
+  return 0;
+}
+
+static void dso_clear_visiting(dso_t *mod) {
+  if (!(mod->flags & MOD_VISITING))
+    return;
+  mod->flags &= ~MOD_VISITING;
+  for (uint32_t i = 0; i < mod->num_deps; ++i)
+    dso_clear_visiting(mod->deps[i]);
+}
+
+// loads the DT_NEEDED graph of root one level at a time, reading each level in parallel;
+// every loaded module is referenced by the modules that need it, so releasing root releases the graph,
+// which is also why dependency cycles are rejected: they would keep each other loaded forever.
+// dependencies are as visible as root: a LOCAL root keeps them out of the global symbol table,
+// and its imports are resolved against them through its own dependency scope instead
+static int dso_load_deps(dso_t *root, const int flags) {
+  dso_t **level = &root;
+  uint32_t num_level = 1;
+  int ret = 0;
+
+  dso_pool_t pool;
+  dso_pool_init(&pool);
+
+  while (num_level && !ret) {
+    dso_job_t *jobs = NULL;
+    uint32_t num_jobs = 0;
+    dso_edge_t *edges = NULL;
+    uint32_t num_edges = 0;
+
+    // collect everything this level needs that isn't loaded yet
+    for (uint32_t m = 0; m < num_level && !ret; ++m) {
+      dso_t *mod = level[m];
+      for (const Elf32_Dyn *dyn = mod->dynamic; dyn->d_tag != DT_NULL && !ret; ++dyn) {
+        if (dyn->d_tag != DT_NEEDED)
+          continue;
+
+        const char *name = mod->dynstrtab + dyn->d_un.d_val;
+        dso_job_t job;
+        if (dso_find_needed(name, &job)) {
+          // it's probably provided by the main module
+          DEBUG_PRINTF("`%s`: needed library `%s` not found, skipping\n", mod->name, name);
+          continue;
+        }
+
+        dso_t *dep = pathtab_find(job.modname, &job.st);
+        if (!dep)
+          dep = pathtab_find(job.path, &job.st);
+        if (dep) {
+          dso_free_job(&job);
+          // everything that's already loaded has all its edges, so this is the only place a cycle can close
+          const int cycle = dso_reaches(dep, mod);
+          dso_clear_visiting(dep);
+          if (cycle) {
+            vrtld_set_error("`%s` needs `%s`, which depends on it", mod->name, dep->name);
+            ret = -1;
+            break;
+          }
+          ret = dso_add_dep(mod, dep);
+          if (!ret && (flags & VRTLD_GLOBAL))
+            ret = dso_make_global(dep);
+          continue;
+        }
+
+        // several modules on this level might need the same thing
+        uint32_t j = 0;
+        while (j < num_jobs && strcmp(jobs[j].modname, job.modname))
+          ++j;
+        if (j == num_jobs) {
+          dso_job_t *newjobs = realloc(jobs, (num_jobs + 1) * sizeof(*jobs));
+          if (!newjobs) {
+            vrtld_set_error("Could not allocate job list for `%s`", root->name);
+            dso_free_job(&job);
+            ret = -1;
+            break;
+          }
+          jobs = newjobs;
+          jobs[num_jobs++] = job;
+        } else {
+          dso_free_job(&job);
+        }
+
+        dso_edge_t *newedges = realloc(edges, (num_edges + 1) * sizeof(*edges));
+        if (!newedges) {
+          vrtld_set_error("Could not allocate dependency list for `%s`", root->name);
+          ret = -1;
+          break;
+        }
+        edges = newedges;
+        edges[num_edges].from = mod;
+        edges[num_edges].job = j;
+        num_edges++;
+      }
+    }
+
+    if (!ret && num_jobs)
+      dso_load_batch(&pool, jobs, num_jobs);
+
+    // hook up everything that did load so it gets released with root if anything else failed
+    for (uint32_t e = 0; e < num_edges; ++e) {
+      dso_job_t *job = &jobs[edges[e].job];
+      if (job->mod) {
+        if (dso_add_dep(edges[e].from, job->mod))
+          ret = -1;
+      } else if (!ret) {
+        // workers can step on each other's error messages, so set our own
+        vrtld_set_error("Could not load `%s`, needed by `%s`", job->modname, edges[e].from->name);
+        ret = -1;
+      }
+    }
+
+    // whatever loaded is the next level
+    dso_t **next_level = num_jobs ? malloc(num_jobs * sizeof(*next_level)) : NULL;
+    uint32_t num_next = 0;
+    for (uint32_t j = 0; j < num_jobs; ++j) {
+      dso_t *dep = jobs[j].mod;
+      if (dep && !dep->refcount) {
+        // nothing could take a reference to it
+        dso_unload(dep);
+      } else if (dep) {
+        dep->flags |= flags & (VRTLD_GLOBAL | VRTLD_LAZY);
+        // without its canonical path, the next module that needs it would load a second copy
+        if (pathtab_insert(jobs[j].modname, &jobs[j].st, dep)) {
+          vrtld_set_error("Could not index `%s` while loading `%s`", jobs[j].modname, root->name);
+          ret = -1;
+        }
+        // the other path is only a shortcut
+        if (strcmp(jobs[j].modname, jobs[j].path) && pathtab_insert(jobs[j].path, &jobs[j].st, dep))
+          DEBUG_PRINTF("`%s`: could not index by `%s`\n", jobs[j].modname, jobs[j].path);
+        if (next_level)
+          next_level[num_next++] = dep;
+        else
+          ret = -1;
+      }
+      dso_free_job(&jobs[j]);
+    }
+
+    free(jobs);
+    free(edges);
+    if (level != &root)
+      free(level);
+    level = next_level;
+    num_level = num_next;
+  }
+
+  if (level != &root)
+    free(level);
+
+  dso_pool_free(&pool);
+
+  return ret;
+}
+
+// relocates and links mod after everything it depends on
+static int dso_relocate_graph(dso_t *mod) {
+  // it's either already done or we've looped back around to it
+  if (mod->prev || (mod->flags & MOD_VISITING))
+    return 0;
+
+  mod->flags |= MOD_VISITING;
+  for (uint32_t i = 0; i < mod->num_deps; ++i) {
+    if (dso_relocate_graph(mod->deps[i])) {
+      mod->flags &= ~MOD_VISITING;
+      return -1;
+    }
+  }
+  mod->flags &= ~MOD_VISITING;
+
+  return dso_relocate(mod, 0);
+}
+
+static void dso_list_lock_init(void) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&dso_list_lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+void vrtld_loader_lock(void) {
+  pthread_once(&dso_list_lock_once, dso_list_lock_init);
+  pthread_mutex_lock(&dso_list_lock);
+  if (dso_list_depth++ == 0)
+    __atomic_store_n(&dso_list_owner, plat_thread_id(), __ATOMIC_RELAXED);
+}
+
+void vrtld_loader_unlock(void) {
+  if (--dso_list_depth == 0)
+    __atomic_store_n(&dso_list_owner, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&dso_list_lock);
+}
+
+void vrtld_lookup_lock(void) {
+  pthread_rwlock_rdlock(&dso_list_rwlock);
+}
+
+void vrtld_lookup_lock_exclusive(void) {
+  pthread_rwlock_wrlock(&dso_list_rwlock);
+}
+
+void vrtld_lookup_unlock(void) {
+  pthread_rwlock_unlock(&dso_list_rwlock);
+}
+
+void vrtld_vma_lock(void) {
+  pthread_mutex_lock(&dso_load_lock);
+}
+
+void vrtld_vma_unlock(void) {
+  pthread_mutex_unlock(&dso_load_lock);
+}
+
+int vrtld_dso_init(dso_t *mod) {
+  // it's either already done or we've looped back around to it
+  if (mod->flags & (MOD_INITIALIZED | MOD_VISITING))
+    return 0;
+
+  // constructors of dependencies go first; keep it marked while ours run in case they dlopen it
+  mod->flags |= MOD_VISITING;
+  int ret = 0;
+  for (uint32_t i = 0; i < mod->num_deps && !ret; ++i)
+    ret = vrtld_dso_init(mod->deps[i]);
+  if (!ret)
+    ret = dso_initialize(mod);
+  mod->flags &= ~MOD_VISITING;
+
+  return ret;
+}
+
+dso_t *vrtld_dso_open(const char *fname, int flags) {
+  dso_t *mod = NULL;
+
+  // the file's identity tells apart different files that were opened by the same path
+  struct stat st;
+  const struct stat *pst = (stat(fname, &st) == 0) ? &st : NULL;
+
+  // see if the module is already loaded by this exact path
+  mod = pathtab_find(fname, pst);
+
+  // identify the module by absolute path if possible
+  char pathbuf[1024] = { 0 };
+  const char *modname = fname;
+  if (!mod) {
+    modname = realpath(fname, pathbuf);
+    if (!modname) modname = fname; // but fall back to the relative name
+    if (modname != fname && strcmp(modname, fname)) {
+      // maybe it was loaded by a different path; remember this one for next time
+      mod = pathtab_find(modname, pst);
+      if (mod && pathtab_insert(fname, pst, mod))
+        DEBUG_PRINTF("`%s`: could not index by `%s`\n", modname, fname);
+    }
+  }
+
+  // just increase refcount if it is already loaded, but it might have to become GLOBAL now
+  if (mod) {
+    DEBUG_PRINTF("dlopen(): `%s` is already loaded, increasing refcount\n", fname);
+    if ((flags & VRTLD_GLOBAL) && dso_make_global(mod))
+      return NULL;
+    mod->refcount++;
+    return mod;
+  }
+
+  // load the module
+  mod = dso_load(fname, modname);
+  if (!mod) return NULL;
+
+  mod->flags |= flags;
+  mod->refcount = 1;
+
+  // index it by both its canonical path and the one it was opened by; the canonical one
+  // is what keeps it from being loaded twice
+  const int indexed = pathtab_insert(modname, pst, mod);
+  if (indexed)
+    vrtld_set_error("Could not index `%s`", modname);
+  if (strcmp(modname, fname) && pathtab_insert(fname, pst, mod))
+    DEBUG_PRINTF("`%s`: could not index by `%s`\n", modname, fname);
+
+  // load everything it needs, then relocate all of it bottom up right away;
+  // if it's lazy, function imports will be bound on first call
+  if (indexed || dso_load_deps(mod, flags) || dso_relocate_graph(mod)) {
+    // this releases whatever dependencies got loaded as well
+    vrtld_dlclose(mod);
+    return NULL;
+  }
+
+  return mod;
+}
+
+static inline int dso_get_addr_info(void *addr, dso_t *mod, vrtld_dl_info_t *info) {
   if (addr < mod->base || addr >= mod->base + mod->size)
     return 0;
 
   // fill in the symbol info if this is a symbol
   const Elf32_Sym *sym = vrtld_reverse_lookup_sym(mod, addr);
   if (sym) {
-    info->dli_saddr = (void *)((uintptr_t)mod->base + sym->st_value);
+    info->dli_saddr = vrtld_sym_addr(mod, sym);
     info->dli_sname = mod->dynstrtab + sym->st_name;
   } else {
     info->dli_saddr = NULL;
@@ -348,9 +1075,31 @@ static inline int dso_get_addr_info(void *addr, const dso_t *mod, vrtld_dl_info_
 }
 
 void vrtld_unload_all(void) {
+  vrtld_loader_lock();
+  vrtld_lookup_lock_exclusive();
+
   dso_t *mod = vrtld_dsolist.next;
   vrtld_dsolist.next = NULL;
 
+  // drop the global symbol table, module entries are freed along with the modules
+  gsym_clear();
+  modmap_clear();
+  pathtab_clear();
+  free(vrtld_dsolist.gsyms);
+  vrtld_dsolist.gsyms = NULL;
+  vrtld_dsolist.num_gsyms = 0;
+  vrtld_free_addrmap(&vrtld_dsolist);
+
+  // nothing can find the modules anymore, so destructors can run without blocking lookups
+  vrtld_lookup_unlock();
+
+  // everything is going away anyway, so don't bother with dependency refcounts
+  for (dso_t *p = mod; p; p = p->next) {
+    free(p->deps);
+    p->deps = NULL;
+    p->num_deps = 0;
+  }
+
   while (mod) {
     dso_t *next = mod->next;
     dso_unload(mod);
@@ -364,13 +1113,13 @@ void vrtld_unload_all(void) {
     free(vrtld_dsolist.hashtab); vrtld_dsolist.hashtab = NULL;
     vrtld_dsolist.flags &= ~MOD_OWN_SYMTAB;
   }
+
+  vrtld_loader_unlock();
 }
 
 /* vrtld API begins */
 
 void *vrtld_dlopen(const char *fname, int flags) {
-  dso_t *mod = NULL;
-
   // clear error flag since we're starting work on a new library
   vrtld_dlerror();
 
@@ -379,41 +1128,34 @@ void *vrtld_dlopen(const char *fname, int flags) {
     return &vrtld_dsolist;
   }
 
-  // see if the module is already loaded and just increase refcount if it is
-  for (dso_t *p = vrtld_dsolist.next; p; p = p->next) {
-    if (!strcmp(p->name, fname)) {
-      mod = p;
-      break;
-    }
-  }
+  vrtld_loader_lock();
 
-  if (mod) {
-    DEBUG_PRINTF("dlopen(): `%s` is already loaded, increasing refcount\n", fname);
-    mod->refcount++;
-    return mod;
+  // if it's already loaded, it might still be waiting for someone to finish it, so init it either way
+  dso_t *mod = vrtld_dso_open(fname, flags);
+  if (mod && vrtld_dso_init(mod)) {
+    vrtld_dlclose(mod);
+    mod = NULL;
   }
 
-  // identify the module by absolute path if possible
-  char pathbuf[1024] = { 0 };
-  const char *modname = realpath(fname, pathbuf);
-  if (!modname) modname = fname; // but fall back to the relative name
+  vrtld_loader_unlock();
 
-  // load the module
-  mod = dso_load(fname, modname);
-  if (!mod) return NULL;
+  return mod;
+}
 
-  // relocate and init it right away if not lazy
-  if (!(flags & VRTLD_LAZY)) {
-    if (dso_relocate_and_init(mod, 0)) {
-      dso_unload(mod);
-      return NULL;
+int vrtld_set_search_path(const char *path) {
+  char *newpath = NULL;
+  if (path && *path) {
+    newpath = vrtld_strdup(path);
+    if (!newpath) {
+      vrtld_set_error("Could not allocate search path");
+      return -1;
     }
   }
-
-  mod->flags |= flags;
-  mod->refcount = 1;
-
-  return mod;
+  vrtld_loader_lock();
+  free(dso_search_path);
+  dso_search_path = newpath;
+  vrtld_loader_unlock();
+  return 0;
 }
 
 int vrtld_dlclose(void *handle) {
@@ -428,14 +1170,75 @@ int vrtld_dlclose(void *handle) {
   }
 
   dso_t *mod = handle;
+  int ret = 0;
+
+  vrtld_loader_lock();
+
   // free the module when reference count reaches zero
   if (--mod->refcount <= 0) {
     DEBUG_PRINTF("`%s`: refcount is 0, unloading\n", mod->name);
+    // the name is gone by the time the event is recorded
+    const uint64_t t = trace_begin();
+    char name[TRACE_ARG_LEN] = { 0 };
+    const uint32_t size = mod->size;
+    if (t)
+      snprintf(name, sizeof(name), "%s", mod->name);
     dso_unlink(mod);
-    return dso_unload(mod);
+    ret = dso_unload(mod);
+    trace_end(t, TRACE_DLCLOSE, name, size, -1);
   }
 
-  return 0;
+  vrtld_loader_unlock();
+
+  return ret;
+}
+
+// whether a search through every module can see mod: modules from vrtld_dlopen_async() stay hidden
+// until their constructors have run, except from those constructors themselves
+static inline int dso_is_visible(const dso_t *mod) {
+  if (mod->flags & MOD_INITIALIZED)
+    return 1;
+  return (mod->flags & MOD_VISITING) && __atomic_load_n(&dso_list_owner, __ATOMIC_RELAXED) == plat_thread_id();
+}
+
+// finishes up any modules that aren't relocated yet while looking; this blocks everyone else;
+// quiet leaves dlerror() alone when the symbol just isn't there
+static void *dso_dlsym_slow(void *handle, const char *symname, const int quiet) {
+  vrtld_loader_lock();
+
+  void *symaddr = NULL;
+  dso_t *mod = handle ? handle : &vrtld_dsolist;
+  for (; mod; mod = mod->next) {
+    if (!(mod->flags & MOD_RELOCATED)) {
+      // module isn't ready yet; try to finalize it
+      if (dso_relocate_graph(mod)) {
+        dso_unload(mod);
+        if (handle)
+          break;
+        else
+          continue;
+      }
+      vrtld_dso_init(mod);
+    }
+
+    if (!handle && !dso_is_visible(mod))
+      continue;
+
+    symaddr = vrtld_lookup(mod, symname);
+    if (symaddr)
+      break;
+
+    // stop early if we're searching in a specific module
+    if (handle) {
+      if (!quiet)
+        vrtld_set_error("`%s`: symbol `%s` not found", mod->name, symname);
+      break;
+    }
+  }
+
+  vrtld_loader_unlock();
+
+  return symaddr;
 }
 
 void *vrtld_dlsym(void *__restrict handle, const char *__restrict symname) {
@@ -449,32 +1252,156 @@ void *vrtld_dlsym(void *__restrict handle, const char *__restrict symname) {
     handle = NULL;
   }
 
+  const uint64_t t = trace_begin();
+
   // NULL handle means search in order starting with the main module
-  dso_t *mod = handle ? handle : &vrtld_dsolist;
-  for (; mod; mod = mod->next) {
+  void *symaddr = NULL;
+  int pending = 0;
+
+  // lookups only need the list to hold still, so they don't wait for each other or for file I/O
+  vrtld_lookup_lock();
+  for (dso_t *mod = handle ? handle : &vrtld_dsolist; mod; mod = mod->next) {
     if (!(mod->flags & MOD_RELOCATED)) {
-      // module isn't ready yet; try to finalize it
-      if (dso_relocate_and_init(mod, 0)) {
-        dso_unload(mod);
-        if (handle)
-          return NULL;
-        else
-          continue;
-      }
+      pending = 1;
+      break;
     }
 
-    void *symaddr = vrtld_lookup(mod, symname);
-    if (symaddr) return symaddr;
+    if (!handle && !dso_is_visible(mod))
+      continue;
+
+    symaddr = vrtld_lookup(mod, symname);
+    if (symaddr)
+      break;
 
     // stop early if we're searching in a specific module
     if (handle) {
       vrtld_set_error("`%s`: symbol `%s` not found", mod->name, symname);
-      return NULL;
+      break;
     }
   }
+  vrtld_lookup_unlock();
 
-  vrtld_set_error("symbol `%s` not found in any loaded modules", symname);
-  return NULL;
+  // something has to be relocated first, so start over the slow way
+  if (pending)
+    symaddr = dso_dlsym_slow(handle, symname, 0);
+
+  trace_end(t, TRACE_DLSYM, symname, 0, -1);
+
+  if (!symaddr && !handle)
+    vrtld_set_error("symbol `%s` not found in any loaded modules", symname);
+
+  return symaddr;
+}
+
+// one name of a vrtld_dlsym_many() request
+typedef struct dso_sym_req {
+  vrtld_hashed_name_t hn;
+  uint32_t idx;     // where it goes in the caller's arrays
+  uint32_t bucket;  // in the module that's being looked in right now
+} dso_sym_req_t;
+
+static int dso_sym_req_cmp(const void *a, const void *b) {
+  const dso_sym_req_t *ra = a;
+  const dso_sym_req_t *rb = b;
+  return (ra->bucket > rb->bucket) - (ra->bucket < rb->bucket);
+}
+
+// resolves what it can in one module; returns how many are left, which are moved to the front
+static uint32_t dso_dlsym_batch(const dso_t *mod, dso_sym_req_t *reqs, const uint32_t num_reqs, void **out) {
+  // walk the hash table front to back instead of jumping all over it
+  for (uint32_t i = 0; i < num_reqs; ++i)
+    reqs[i].bucket = vrtld_lookup_bucket(mod, &reqs[i].hn);
+  qsort(reqs, num_reqs, sizeof(*reqs), dso_sym_req_cmp);
+
+  uint32_t left = 0;
+  for (uint32_t i = 0; i < num_reqs; ++i) {
+    void *addr = vrtld_lookup_hashed(mod, &reqs[i].hn);
+    if (addr)
+      out[reqs[i].idx] = addr;
+    else
+      reqs[left++] = reqs[i];
+  }
+
+  return left;
+}
+
+int vrtld_dlsym_many(void *handle, const char *const *names, void **out, const unsigned int count, unsigned int *out_missing) {
+  if (!names || !out) {
+    vrtld_set_error("vrtld_dlsym_many(): NULL args");
+    return -1;
+  }
+
+  // passed in a handle to the main module
+  if (handle == &vrtld_dsolist) {
+    handle = NULL;
+  }
+
+  if (out_missing)
+    memset(out_missing, 0, ((count + 31) / 32) * sizeof(*out_missing));
+
+  dso_sym_req_t *reqs = count ? malloc(count * sizeof(*reqs)) : NULL;
+  if (count && !reqs) {
+    vrtld_set_error("vrtld_dlsym_many(): could not allocate %u requests", count);
+    return -1;
+  }
+
+  const uint64_t t = trace_begin();
+
+  // hash everything once; empty names can't be found anywhere
+  uint32_t num_reqs = 0;
+  uint32_t num_missing = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    out[i] = NULL;
+    if (!names[i] || !*names[i]) {
+      if (out_missing) out_missing[i / 32] |= 1u << (i % 32);
+      ++num_missing;
+      continue;
+    }
+    reqs[num_reqs].hn.name = names[i];
+    reqs[num_reqs].hn.gnuhash = vrtld_gnu_hash((const uint8_t *)names[i]);
+    reqs[num_reqs].hn.elfhash = vrtld_elf_hash((const uint8_t *)names[i]);
+    reqs[num_reqs].idx = i;
+    ++num_reqs;
+  }
+
+  // same search order as vrtld_dlsym(), but each module is only visited once
+  int pending = 0;
+  vrtld_lookup_lock();
+  for (dso_t *mod = handle ? handle : &vrtld_dsolist; mod && num_reqs; mod = mod->next) {
+    if (!(mod->flags & MOD_RELOCATED)) {
+      pending = 1;
+      break;
+    }
+    if (!handle && !dso_is_visible(mod))
+      continue;
+    num_reqs = dso_dlsym_batch(mod, reqs, num_reqs, out);
+    if (handle)
+      break;
+  }
+  vrtld_lookup_unlock();
+
+  // something has to be relocated first; that's rare enough to just do the rest one by one
+  if (pending) {
+    uint32_t left = 0;
+    for (uint32_t i = 0; i < num_reqs; ++i) {
+      out[reqs[i].idx] = dso_dlsym_slow(handle, reqs[i].hn.name, 1);
+      if (!out[reqs[i].idx])
+        reqs[left++] = reqs[i];
+    }
+    num_reqs = left;
+  }
+
+  trace_end(t, TRACE_DLSYM_MANY, handle ? ((dso_t *)handle)->name : vrtld_dsolist.name, count, -1);
+
+  // misses are only reported here, there's no point in formatting hundreds of error messages
+  for (uint32_t i = 0; i < num_reqs; ++i) {
+    if (out_missing) out_missing[reqs[i].idx / 32] |= 1u << (reqs[i].idx % 32);
+    ++num_missing;
+  }
+
+  free(reqs);
+
+  return num_missing;
 }
 
 int vrtld_dladdr(void *addr, vrtld_dl_info_t *info) {
@@ -487,16 +1414,19 @@ int vrtld_dladdr(void *addr, vrtld_dl_info_t *info) {
   info->dli_saddr = NULL;
   info->dli_sname = NULL;
 
-  // ha-ha, time for linear lookup
-  // start with the top module after main, since someone's unlikely to be looking for symbol names inside main
-  const dso_t *mod;
-  for (mod = vrtld_dsolist.next; mod; mod = mod->next) {
-    if (dso_get_addr_info(addr, mod, info))
-      return 1;
-  }
+  vrtld_lookup_lock();
+
+  // find which module this is in, if any
+  dso_t *mod = modmap_find(addr);
+  int ret = mod && dso_get_addr_info(addr, mod, info);
 
   // do main module last
-  return dso_get_addr_info(addr, &vrtld_dsolist, info);
+  if (!ret)
+    ret = dso_get_addr_info(addr, &vrtld_dsolist, info);
+
+  vrtld_lookup_unlock();
+
+  return ret;
 }
 
 void *vrtld_get_handle(void *base) {
@@ -505,11 +1435,14 @@ void *vrtld_get_handle(void *base) {
     return NULL;
   }
 
-  dso_t *mod;
-  for (mod = &vrtld_dsolist; mod; mod = mod->next) {
-    if (mod->base == base)
-      return mod;
-  }
+  if (vrtld_dsolist.base == base)
+    return &vrtld_dsolist;
+
+  vrtld_lookup_lock();
+  dso_t *mod = modmap_find(base);
+  vrtld_lookup_unlock();
+  if (mod && mod->base == base)
+    return mod;
 
   vrtld_set_error("vrtld_get_handle(): %p is not the base of any loaded module", base);
   return NULL;
@@ -542,3 +1475,20 @@ void *vrtld_get_exidx(void *handle, unsigned int *out_count) {
   if (out_count) *out_count = mod->num_exidx;
   return mod->exidx;
 }
+
+unsigned int vrtld_get_lookups_saved(void *handle) {
+  if (!handle) {
+    vrtld_set_error("vrtld_get_lookups_saved(): NULL arg");
+    return 0;
+  }
+  const dso_t *mod = handle;
+  return mod->stats.lookups_saved;
+}
+
+#ifndef WITH_EXCEPTION_SUPPORT
+void vrtld_get_exidx_cache_stats(unsigned int *out_hits, unsigned int *out_misses) {
+  // no exidx handler, so no cache either
+  if (out_hits) *out_hits = 0;
+  if (out_misses) *out_misses = 0;
+}
+#endif
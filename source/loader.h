@@ -1,3 +1,26 @@
 #pragma once
 
+#include "common.h"
+
 void vrtld_unload_all(void);
+
+// serializes everything that changes the module list; can be taken recursively
+void vrtld_loader_lock(void);
+void vrtld_loader_unlock(void);
+
+// keeps the module list and the symbol tables from changing while looking things up;
+// any number of threads can hold it at once
+void vrtld_lookup_lock(void);
+void vrtld_lookup_unlock(void);
+// for actually changing any of it; only with the loader lock held, and never around user code
+void vrtld_lookup_lock_exclusive(void);
+
+// guards the address space allocator, which dependency workers use without the loader lock
+void vrtld_vma_lock(void);
+void vrtld_vma_unlock(void);
+
+// loads, relocates and links a module and its dependencies, or adds a reference to it if it's loaded
+dso_t *vrtld_dso_open(const char *fname, int flags);
+// runs the constructors of a module and its dependencies that haven't been run yet, then makes the
+// GLOBAL ones visible to other modules; returns -1 if that failed
+int vrtld_dso_init(dso_t *mod);
@@ -1,81 +1,38 @@
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-#include <vitasdk.h>
-#include <taihen.h>
+#include <pthread.h>
 
 #include "common.h"
 #include "vrtld.h"
 #include "util.h"
-#include "exports.h"
+#include "gsym.h"
+#include "nid.h"
 #include "lookup.h"
+#include "tls.h"
 
 // sce exports stuff shamelessly stolen from vita-rss-libdl
 
-typedef struct sce_module_exports {
-  uint16_t size;           // size of this structure; 0x20 for Vita 1.x
-  uint8_t  lib_version[2]; //
-  uint16_t attribute;      // ?
-  uint16_t num_functions;  // number of exported functions
-  uint16_t num_vars;       // number of exported variables
-  uint16_t unk;
-  uint32_t num_tls_vars;   // number of exported TLS variables?  <-- pretty sure wrong // yifanlu
-  uint32_t lib_nid;        // NID of this specific export list; one PRX can export several names
-  char     *lib_name;      // name of the export module
-  uint32_t *nid_table;     // array of 32-bit NIDs for the exports, first functions then vars
-  void     **entry_table;  // array of pointers to exported functions and then variables
-} sce_module_exports_t;
-
-static void *sce_module_get_export(const char *module_name, const uint32_t func_nid) {
-  tai_module_info_t tai_info = { 0 };
-  tai_info.size = sizeof(tai_info);
-
-  const int ret = taiGetModuleInfo(module_name, &tai_info);
-  if (ret < 0) {
-    DEBUG_PRINTF("sce_module_get_export() failed: taiGetModuleInfo() returned %d\n", ret);
-    return NULL;
-  }
+int vrtld_sce_exports_init(void) {
+  uintptr_t exports_start, exports_end;
 
-  uintptr_t i = tai_info.exports_start;
-  while (i < tai_info.exports_end) {
-    const sce_module_exports_t *imp_info = (sce_module_exports_t *)(i);
-    for (int j = 0; j < imp_info->num_functions + imp_info->num_vars; j++) {
-      if (imp_info->nid_table[j] == func_nid)
-        return imp_info->entry_table[j];
-    }
-    i += imp_info->size;
+  // index the main module's exports once, so that every lookup afterwards is a binary search
+  if (plat_main_exports(&exports_start, &exports_end) < 0) {
+    DEBUG_PRINTF("vrtld_sce_exports_init() failed: no export tables\n");
+    return -1;
   }
 
-  return NULL;
+  return nid_index_build(exports_start, exports_end);
 }
 
-static uint32_t sce_nid_for_name(const char *name) {
-  SceSblDmac5HashTransformParam param = { 0 };
-  uint8_t src[0x40 + 0x3F];
-  uint8_t dst[0x20];
-  const size_t len = strlen(name);
-
-  void *p = (void*)((uintptr_t)(src + 0x3F) & ~0x3F);
-  snprintf((char*)p, 64, name);
-
-  param.src = p;
-  param.dst = dst;
-  param.length = len;
-
-  const int ret = sceSblDmac5HashTransform(&param, 0x13, 0);
-  if (ret < 0) {
-    DEBUG_PRINTF("sce_nid_for_name(%s) failed: %d\n", name, ret);
-    return 0;
-  }
-
-  return (dst[0] << 24) | (dst[1] << 16) | (dst[2] << 8) | dst[3];
+void vrtld_sce_exports_free(void) {
+  nid_index_free();
 }
 
 void *vrtld_lookup_sce_export(const char *symname) {
-  if ((vrtld_init_flags() & VRTLD_NO_SCE_EXPORTS) == 0) {
-    const uint32_t nid = sce_nid_for_name(symname);
-    if (nid > 0)
-      return sce_module_get_export(TAI_MAIN_MODULE, nid);
-  }
+  // don't even bother hashing the name if there's nothing to look in
+  if ((vrtld_init_flags() & VRTLD_NO_SCE_EXPORTS) == 0 && nid_index_count())
+    return nid_index_find(nid_for_name(symname));
   return NULL;
 }
 
@@ -85,7 +42,16 @@ const Elf32_Sym *vrtld_elf_hashtab_lookup(
   const uint32_t *hashtab,
   const char *symname
 ) {
-    const uint32_t hash = vrtld_elf_hash((const uint8_t *)symname);
+    return vrtld_elf_hashtab_lookup_hashed(strtab, symtab, hashtab, symname, vrtld_elf_hash((const uint8_t *)symname));
+}
+
+const Elf32_Sym *vrtld_elf_hashtab_lookup_hashed(
+  const char *strtab,
+  const Elf32_Sym *symtab,
+  const uint32_t *hashtab,
+  const char *symname,
+  const uint32_t hash
+) {
     const uint32_t nbucket = hashtab[0];
     const uint32_t *bucket = &hashtab[2];
     const uint32_t *chain = &bucket[nbucket];
@@ -97,10 +63,55 @@ const Elf32_Sym *vrtld_elf_hashtab_lookup(
     return NULL;
 }
 
+const Elf32_Sym *vrtld_gnu_hashtab_lookup(
+  const char *strtab,
+  const Elf32_Sym *symtab,
+  const uint32_t *gnuhashtab,
+  const char *symname
+) {
+    return vrtld_gnu_hashtab_lookup_hashed(strtab, symtab, gnuhashtab, symname, vrtld_gnu_hash((const uint8_t *)symname));
+}
+
+const Elf32_Sym *vrtld_gnu_hashtab_lookup_hashed(
+  const char *strtab,
+  const Elf32_Sym *symtab,
+  const uint32_t *gnuhashtab,
+  const char *symname,
+  const uint32_t hash
+) {
+    const uint32_t nbucket = gnuhashtab[0];
+    const uint32_t symoffset = gnuhashtab[1];
+    const uint32_t bloomsz = gnuhashtab[2];
+    const uint32_t bloomshift = gnuhashtab[3];
+    const uint32_t *bloom = &gnuhashtab[4];
+    const uint32_t *bucket = &bloom[bloomsz];
+    const uint32_t *chain = &bucket[nbucket];
+    // check the bloom filter first; bloomsz is always a power of 2
+    const uint32_t word = bloom[(hash / 32) & (bloomsz - 1)];
+    const uint32_t mask = (1u << (hash % 32)) | (1u << ((hash >> bloomshift) % 32));
+    if ((word & mask) != mask)
+      return NULL;
+    uint32_t i = bucket[hash % nbucket];
+    if (i < symoffset)
+      return NULL;
+    // the chain holds hashes with the lowest bit marking the end of the chain;
+    // only bother comparing strings when the hashes match
+    for (;; ++i) {
+      const uint32_t chainhash = chain[i - symoffset];
+      if ((hash | 1) == (chainhash | 1) && !strcmp(symname, strtab + symtab[i].st_name))
+        return symtab + i;
+      if (chainhash & 1)
+        break;
+    }
+    return NULL;
+}
+
 const Elf32_Sym *vrtld_lookup_sym(const dso_t *mod, const char *symname) {
   if (!mod || !mod->dynsym || !mod->dynstrtab)
     return NULL;
-  // if hashtab is available, use that for lookup, otherwise do linear search
+  // prefer the GNU hashtab, then the SysV one, otherwise do linear search
+  if (mod->gnuhashtab)
+    return vrtld_gnu_hashtab_lookup(mod->dynstrtab, mod->dynsym, mod->gnuhashtab, symname);
   if (mod->hashtab)
     return vrtld_elf_hashtab_lookup(mod->dynstrtab, mod->dynsym, mod->hashtab, symname);
   // sym 0 is always UNDEF
@@ -111,11 +122,13 @@ const Elf32_Sym *vrtld_lookup_sym(const dso_t *mod, const char *symname) {
   return NULL;
 }
 
-void *vrtld_lookup(const dso_t *mod, const char *symname) {
-  // try normal elf lookup first
-  const Elf32_Sym *sym = vrtld_lookup_sym(mod, symname);
-  if (sym && sym->st_shndx != SHN_UNDEF)
-    return (uint8_t *)mod->base + sym->st_value;
+static void *vrtld_lookup_result(const dso_t *mod, const Elf32_Sym *sym, const char *symname) {
+  if (sym && sym->st_shndx != SHN_UNDEF) {
+    // TLS variables are somewhere else for every thread
+    if (ELF32_ST_TYPE(sym->st_info) == STT_TLS)
+      return tls_get_addr(mod, sym->st_value);
+    return vrtld_sym_addr(mod, sym);
+  }
   // if this is the main module, try SCE exports table as a last resort
   if (mod == &vrtld_dsolist)
     return vrtld_lookup_sce_export(symname);
@@ -123,43 +136,223 @@ void *vrtld_lookup(const dso_t *mod, const char *symname) {
   return NULL;
 }
 
-const Elf32_Sym *vrtld_reverse_lookup_sym(const dso_t *mod, const void *addr) {
+void *vrtld_lookup(const dso_t *mod, const char *symname) {
+  // try normal elf lookup first
+  return vrtld_lookup_result(mod, vrtld_lookup_sym(mod, symname), symname);
+}
+
+void *vrtld_lookup_hashed(const dso_t *mod, const vrtld_hashed_name_t *hn) {
+  const Elf32_Sym *sym;
+  if (!mod->dynsym || !mod->dynstrtab)
+    sym = NULL;
+  else if (mod->gnuhashtab)
+    sym = vrtld_gnu_hashtab_lookup_hashed(mod->dynstrtab, mod->dynsym, mod->gnuhashtab, hn->name, hn->gnuhash);
+  else if (mod->hashtab)
+    sym = vrtld_elf_hashtab_lookup_hashed(mod->dynstrtab, mod->dynsym, mod->hashtab, hn->name, hn->elfhash);
+  else
+    sym = vrtld_lookup_sym(mod, hn->name);
+  return vrtld_lookup_result(mod, sym, hn->name);
+}
+
+uint32_t vrtld_lookup_bucket(const dso_t *mod, const vrtld_hashed_name_t *hn) {
+  // both kinds of table start with the bucket count
+  if (mod->gnuhashtab)
+    return hn->gnuhash % mod->gnuhashtab[0];
+  if (mod->hashtab)
+    return hn->elfhash % mod->hashtab[0];
+  return 0;
+}
+
+// how far back to look for a symbol that actually contains the address
+#define ADDRMAP_MAX_BACKTRACK 8
+
+// address maps are built on first use, possibly by several dladdr() calls at once
+static pthread_mutex_t addrmap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct dso_symaddr {
+  uintptr_t addr;
+  uint32_t size;
+  uint32_t symidx;
+} dso_symaddr_t;
+
+static int symaddr_cmp(const void *a, const void *b) {
+  const dso_symaddr_t *sa = a;
+  const dso_symaddr_t *sb = b;
+  if (sa->addr != sb->addr)
+    return (sa->addr < sb->addr) ? -1 : 1;
+  // prefer the first symbol at the same address
+  return (sa->symidx < sb->symidx) ? -1 : (sa->symidx > sb->symidx);
+}
+
+static inline int symaddr_is_code_or_data(const Elf32_Sym *sym) {
+  const int type = ELF32_ST_TYPE(sym->st_info);
+  return sym->st_shndx != SHN_UNDEF && sym->st_value && sym->st_name
+    && (type == STT_FUNC || type == STT_OBJECT || type == STT_NOTYPE);
+}
+
+static int vrtld_build_addrmap(dso_t *mod) {
+  uint32_t num = 0;
+  for (size_t i = 1; i < mod->num_dynsym; ++i)
+    num += symaddr_is_code_or_data(&mod->dynsym[i]);
+
+  if (!num)
+    return -1;
+
+  dso_symaddr_t *addrmap = malloc(num * sizeof(*addrmap));
+  if (!addrmap)
+    return -1;
+
+  for (size_t i = 1, n = 0; i < mod->num_dynsym; ++i) {
+    const Elf32_Sym *sym = &mod->dynsym[i];
+    if (symaddr_is_code_or_data(sym)) {
+      addrmap[n].addr = (uintptr_t)vrtld_sym_addr(mod, sym);
+      addrmap[n].size = sym->st_size;
+      addrmap[n].symidx = i;
+      ++n;
+    }
+  }
+
+  qsort(addrmap, num, sizeof(*addrmap), symaddr_cmp);
+
+  // publish the map only once it's complete, since readers don't take addrmap_lock
+  mod->num_addrmap = num;
+  __atomic_store_n(&mod->addrmap, addrmap, __ATOMIC_RELEASE);
+
+  DEBUG_PRINTF("`%s`: built address map with %u symbols\n", mod->name, num);
+
+  return 0;
+}
+
+void vrtld_free_addrmap(dso_t *mod) {
+  free(mod->addrmap);
+  mod->addrmap = NULL;
+  mod->num_addrmap = 0;
+}
+
+const Elf32_Sym *vrtld_reverse_lookup_sym(dso_t *mod, const void *addr) {
   if (!(mod->flags & MOD_RELOCATED) || !mod->dynsym || mod->num_dynsym <= 1)
     return NULL;
-  // skip mandatory UNDEF
-  for (size_t i = 1; i < mod->num_dynsym; ++i) {
-    if (mod->dynsym[i].st_shndx != SHN_UNDEF && mod->dynsym[i].st_value) {
-      const uintptr_t symaddr = mod->dynsym[i].st_value + (uintptr_t)mod->base;
-      if (symaddr == (uintptr_t)addr)
-        return mod->dynsym + i;
+
+  if (!__atomic_load_n(&mod->addrmap, __ATOMIC_ACQUIRE)) {
+    pthread_mutex_lock(&addrmap_lock);
+    const int ret = mod->addrmap ? 0 : vrtld_build_addrmap(mod);
+    pthread_mutex_unlock(&addrmap_lock);
+    if (ret)
+      return NULL;
+  }
+
+  // find the last symbol that starts at or before addr
+  const uintptr_t target = (uintptr_t)addr;
+  uint32_t lo = 0, hi = mod->num_addrmap;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    if (mod->addrmap[mid].addr <= target)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo == 0)
+    return NULL;
+
+  // prefer a symbol that actually contains addr, otherwise settle for the nearest preceding one
+  const dso_symaddr_t *best = &mod->addrmap[lo - 1];
+  for (uint32_t i = lo, n = 0; i > 0 && n < ADDRMAP_MAX_BACKTRACK; --i, ++n) {
+    const dso_symaddr_t *sa = &mod->addrmap[i - 1];
+    if (target - sa->addr < sa->size) {
+      best = sa;
+      break;
     }
   }
-  return NULL;
+
+  return mod->dynsym + best->symidx;
 }
 
-void *vrtld_lookup_global(const char *symname) {
+// how many modules of a dependency graph can be searched without allocating
+#define LOOKUP_SCOPE_INLINE 32
+
+// the dependency graph of mod, breadth first like ld.so does it; this is how modules that were
+// loaded LOCAL find each other. the graph of a module that's being looked up from can't change anymore,
+// since dependencies are only ever added to modules that are still being loaded
+static void *vrtld_lookup_scope(const dso_t *mod, const char *symname) {
+  const dso_t *inline_queue[LOOKUP_SCOPE_INLINE];
+  const dso_t **queue = inline_queue;
+  uint32_t capacity = LOOKUP_SCOPE_INLINE;
+  uint32_t head = 0, tail = 0;
+  void *addr = NULL;
+
+  queue[tail++] = mod;
+  while (head < tail && !addr) {
+    const dso_t *cur = queue[head++];
+    if (cur != mod) {
+      const Elf32_Sym *sym = vrtld_lookup_sym(cur, symname);
+      const int bind = sym ? ELF32_ST_BIND(sym->st_info) : STB_LOCAL;
+      if (sym && sym->st_shndx != SHN_UNDEF && (bind == STB_GLOBAL || bind == STB_WEAK) && ELF32_ST_TYPE(sym->st_info) != STT_TLS)
+        addr = vrtld_sym_addr(cur, sym);
+    }
+    for (uint32_t i = 0; i < cur->num_deps && !addr; ++i) {
+      // diamonds are common, so don't queue anything twice
+      const dso_t *dep = cur->deps[i];
+      uint32_t j = 0;
+      while (j < tail && queue[j] != dep)
+        ++j;
+      if (j < tail)
+        continue;
+      if (tail == capacity) {
+        const dso_t **grown = malloc(capacity * 2 * sizeof(*grown));
+        if (!grown)
+          goto out;
+        memcpy(grown, queue, tail * sizeof(*grown));
+        if (queue != inline_queue)
+          free(queue);
+        queue = grown;
+        capacity *= 2;
+      }
+      queue[tail++] = dep;
+    }
+  }
+
+out:
+  if (queue != inline_queue)
+    free(queue);
+  return addr;
+}
+
+// called from lookups running in parallel, so the counters are bumped atomically
+void *vrtld_lookup_global(dso_t *mod, const char *symname) {
   if (!symname || !*symname)
     return NULL;
 
-  // try the override exports table if it exists
-  if (&__vrtld_override_exports && &__vrtld_num_override_exports && __vrtld_override_exports) {
-    for (size_t i = 0; i < __vrtld_num_override_exports; ++i)
-      if (!strcmp(symname, __vrtld_override_exports[i].name))
-        return __vrtld_override_exports[i].addr_rx;
+  // the global table has the override exports and all GLOBAL modules, in order of precedence
+  int is_override = 0;
+  void *addr = gsym_lookup(symname, &is_override);
+  if (addr && is_override) {
+    __atomic_fetch_add(&mod->stats.lookup_hits[VRTLD_SOURCE_OVERRIDE], 1, __ATOMIC_RELAXED);
+    return addr;
   }
 
-  // try SCE exports table of the main module
+  // try SCE exports table of the main module, it goes before the actual modules
   void *exp = vrtld_lookup_sce_export(symname);
-  if (exp) return exp;
-
-  // try actual modules
-  const dso_t *mod = &vrtld_dsolist;
-  while (mod) {
-    const Elf32_Sym *sym = vrtld_lookup_sym(mod, symname);
-    if (sym && sym->st_shndx != SHN_UNDEF)
-      return (void *)((uintptr_t)mod->base + sym->st_value);
-    mod = mod->next;
+  if (exp) {
+    __atomic_fetch_add(&mod->stats.lookup_hits[VRTLD_SOURCE_SCE], 1, __ATOMIC_RELAXED);
+    return exp;
   }
 
-  return NULL;
+  // then whatever mod depends on that isn't GLOBAL
+  if (!addr)
+    addr = vrtld_lookup_scope(mod, symname);
+
+  if (addr) {
+    __atomic_fetch_add(&mod->stats.lookup_hits[VRTLD_SOURCE_MODULE], 1, __ATOMIC_RELAXED);
+    return addr;
+  }
+
+  // the loader's own helpers go last, so that the app can replace them
+  addr = tls_builtin_lookup(symname);
+  if (addr)
+    __atomic_fetch_add(&mod->stats.lookup_hits[VRTLD_SOURCE_LOADER], 1, __ATOMIC_RELAXED);
+  else
+    __atomic_fetch_add(&mod->stats.lookup_misses, 1, __ATOMIC_RELAXED);
+
+  return addr;
 }
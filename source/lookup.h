@@ -2,9 +2,35 @@
 
 #include "common.h"
 
+// SHN_ABS symbols hold absolute addresses, everything else is relative to the module base
+static inline void *vrtld_sym_addr(const dso_t *mod, const Elf32_Sym *sym) {
+  if (sym->st_shndx == SHN_ABS)
+    return (void *)(uintptr_t)sym->st_value;
+  return (uint8_t *)mod->base + sym->st_value;
+}
+
+// a symbol name with its hashes already calculated, for looking up lots of names at once
+typedef struct vrtld_hashed_name {
+  const char *name;
+  uint32_t gnuhash;
+  uint32_t elfhash;
+} vrtld_hashed_name_t;
+
+const Elf32_Sym *vrtld_elf_hashtab_lookup_hashed(const char *strtab, const Elf32_Sym *symtab, const uint32_t *hashtab, const char *symname, const uint32_t hash);
+const Elf32_Sym *vrtld_gnu_hashtab_lookup_hashed(const char *strtab, const Elf32_Sym *symtab, const uint32_t *gnuhashtab, const char *symname, const uint32_t hash);
+
 const Elf32_Sym *vrtld_lookup_sym(const dso_t *mod, const char *symname);
-const Elf32_Sym *vrtld_reverse_lookup_sym(const dso_t *mod, const void *addr);
+const Elf32_Sym *vrtld_reverse_lookup_sym(dso_t *mod, const void *addr);
+void vrtld_free_addrmap(dso_t *mod);
 
 void *vrtld_lookup(const dso_t *mod, const char *symname);
-void *vrtld_lookup_global(const char *symname);
+void *vrtld_lookup_hashed(const dso_t *mod, const vrtld_hashed_name_t *hn);
+// which hash bucket of mod the name falls into; looking names up in bucket order is kinder to the cache
+uint32_t vrtld_lookup_bucket(const dso_t *mod, const vrtld_hashed_name_t *hn);
+// mod is the module doing the lookup; it gets the lookup counted in its stats, and after everything
+// GLOBAL its own dependencies are searched, so that LOCAL modules can be linked against
+void *vrtld_lookup_global(dso_t *mod, const char *symname);
 void *vrtld_lookup_sce_export(const char *symname);
+
+int vrtld_sce_exports_init(void);
+void vrtld_sce_exports_free(void);
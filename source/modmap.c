@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "util.h"
+#include "modmap.h"
+
+#define MODMAP_MIN_CAPACITY 16
+
+typedef struct modmap_entry {
+  uintptr_t start;
+  uintptr_t end;
+  dso_t *mod;
+} modmap_entry_t;
+
+static modmap_entry_t *modmap;
+static uint32_t modmap_len;
+static uint32_t modmap_cap;
+
+// last module that was found; consecutive queries usually hit the same one
+// lookups can run in parallel, so it's only ever accessed atomically by modmap_find()
+static dso_t *modmap_last;
+
+// index of the first entry that starts after addr
+static uint32_t modmap_upper_bound(const uintptr_t addr) {
+  uint32_t lo = 0, hi = modmap_len;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    if (modmap[mid].start <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+int modmap_insert(dso_t *mod) {
+  if (modmap_len == modmap_cap) {
+    const uint32_t cap = modmap_cap ? modmap_cap * 2 : MODMAP_MIN_CAPACITY;
+    modmap_entry_t *newmap = realloc(modmap, cap * sizeof(*modmap));
+    if (!newmap) {
+      DEBUG_PRINTF("modmap_insert(): could not grow to %u entries\n", cap);
+      return -1;
+    }
+    modmap = newmap;
+    modmap_cap = cap;
+  }
+
+  const uintptr_t start = (uintptr_t)mod->base;
+  const uint32_t i = modmap_upper_bound(start);
+  memmove(&modmap[i + 1], &modmap[i], (modmap_len - i) * sizeof(*modmap));
+  modmap[i].start = start;
+  modmap[i].end = start + mod->size;
+  modmap[i].mod = mod;
+  modmap_len++;
+
+  return 0;
+}
+
+void modmap_remove(dso_t *mod) {
+  if (modmap_last == mod)
+    modmap_last = NULL;
+
+  const uint32_t i = modmap_upper_bound((uintptr_t)mod->base);
+  if (i == 0 || modmap[i - 1].mod != mod)
+    return;
+
+  memmove(&modmap[i - 1], &modmap[i], (modmap_len - i) * sizeof(*modmap));
+  modmap_len--;
+}
+
+void modmap_clear(void) {
+  free(modmap);
+  modmap = NULL;
+  modmap_len = 0;
+  modmap_cap = 0;
+  modmap_last = NULL;
+}
+
+dso_t *modmap_find(const void *addr) {
+  const uintptr_t p = (uintptr_t)addr;
+
+  dso_t *last = __atomic_load_n(&modmap_last, __ATOMIC_RELAXED);
+  if (last && p >= (uintptr_t)last->base && p < (uintptr_t)last->base + last->size)
+    return last;
+
+  const uint32_t i = modmap_upper_bound(p);
+  if (i == 0 || p >= modmap[i - 1].end)
+    return NULL;
+
+  dso_t *mod = modmap[i - 1].mod;
+  __atomic_store_n(&modmap_last, mod, __ATOMIC_RELAXED);
+  return mod;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "common.h"
+
+// sorted index of the address ranges of all linked modules (except main)
+
+int modmap_insert(dso_t *mod);
+void modmap_remove(dso_t *mod);
+void modmap_clear(void);
+
+dso_t *modmap_find(const void *addr);
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util.h"
+#include "nid.h"
+
+// recently hashed names and their NIDs, keyed by a 64-bit hash and the length of the name,
+// so that long mangled names are memoized without keeping a copy of them
+#define NID_CACHE_SIZE 256
+
+typedef struct sce_module_exports {
+  uint16_t size;           // size of this structure; 0x20 for Vita 1.x
+  uint8_t  lib_version[2]; //
+  uint16_t attribute;      // ?
+  uint16_t num_functions;  // number of exported functions
+  uint16_t num_vars;       // number of exported variables
+  uint16_t unk;
+  uint32_t num_tls_vars;   // number of exported TLS variables?  <-- pretty sure wrong // yifanlu
+  uint32_t lib_nid;        // NID of this specific export list; one PRX can export several names
+  char     *lib_name;      // name of the export module
+  uint32_t *nid_table;     // array of 32-bit NIDs for the exports, first functions then vars
+  void     **entry_table;  // array of pointers to exported functions and then variables
+} sce_module_exports_t;
+
+typedef struct nid_entry {
+  uint32_t nid;
+  uint32_t seq; // original position, so that the first export with a given NID wins like before
+  void *addr;
+} nid_entry_t;
+
+static nid_entry_t *nid_index;
+static uint32_t nid_index_len;
+
+// lookups can run on several threads at once, so each slot is a tiny seqlock:
+// seq is odd while the slot is being written, and readers retry by just hashing the name
+static struct {
+  uint32_t seq;
+  uint32_t len;
+  uint64_t hash;
+  uint32_t nid;
+} nid_cache[NID_CACHE_SIZE];
+
+/* SHA-1; the NID is the first 4 bytes of the digest */
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_block(uint32_t state[5], const uint8_t *block) {
+  uint32_t w[80];
+
+  for (int i = 0; i < 16; ++i)
+    w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) | ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+  for (int i = 16; i < 80; ++i)
+    w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+  for (int i = 0; i < 80; ++i) {
+    uint32_t f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+    const uint32_t t = ROL32(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = ROL32(b, 30);
+    b = a;
+    a = t;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+static uint32_t sha1_nid(const uint8_t *data, const size_t len) {
+  uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  uint8_t block[64];
+  size_t left = len;
+
+  for (; left >= 64; left -= 64, data += 64)
+    sha1_block(state, data);
+
+  // pad the tail: 0x80, zeroes, then bit length as a big endian u64
+  memset(block, 0, sizeof(block));
+  memcpy(block, data, left);
+  block[left] = 0x80;
+  if (left >= 56) {
+    sha1_block(state, block);
+    memset(block, 0, sizeof(block));
+  }
+  const uint64_t bits = (uint64_t)len * 8;
+  for (int i = 0; i < 8; ++i)
+    block[63 - i] = (uint8_t)(bits >> (i * 8));
+  sha1_block(state, block);
+
+  return state[0];
+}
+
+uint32_t nid_for_name(const char *name) {
+  const size_t len = strlen(name);
+  const uint64_t hash = vrtld_hash64(VRTLD_HASH64_INIT, name, len);
+  const uint32_t slot = (uint32_t)hash & (NID_CACHE_SIZE - 1);
+
+  uint32_t seq = __atomic_load_n(&nid_cache[slot].seq, __ATOMIC_ACQUIRE);
+  if (!(seq & 1) && nid_cache[slot].hash == hash && nid_cache[slot].len == len) {
+    const uint32_t nid = nid_cache[slot].nid;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&nid_cache[slot].seq, __ATOMIC_RELAXED) == seq)
+      return nid;
+  }
+
+  const uint32_t nid = sha1_nid((const uint8_t *)name, len);
+
+  // if someone else is writing the slot right now, just don't bother
+  seq = __atomic_load_n(&nid_cache[slot].seq, __ATOMIC_RELAXED);
+  if (!(seq & 1) && __atomic_compare_exchange_n(&nid_cache[slot].seq, &seq, seq + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    nid_cache[slot].len = (uint32_t)len;
+    nid_cache[slot].hash = hash;
+    nid_cache[slot].nid = nid;
+    __atomic_store_n(&nid_cache[slot].seq, seq + 2, __ATOMIC_RELEASE);
+  }
+
+  return nid;
+}
+
+static int nid_entry_cmp(const void *a, const void *b) {
+  const nid_entry_t *ea = a;
+  const nid_entry_t *eb = b;
+  if (ea->nid != eb->nid)
+    return (ea->nid < eb->nid) ? -1 : 1;
+  return (ea->seq < eb->seq) ? -1 : (ea->seq > eb->seq);
+}
+
+int nid_index_build(const uintptr_t exports_start, const uintptr_t exports_end) {
+  nid_index_free();
+
+  // count everything first
+  uint32_t count = 0;
+  for (uintptr_t i = exports_start; i < exports_end; ) {
+    const sce_module_exports_t *exp = (const sce_module_exports_t *)i;
+    if (!exp->size) break; // malformed
+    count += exp->num_functions + exp->num_vars;
+    i += exp->size;
+  }
+
+  if (!count)
+    return 0;
+
+  nid_index = malloc(count * sizeof(*nid_index));
+  if (!nid_index) {
+    DEBUG_PRINTF("nid_index_build(): could not allocate %u entries\n", count);
+    return -1;
+  }
+
+  uint32_t n = 0;
+  for (uintptr_t i = exports_start; i < exports_end && n < count; ) {
+    const sce_module_exports_t *exp = (const sce_module_exports_t *)i;
+    if (!exp->size) break;
+    for (int j = 0; j < exp->num_functions + exp->num_vars && n < count; ++j, ++n) {
+      nid_index[n].nid = exp->nid_table[j];
+      nid_index[n].seq = n;
+      nid_index[n].addr = exp->entry_table[j];
+    }
+    i += exp->size;
+  }
+
+  qsort(nid_index, n, sizeof(*nid_index), nid_entry_cmp);
+  nid_index_len = n;
+
+  DEBUG_PRINTF("nid_index_build(): indexed %u exports\n", n);
+
+  return 0;
+}
+
+void *nid_index_find(const uint32_t nid) {
+  // lower bound, so that we get the first entry with this NID
+  uint32_t lo = 0, hi = nid_index_len;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    if (nid_index[mid].nid < nid)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < nid_index_len && nid_index[lo].nid == nid)
+    return nid_index[lo].addr;
+  return NULL;
+}
+
+uint32_t nid_index_count(void) {
+  return nid_index_len;
+}
+
+uint64_t nid_index_hash(const uint64_t h) {
+  return vrtld_hash64(h, nid_index, nid_index_len * sizeof(*nid_index));
+}
+
+void nid_index_free(void) {
+  free(nid_index);
+  nid_index = NULL;
+  nid_index_len = 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// SCE NID helpers; these don't talk to the system, so the caller has to supply the export tables
+
+uint32_t nid_for_name(const char *name);
+
+int nid_index_build(const uintptr_t exports_start, const uintptr_t exports_end);
+void *nid_index_find(const uint32_t nid);
+uint32_t nid_index_count(void);
+uint64_t nid_index_hash(const uint64_t h);
+void nid_index_free(void);
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "util.h"
+#include "pathtab.h"
+
+// must be a power of 2
+#define PATHTAB_NUM_BUCKETS 128
+
+typedef struct pathtab_entry {
+  struct pathtab_entry *next;
+  dso_t *mod;
+  uint32_t hash;
+  // file identity at the time it was loaded
+  off_t size;
+  time_t mtime;
+  int has_ident;
+  char path[];
+} pathtab_entry_t;
+
+static pathtab_entry_t *pathtab[PATHTAB_NUM_BUCKETS];
+
+static inline int pathtab_ident_matches(const pathtab_entry_t *ent, const struct stat *st) {
+  // if either side doesn't know the identity, the path has to be enough
+  if (!st || !ent->has_ident)
+    return 1;
+  return ent->size == st->st_size && ent->mtime == st->st_mtime;
+}
+
+dso_t *pathtab_find(const char *path, const struct stat *st) {
+  const uint32_t hash = vrtld_gnu_hash((const uint8_t *)path);
+  for (const pathtab_entry_t *ent = pathtab[hash & (PATHTAB_NUM_BUCKETS - 1)]; ent; ent = ent->next) {
+    if (ent->hash == hash && !strcmp(ent->path, path)) {
+      if (pathtab_ident_matches(ent, st))
+        return ent->mod;
+      // same path, but it's a different file now
+      DEBUG_PRINTF("pathtab_find(): `%s` has changed since `%s` was loaded\n", path, ent->mod->name);
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+int pathtab_insert(const char *path, const struct stat *st, dso_t *mod) {
+  const uint32_t hash = vrtld_gnu_hash((const uint8_t *)path);
+  pathtab_entry_t **head = &pathtab[hash & (PATHTAB_NUM_BUCKETS - 1)];
+
+  // replace any stale entry for the same path
+  for (pathtab_entry_t **pent = head; *pent; pent = &(*pent)->next) {
+    if ((*pent)->hash == hash && !strcmp((*pent)->path, path)) {
+      pathtab_entry_t *ent = *pent;
+      *pent = ent->next;
+      free(ent);
+      break;
+    }
+  }
+
+  const size_t len = strlen(path);
+  pathtab_entry_t *ent = malloc(sizeof(*ent) + len + 1);
+  if (!ent) {
+    DEBUG_PRINTF("pathtab_insert(): could not allocate entry for `%s`\n", path);
+    return -1;
+  }
+
+  ent->mod = mod;
+  ent->hash = hash;
+  ent->has_ident = (st != NULL);
+  ent->size = st ? st->st_size : 0;
+  ent->mtime = st ? st->st_mtime : 0;
+  memcpy(ent->path, path, len + 1);
+
+  ent->next = *head;
+  *head = ent;
+
+  return 0;
+}
+
+void pathtab_remove(const dso_t *mod) {
+  // a module only has a couple of entries, but they can be in any bucket
+  for (uint32_t i = 0; i < PATHTAB_NUM_BUCKETS; ++i) {
+    pathtab_entry_t **pent = &pathtab[i];
+    while (*pent) {
+      pathtab_entry_t *ent = *pent;
+      if (ent->mod == mod) {
+        *pent = ent->next;
+        free(ent);
+      } else {
+        pent = &ent->next;
+      }
+    }
+  }
+}
+
+void pathtab_clear(void) {
+  for (uint32_t i = 0; i < PATHTAB_NUM_BUCKETS; ++i) {
+    pathtab_entry_t *ent = pathtab[i];
+    while (ent) {
+      pathtab_entry_t *next = ent->next;
+      free(ent);
+      ent = next;
+    }
+    pathtab[i] = NULL;
+  }
+}
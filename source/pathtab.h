@@ -0,0 +1,13 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include "common.h"
+
+// loaded modules by path, both canonical and the ones they were opened by
+
+int pathtab_insert(const char *path, const struct stat *st, dso_t *mod);
+void pathtab_remove(const dso_t *mod);
+void pathtab_clear(void);
+
+dso_t *pathtab_find(const char *path, const struct stat *st);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// everything the loader needs from the OS; see platform_vita.c and platform_linux.c
+
+#ifdef VRTLD_HOST
+// modules can be mapped, relocated and looked up, but never executed
+#define PLAT_CAN_EXECUTE 0
+#else
+#define PLAT_CAN_EXECUTE 1
+#endif
+
+enum plat_prot {
+  PLAT_PROT_R,
+  PLAT_PROT_RX,
+  PLAT_PROT_RW,
+};
+
+// handle of a mapped segment; 0 means nothing is mapped
+typedef int plat_block_t;
+
+// checks that whatever the loader depends on is available
+int plat_init(void);
+
+// reserves and releases the address window that modules are mapped into
+int plat_reserve_window(const uintptr_t start, const uintptr_t end);
+void plat_release_window(const uintptr_t start, const uintptr_t end);
+
+// maps `size` bytes at exactly `addr`, which is page aligned and inside the window
+plat_block_t plat_map(void *addr, const size_t size, const int prot);
+void plat_unmap(const plat_block_t blk, void *addr, const size_t size);
+
+// writes to memory that might be mapped read only
+void plat_write_protected(void *dst, const void *src, const size_t size);
+void plat_flush_caches(void *addr, const size_t size);
+
+// range of the main module's SCE export tables; fails if there are none
+int plat_main_exports(uintptr_t *out_start, uintptr_t *out_end);
+
+uint64_t plat_time_us(void);
+uint32_t plat_thread_id(void);
+uint32_t plat_process_id(void);
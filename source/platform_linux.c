@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "util.h"
+#include "platform.h"
+
+// modules are only mapped, relocated and looked up here, never executed, so everything
+// is simply mapped RW; the window has to be below 4GB so that addresses fit in ELF32 slots
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+int plat_init(void) {
+  return 0;
+}
+
+int plat_reserve_window(const uintptr_t start, const uintptr_t end) {
+  if (end > UINT32_MAX) {
+    DEBUG_PRINTF("plat_reserve_window(): window 0x%lx - 0x%lx does not fit in 32 bits\n", (unsigned long)start, (unsigned long)end);
+    return -1;
+  }
+
+  void *ptr = mmap((void *)start, end - start, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+  if (ptr == MAP_FAILED)
+    return -1;
+
+  if (ptr != (void *)start) {
+    // old kernels ignore MAP_FIXED_NOREPLACE and treat the address as a hint
+    munmap(ptr, end - start);
+    return -1;
+  }
+
+  return 0;
+}
+
+void plat_release_window(const uintptr_t start, const uintptr_t end) {
+  munmap((void *)start, end - start);
+}
+
+plat_block_t plat_map(void *addr, const size_t size, const int prot) {
+  (void)prot;
+  void *ptr = mmap(addr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  return (ptr == addr) ? 1 : 0;
+}
+
+void plat_unmap(const plat_block_t blk, void *addr, const size_t size) {
+  // put the reservation back
+  if (blk)
+    mmap(addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+}
+
+void plat_write_protected(void *dst, const void *src, const size_t size) {
+  memcpy(dst, src, size);
+}
+
+void plat_flush_caches(void *addr, const size_t size) {
+  // nothing is going to execute it
+  (void)addr;
+  (void)size;
+}
+
+int plat_main_exports(uintptr_t *out_start, uintptr_t *out_end) {
+  // no such thing here
+  (void)out_start;
+  (void)out_end;
+  return -1;
+}
+
+uint64_t plat_time_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t plat_thread_id(void) {
+  return (uint32_t)syscall(SYS_gettid);
+}
+
+uint32_t plat_process_id(void) {
+  return (uint32_t)getpid();
+}
@@ -0,0 +1,109 @@
+#include <string.h>
+#include <vitasdk.h>
+#include <kubridge.h>
+#include <taihen.h>
+
+#include "util.h"
+#include "platform.h"
+
+#ifndef SCE_KERNEL_MEMBLOCK_TYPE_USER_RX
+#define SCE_KERNEL_MEMBLOCK_TYPE_USER_RX 0x0C20D050
+#endif
+
+#ifndef SCE_KERNEL_MEMBLOCK_TYPE_USER_R
+#define SCE_KERNEL_MEMBLOCK_TYPE_USER_R SCE_KERNEL_MEMBLOCK_TYPE_USER_MAIN_R
+#endif
+
+static inline uint32_t plat_memblock_type(const int prot) {
+  switch (prot) {
+    case PLAT_PROT_R:  return SCE_KERNEL_MEMBLOCK_TYPE_USER_R;
+    case PLAT_PROT_RX: return SCE_KERNEL_MEMBLOCK_TYPE_USER_RX;
+    default:           return SCE_KERNEL_MEMBLOCK_TYPE_USER_RW;
+  }
+}
+
+int plat_init(void) {
+  // everything here goes through kubridge
+  int search_unk[2];
+  if (_vshKernelSearchModuleByName("kubridge", search_unk) < 0) {
+    vrtld_set_error("kubridge not detected");
+    return -1;
+  }
+  return 0;
+}
+
+int plat_reserve_window(const uintptr_t start, const uintptr_t end) {
+  // nothing to do, memblocks can be placed anywhere in there
+  (void)start;
+  (void)end;
+  return 0;
+}
+
+void plat_release_window(const uintptr_t start, const uintptr_t end) {
+  (void)start;
+  (void)end;
+}
+
+plat_block_t plat_map(void *addr, const size_t size, const int prot) {
+  SceKernelAllocMemBlockKernelOpt opt;
+  memset(&opt, 0, sizeof(opt));
+  opt.size = sizeof(opt);
+  opt.attr = 0x1;
+  opt.field_C = (uintptr_t)addr;
+  const SceUID blkid = kuKernelAllocMemBlock("dso_seg", plat_memblock_type(prot), size, &opt);
+  if (blkid < 0)
+    return 0;
+
+  // the segment should be where we expect it to be
+  void *outptr = NULL;
+  sceKernelGetMemBlockBase(blkid, &outptr);
+  if (outptr != addr) {
+    DEBUG_PRINTF("plat_map(): wanted memblock at %p, got %p\n", addr, outptr);
+    sceKernelFreeMemBlock(blkid);
+    return 0;
+  }
+
+  return blkid;
+}
+
+void plat_unmap(const plat_block_t blk, void *addr, const size_t size) {
+  (void)addr;
+  (void)size;
+  if (blk > 0)
+    sceKernelFreeMemBlock(blk);
+}
+
+void plat_write_protected(void *dst, const void *src, const size_t size) {
+  kuKernelCpuUnrestrictedMemcpy(dst, src, size);
+}
+
+void plat_flush_caches(void *addr, const size_t size) {
+  kuKernelFlushCaches(addr, size);
+}
+
+int plat_main_exports(uintptr_t *out_start, uintptr_t *out_end) {
+  tai_module_info_t tai_info = { 0 };
+  tai_info.size = sizeof(tai_info);
+
+  const int ret = taiGetModuleInfo(TAI_MAIN_MODULE, &tai_info);
+  if (ret < 0) {
+    DEBUG_PRINTF("plat_main_exports(): taiGetModuleInfo() returned %d\n", ret);
+    return -1;
+  }
+
+  *out_start = tai_info.exports_start;
+  *out_end = tai_info.exports_end;
+  return 0;
+}
+
+uint64_t plat_time_us(void) {
+  return sceKernelGetProcessTimeWide();
+}
+
+uint32_t plat_thread_id(void) {
+  return sceKernelGetThreadId();
+}
+
+uint32_t plat_process_id(void) {
+  return sceKernelGetProcessId();
+}
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "vrtld.h"
+#include "util.h"
+#include "exports.h"
+#include "nid.h"
+#include "modmap.h"
+#include "gsym.h"
+#include "rcache.h"
+
+// the cache file lives next to the module and is valid only as long as the module, its load
+// address, every module its imports were actually resolved against, and every module that
+// a lookup searches on the way there stay the same
+
+#define RCACHE_MAGIC   0x31435256 // 'VRC1'
+#define RCACHE_VERSION 3
+#define RCACHE_EXT     ".vrc"
+
+typedef struct rcache_hdr {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t ident;     // content hash of the module
+  uint64_t fixed;     // hash of the providers that aren't modules: overrides, SCE and main exports
+  uint64_t searched;  // hash of the GLOBAL modules and the dependencies, in the order they're searched
+  uint32_t base;      // where the module was loaded
+  uint32_t num_providers;
+  uint32_t num_entries;
+  uint32_t pad;
+} rcache_hdr_t;
+
+// a module that at least one import was resolved to
+typedef struct rcache_provider {
+  uint64_t ident;
+  uint32_t base;
+  uint32_t size;
+} rcache_provider_t;
+
+typedef struct rcache_entry {
+  uint32_t symno;
+  uint32_t symval;
+} rcache_entry_t;
+
+static uint64_t rcache_main_ident(void) {
+  // the main module's export table can only change through vrtld_set_main_exports(), which resets this
+  if (!vrtld_dsolist.ident) {
+    uint64_t h = VRTLD_HASH64_INIT;
+    for (uint32_t i = 1; i < vrtld_dsolist.num_dynsym && vrtld_dsolist.dynsym; ++i) {
+      const Elf32_Sym *sym = &vrtld_dsolist.dynsym[i];
+      const char *name = vrtld_dsolist.dynstrtab + sym->st_name;
+      h = vrtld_hash64(h, name, strlen(name));
+      h = vrtld_hash64(h, &sym->st_value, sizeof(sym->st_value));
+    }
+    vrtld_dsolist.ident = h;
+  }
+  return vrtld_dsolist.ident;
+}
+
+static uint64_t rcache_fixed_providers(void) {
+  uint64_t h = VRTLD_HASH64_INIT;
+
+  // override table
+  if (&__vrtld_override_exports && &__vrtld_num_override_exports && __vrtld_override_exports) {
+    for (size_t i = 0; i < __vrtld_num_override_exports; ++i) {
+      const vrtld_export_t *exp = &__vrtld_override_exports[i];
+      h = vrtld_hash64(h, exp->name, strlen(exp->name));
+      h = vrtld_hash64(h, &exp->addr_rx, sizeof(exp->addr_rx));
+    }
+  }
+
+  // SCE exports and main module exports
+  h = nid_index_hash(h);
+  const uint64_t main_ident = rcache_main_ident();
+  h = vrtld_hash64(h, &main_ident, sizeof(main_ident));
+
+  // the loader's own helpers, like __tls_get_addr()
+  const uintptr_t self = (uintptr_t)&rcache_fixed_providers;
+  h = vrtld_hash64(h, &self, sizeof(self));
+
+  return h;
+}
+
+static inline uint64_t rcache_hash_module(uint64_t h, const dso_t *p) {
+  const uint32_t base = (uintptr_t)p->base;
+  h = vrtld_hash64(h, &p->ident, sizeof(p->ident));
+  return vrtld_hash64(h, &base, sizeof(base));
+}
+
+// the modules a lookup from `mod` goes through besides the fixed providers; anything that
+// interposes an import, or provides one that used to be missing, shows up in here.
+// returns 0 if one of them can't be identified
+static uint64_t rcache_searched_modules(const dso_t *mod) {
+  uint64_t h = VRTLD_HASH64_INIT;
+  uint32_t num = 0;
+
+  // GLOBAL modules, by the priority they have in the global symbol table; there's few enough
+  // of them to just pick the next one every time
+  for (uint32_t prev = 0; ; ) {
+    const dso_t *next = NULL;
+    uint32_t next_prio = UINT32_MAX;
+    for (const dso_t *p = vrtld_dsolist.next; p; p = p->next) {
+      const uint32_t prio = gsym_priority(p);
+      if (prio > prev && prio < next_prio) {
+        next = p;
+        next_prio = prio;
+      }
+    }
+    if (!next)
+      break;
+    if (!next->ident)
+      return 0;
+    h = rcache_hash_module(h, next);
+    prev = next_prio;
+  }
+
+  // then the module's dependencies, breadth first like vrtld_lookup_global() does
+  for (const dso_t *p = vrtld_dsolist.next; p; p = p->next)
+    ++num;
+  const dso_t **queue = malloc((num + 1) * sizeof(*queue));
+  if (!queue)
+    return 0;
+  uint32_t head = 0, tail = 0;
+  queue[tail++] = mod;
+  while (head < tail) {
+    const dso_t *cur = queue[head++];
+    for (uint32_t i = 0; i < cur->num_deps; ++i) {
+      const dso_t *dep = cur->deps[i];
+      uint32_t j = 0;
+      while (j < tail && queue[j] != dep)
+        ++j;
+      if (j < tail)
+        continue;
+      if (!dep->ident || tail > num) {
+        free(queue);
+        return 0;
+      }
+      queue[tail++] = dep;
+      h = rcache_hash_module(h, dep);
+    }
+  }
+  free(queue);
+
+  // can't be mistaken for "unknown"
+  return h ? h : 1;
+}
+
+static inline int rcache_provider_matches(const dso_t *mod, const rcache_provider_t *prov) {
+  // this can be a LOCAL dependency too; whether it's still searched is up to rcache_searched_modules()
+  const dso_t *p = modmap_find((const void *)(uintptr_t)prov->base);
+  return p && p != mod && (uint32_t)(uintptr_t)p->base == prov->base
+    && p->size == prov->size && p->ident && p->ident == prov->ident;
+}
+
+static char *rcache_path(const dso_t *mod) {
+  const size_t len = strlen(mod->name);
+  char *path = malloc(len + sizeof(RCACHE_EXT));
+  if (path) {
+    memcpy(path, mod->name, len);
+    memcpy(path + len, RCACHE_EXT, sizeof(RCACHE_EXT));
+  }
+  return path;
+}
+
+int rcache_load(dso_t *mod, reloc_memo_t *memo) {
+  if (!mod->ident)
+    return -1;
+
+  char *path = rcache_path(mod);
+  if (!path)
+    return -1;
+
+  FILE *f = fopen(path, "rb");
+  free(path);
+  if (!f)
+    return -1;
+
+  rcache_hdr_t hdr;
+  rcache_provider_t *providers = NULL;
+  rcache_entry_t *entries = NULL;
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1)
+    goto _miss;
+
+  if (hdr.magic != RCACHE_MAGIC || hdr.version != RCACHE_VERSION || hdr.ident != mod->ident
+      || hdr.base != (uint32_t)(uintptr_t)mod->base || hdr.num_entries > mod->num_dynsym
+      || hdr.num_providers > hdr.num_entries || hdr.fixed != rcache_fixed_providers()
+      || !hdr.searched || hdr.searched != rcache_searched_modules(mod)) {
+    DEBUG_PRINTF("`%s`: reloc cache is stale\n", mod->name);
+    goto _miss;
+  }
+
+  providers = malloc(hdr.num_providers * sizeof(*providers) + 1);
+  if (!providers || fread(providers, sizeof(*providers), hdr.num_providers, f) != hdr.num_providers)
+    goto _miss;
+
+  for (uint32_t i = 0; i < hdr.num_providers; ++i) {
+    if (!rcache_provider_matches(mod, &providers[i])) {
+      DEBUG_PRINTF("`%s`: reloc cache is stale, provider at 0x%08x changed\n", mod->name, providers[i].base);
+      goto _miss;
+    }
+  }
+
+  entries = malloc(hdr.num_entries * sizeof(*entries) + 1);
+  if (!entries || fread(entries, sizeof(*entries), hdr.num_entries, f) != hdr.num_entries)
+    goto _miss;
+
+  for (uint32_t i = 0; i < hdr.num_entries; ++i) {
+    if (entries[i].symno >= mod->num_dynsym)
+      goto _miss;
+  }
+
+  // everything checks out, so every import is now resolved
+  for (uint32_t i = 0; i < hdr.num_entries; ++i) {
+    memo[entries[i].symno].symval = entries[i].symval;
+    memo[entries[i].symno].resolved = 1;
+    memo[entries[i].symno].cached = 1;
+  }
+
+  DEBUG_PRINTF("`%s`: loaded %u imports from reloc cache\n", mod->name, hdr.num_entries);
+
+  free(entries);
+  free(providers);
+  fclose(f);
+  return 0;
+
+_miss:
+  free(entries);
+  free(providers);
+  fclose(f);
+  return -1;
+}
+
+// the modules that imports were resolved to, in no particular order; returns how many there are
+static uint32_t rcache_collect_providers(const dso_t *mod, const reloc_memo_t *memo, rcache_provider_t *out) {
+  uint32_t num = 0;
+  const dso_t *last = NULL;
+
+  for (uint32_t i = 0; i < mod->num_dynsym; ++i) {
+    // imports that weren't found are covered by rcache_searched_modules()
+    if (!memo[i].resolved || !memo[i].symval)
+      continue;
+    // everything that isn't in a module is covered by rcache_fixed_providers()
+    const dso_t *p = modmap_find((const void *)(uintptr_t)memo[i].symval);
+    if (!p || p == last)
+      continue;
+    last = p;
+    uint32_t j;
+    for (j = 0; j < num && out[j].base != (uint32_t)(uintptr_t)p->base; ++j);
+    if (j == num) {
+      out[num].ident = p->ident;
+      out[num].base = (uintptr_t)p->base;
+      out[num].size = p->size;
+      ++num;
+    }
+  }
+
+  return num;
+}
+
+void rcache_save(const dso_t *mod, const reloc_memo_t *memo) {
+  if (!mod->ident)
+    return;
+
+  rcache_hdr_t hdr = {
+    .magic = RCACHE_MAGIC,
+    .version = RCACHE_VERSION,
+    .ident = mod->ident,
+    .fixed = rcache_fixed_providers(),
+    .searched = rcache_searched_modules(mod),
+    .base = (uintptr_t)mod->base,
+  };
+
+  // can't tell whether the search order has changed
+  if (!hdr.searched)
+    return;
+
+  for (uint32_t i = 0; i < mod->num_dynsym; ++i)
+    hdr.num_entries += memo[i].resolved;
+
+  // there can't be more providers than resolved imports
+  rcache_provider_t *providers = malloc(hdr.num_entries * sizeof(*providers) + 1);
+  if (!providers)
+    return;
+
+  hdr.num_providers = rcache_collect_providers(mod, memo, providers);
+  for (uint32_t i = 0; i < hdr.num_providers; ++i) {
+    // can't tell whether a module without an ident has changed
+    if (!providers[i].ident) {
+      free(providers);
+      return;
+    }
+  }
+
+  char *path = rcache_path(mod);
+  if (!path) {
+    free(providers);
+    return;
+  }
+
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    // not an error, the module might be on a read-only device
+    DEBUG_PRINTF("`%s`: could not create reloc cache `%s`\n", mod->name, path);
+    free(providers);
+    free(path);
+    return;
+  }
+
+  int ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+  ok = ok && fwrite(providers, sizeof(*providers), hdr.num_providers, f) == hdr.num_providers;
+  for (uint32_t i = 0; ok && i < mod->num_dynsym; ++i) {
+    if (memo[i].resolved) {
+      const rcache_entry_t entry = { i, memo[i].symval };
+      ok = fwrite(&entry, sizeof(entry), 1, f) == 1;
+    }
+  }
+
+  fclose(f);
+
+  if (!ok) {
+    // don't leave a truncated cache behind
+    remove(path);
+  }
+
+  DEBUG_PRINTF("`%s`: %s reloc cache with %u imports from %u modules\n", mod->name, ok ? "wrote" : "failed to write",
+    hdr.num_entries, hdr.num_providers);
+
+  free(providers);
+  free(path);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "common.h"
+#include "reloc.h"
+
+// on-disk cache of import resolution results, see VRTLD_RELOC_CACHE
+
+int rcache_load(dso_t *mod, reloc_memo_t *memo);
+void rcache_save(const dso_t *mod, const reloc_memo_t *memo);
@@ -1,30 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <kubridge.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "common.h"
 #include "vrtld.h"
 #include "util.h"
 #include "lookup.h"
 #include "reloc.h"
+#include "rcache.h"
+#include "loader.h"
+#include "tls.h"
+
+#ifndef DT_RELR
+#define DT_RELRSZ 35
+#define DT_RELR   36
+#endif
+
+#ifndef DT_ANDROID_REL
+#define DT_ANDROID_REL   (DT_LOOS + 2)
+#define DT_ANDROID_RELSZ (DT_LOOS + 3)
+#endif
+
+// APS2 packed relocation group flags
+#define APS2_GROUPED_BY_INFO         1
+#define APS2_GROUPED_BY_OFFSET_DELTA 2
+#define APS2_GROUPED_BY_ADDEND       4
+#define APS2_GROUP_HAS_ADDEND        8
 
-static int process_relocs(dso_t *mod, const Elf32_Rel *rels, const size_t num_rels, const int imports_only, const int ignore_undef) {
+// how many unpacked APS2 relocs to collect before processing them
+#define APS2_BATCH 64
+
+static int process_relocs(dso_t *mod, reloc_memo_t *memo, const Elf32_Rel *rels, const size_t num_rels, const int imports_only, const int ignore_undef) {
   int num_failed = 0;
 
   for (size_t j = 0; j < num_rels; j++) {
-    uintptr_t *ptr = (uintptr_t *)((uintptr_t)mod->base + rels[j].r_offset);
+    Elf32_Addr *ptr = (Elf32_Addr *)((uintptr_t)mod->base + rels[j].r_offset);
     const uintptr_t symno = ELF32_R_SYM(rels[j].r_info);
     const int type = ELF32_R_TYPE(rels[j].r_info);
     uintptr_t symval = 0;
     uintptr_t symbase = (uintptr_t)mod->base;
     const char *symname = NULL;
 
+    // these refer to a module's TLS block instead of an address, so they're resolved on their own
+    if (type == R_ARM_TLS_DTPMOD32 || type == R_ARM_TLS_DTPOFF32 || type == R_ARM_TLS_TPOFF32) {
+      if (imports_only && (!symno || mod->dynsym[symno].st_shndx != SHN_UNDEF))
+        continue;
+      const int ret = tls_relocate(mod, ptr, type, symno, ignore_undef);
+      if (ret < 0) return ret;
+      num_failed += ret;
+      continue;
+    }
+
     if (symno) {
       // if the reloc refers to a symbol, get the symbol value in there
       const Elf32_Sym *sym = &mod->dynsym[symno];
       if (sym->st_shndx == SHN_UNDEF) {
         symname = mod->dynstrtab + sym->st_name;
-        symval = (uintptr_t)vrtld_lookup_global(symname);
+        if (memo && memo[symno].resolved) {
+          // already looked this one up, possibly unsuccessfully
+          symval = memo[symno].symval;
+          if (memo[symno].cached)
+            mod->stats.lookups_cached++;
+          else
+            mod->stats.lookups_saved++;
+        } else {
+          symval = (uintptr_t)vrtld_lookup_global(mod, symname);
+          if (memo) {
+            memo[symno].symval = symval;
+            memo[symno].resolved = 1;
+          }
+        }
         symbase = 0; // symbol is somewhere else
+#if UINTPTR_MAX > UINT32_MAX
+        if (symval > UINT32_MAX) {
+          // only happens on 64-bit hosts; see vrtld_symtab_from_exports()
+          vrtld_set_error("`%s`: Symbol `%s` is at %p, out of reach of a 32-bit reloc", mod->name, symname, (void *)symval);
+          return -1;
+        }
+#endif
         if (!symval) {
           const int weak = (ELF32_ST_BIND(sym->st_info) == STB_WEAK);
           if (weak || ignore_undef) {
@@ -39,6 +98,8 @@ static int process_relocs(dso_t *mod, const Elf32_Rel *rels, const size_t num_re
       } else {
         if (imports_only) continue;
         symval = sym->st_value;
+        if (sym->st_shndx == SHN_ABS)
+          symbase = 0; // absolute value, doesn't need relocating
       }
     } else if (imports_only) {
       continue;
@@ -47,16 +108,24 @@ static int process_relocs(dso_t *mod, const Elf32_Rel *rels, const size_t num_re
     switch (type) {
       case R_ARM_RELATIVE:
         *ptr += symbase;
+        mod->stats.relocs[VRTLD_RELOC_RELATIVE]++;
         break;
       case R_ARM_ABS32:
         *ptr += symbase + symval;
+        mod->stats.relocs[VRTLD_RELOC_ABS32]++;
         break;
       case R_ARM_GLOB_DAT:
+        *ptr = symbase + symval;
+        mod->stats.relocs[VRTLD_RELOC_GLOB_DAT]++;
+        break;
       case R_ARM_JUMP_SLOT:
         *ptr = symbase + symval;
+        mod->stats.relocs[VRTLD_RELOC_JUMP_SLOT]++;
         break;
       case R_ARM_NONE:
-        break; // sorry nothing
+        // sorry nothing
+        mod->stats.relocs[VRTLD_RELOC_OTHER]++;
+        break;
       default:
         vrtld_set_error("`%s`: Unknown relocation type: %d", mod->name, type);
         return -1;
@@ -66,6 +135,268 @@ static int process_relocs(dso_t *mod, const Elf32_Rel *rels, const size_t num_re
   return num_failed;
 }
 
+#ifdef __arm__
+
+// lazy binding: GOT[1] holds the module, GOT[2] holds the address of vrtld_plt_resolve(),
+// and every JUMP_SLOT initially points to PLT0, which calls GOT[2]
+
+void *vrtld_plt_fixup(dso_t *mod, uintptr_t *slot) __attribute__((used));
+
+void *vrtld_plt_fixup(dso_t *mod, uintptr_t *slot) {
+  // JMPREL entries are usually in the same order as the GOT slots following the 3 reserved ones
+  const uintptr_t r_offset = (uintptr_t)slot - (uintptr_t)mod->base;
+  uint32_t idx = slot - (mod->jmprel_got + 3);
+  if (idx >= mod->num_jmprel || mod->jmprel[idx].r_offset != r_offset) {
+    for (idx = 0; idx < mod->num_jmprel; ++idx) {
+      if (mod->jmprel[idx].r_offset == r_offset)
+        break;
+    }
+  }
+
+  if (idx >= mod->num_jmprel) {
+    // the GOT or the PLT is corrupt, there's nothing sensible to call
+    vrtld_set_error("`%s`: No JMPREL entry for GOT slot %p", mod->name, (void *)slot);
+    __builtin_trap();
+  }
+
+  const Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(mod->jmprel[idx].r_info)];
+  const char *symname = mod->dynstrtab + sym->st_name;
+  void *symval = NULL;
+  if (sym->st_shndx == SHN_UNDEF) {
+    // another thread might be linking something into the global symbol table right now
+    vrtld_lookup_lock();
+    symval = vrtld_lookup_global(mod, symname);
+    vrtld_lookup_unlock();
+  } else
+    symval = vrtld_sym_addr(mod, sym);
+
+  if (!symval) {
+    // the caller can't be told, so this is as far as it goes; the error is logged in debug builds
+    vrtld_set_error("`%s`: Could not lazily resolve symbol `%s`", mod->name, symname);
+    abort();
+  }
+
+  DEBUG_PRINTF("`%s`: lazily bound `%s` to %p\n", mod->name, symname, symval);
+  __atomic_fetch_add(&mod->stats.relocs[VRTLD_RELOC_JUMP_SLOT], 1, __ATOMIC_RELAXED);
+
+  *slot = (uintptr_t)symval;
+  return symval;
+}
+
+// entered from PLT0 with the caller's lr on the stack, lr = &GOT[2] and ip = &GOT[n];
+// saves the argument registers, binds the slot and tail-calls the target
+__attribute__((naked)) void vrtld_plt_resolve(void) {
+  __asm__ volatile (
+    "push {r0-r4}\n"         // r4 is only there to keep sp 8-byte aligned
+    "vpush {d0-d7}\n"        // VFP arguments
+    "ldr r0, [lr, #-4]\n"    // GOT[1]
+    "mov r1, ip\n"
+    "bl vrtld_plt_fixup\n"
+    "mov ip, r0\n"
+    "vpop {d0-d7}\n"
+    "pop {r0-r4, lr}\n"      // also restores the lr that PLT0 saved
+    "bx ip\n"
+  );
+}
+
+static int process_lazy_relocs(dso_t *mod, reloc_memo_t *memo, Elf32_Rel *rels, const size_t num_rels, uintptr_t *got, const int ignore_undef) {
+  got[1] = (uintptr_t)mod;
+  got[2] = (uintptr_t)&vrtld_plt_resolve;
+
+  mod->jmprel = rels;
+  mod->num_jmprel = num_rels;
+  mod->jmprel_got = got;
+
+  int num_failed = 0;
+  for (size_t j = 0; j < num_rels; j++) {
+    if (ELF32_R_TYPE(rels[j].r_info) == R_ARM_JUMP_SLOT) {
+      // slot points to PLT0 for now, just relocate that
+      uintptr_t *ptr = (uintptr_t *)((uintptr_t)mod->base + rels[j].r_offset);
+      *ptr += (uintptr_t)mod->base;
+      mod->stats.relocs[VRTLD_RELOC_LAZY]++;
+    } else {
+      // not something we can defer
+      const int ret = process_relocs(mod, memo, &rels[j], 1, 0, ignore_undef);
+      if (ret < 0) return ret;
+      num_failed += ret;
+    }
+  }
+
+  return num_failed;
+}
+
+#else
+
+static int process_lazy_relocs(dso_t *mod, reloc_memo_t *memo, Elf32_Rel *rels, const size_t num_rels, uintptr_t *got, const int ignore_undef) {
+  // no resolver trampoline on this arch, bind everything now
+  (void)got;
+  return process_relocs(mod, memo, rels, num_rels, 0, ignore_undef);
+}
+
+#endif
+
+static void process_relative_relocs(dso_t *mod, const Elf32_Rel *rels, const size_t num_rels) {
+  const Elf32_Addr base = (uintptr_t)mod->base;
+  uint8_t *image = mod->base;
+  size_t j = 0;
+
+  mod->stats.relocs[VRTLD_RELOC_RELATIVE] += num_rels;
+
+  // these are R_ARM_RELATIVE by definition, so there's no need to check anything;
+  // runs of 4 consecutive words (vtables, function pointer arrays) are done in one go
+#if defined(__ARM_NEON)
+  const uint32x4_t vbase = vdupq_n_u32(base);
+  while (j + 4 <= num_rels) {
+    const Elf32_Addr ofs = rels[j].r_offset;
+    if (rels[j + 1].r_offset == ofs + 4 && rels[j + 2].r_offset == ofs + 8 && rels[j + 3].r_offset == ofs + 12) {
+      uint32_t *ptr = (uint32_t *)(image + ofs);
+      vst1q_u32(ptr, vaddq_u32(vld1q_u32(ptr), vbase));
+      j += 4;
+    } else {
+      *(Elf32_Addr *)(image + ofs) += base;
+      j += 1;
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128i vbase = _mm_set1_epi32(base);
+  while (j + 4 <= num_rels) {
+    const Elf32_Addr ofs = rels[j].r_offset;
+    if (rels[j + 1].r_offset == ofs + 4 && rels[j + 2].r_offset == ofs + 8 && rels[j + 3].r_offset == ofs + 12) {
+      __m128i *ptr = (__m128i *)(image + ofs);
+      _mm_storeu_si128(ptr, _mm_add_epi32(_mm_loadu_si128(ptr), vbase));
+      j += 4;
+    } else {
+      *(Elf32_Addr *)(image + ofs) += base;
+      j += 1;
+    }
+  }
+#endif
+
+  for (; j + 4 <= num_rels; j += 4) {
+    Elf32_Addr *p0 = (Elf32_Addr *)(image + rels[j + 0].r_offset);
+    Elf32_Addr *p1 = (Elf32_Addr *)(image + rels[j + 1].r_offset);
+    Elf32_Addr *p2 = (Elf32_Addr *)(image + rels[j + 2].r_offset);
+    Elf32_Addr *p3 = (Elf32_Addr *)(image + rels[j + 3].r_offset);
+    *p0 += base;
+    *p1 += base;
+    *p2 += base;
+    *p3 += base;
+  }
+
+  for (; j < num_rels; ++j)
+    *(Elf32_Addr *)(image + rels[j].r_offset) += base;
+}
+
+static void process_relr(dso_t *mod, const Elf32_Word *relr, const size_t num_relr) {
+  const uintptr_t base = (uintptr_t)mod->base;
+  Elf32_Addr *where = NULL;
+  uint32_t count = 0;
+
+  // an even entry is an address to relocate, an odd entry is a bitmap of the 31 words after the last one
+  for (size_t j = 0; j < num_relr; ++j) {
+    const Elf32_Word entry = relr[j];
+    if ((entry & 1) == 0) {
+      where = (Elf32_Addr *)(base + entry);
+      *where++ += base;
+      ++count;
+    } else if (where) {
+      Elf32_Addr *ptr = where;
+      for (Elf32_Word bits = entry >> 1; bits; bits >>= 1, ++ptr) {
+        if (bits & 1) {
+          *ptr += base;
+          ++count;
+        }
+      }
+      where += 31;
+    }
+  }
+
+  mod->stats.relocs[VRTLD_RELOC_RELATIVE] += count;
+}
+
+static inline int aps2_sleb128(const uint8_t **pp, const uint8_t *end, int32_t *out) {
+  const uint8_t *p = *pp;
+  uint32_t val = 0;
+  uint32_t shift = 0;
+  uint8_t byte;
+  do {
+    if (p >= end)
+      return -1;
+    byte = *p++;
+    if (shift < 32)
+      val |= (uint32_t)(byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  if (shift < 32 && (byte & 0x40))
+    val |= ~0u << shift;
+  *pp = p;
+  *out = (int32_t)val;
+  return 0;
+}
+
+static int process_aps2_relocs(dso_t *mod, reloc_memo_t *memo, const uint8_t *data, const size_t size, const int imports_only, const int ignore_undef) {
+  const uint8_t *p = data + 4;
+  const uint8_t *end = data + size;
+  Elf32_Rel batch[APS2_BATCH];
+  size_t num_batch = 0;
+  int num_failed = 0;
+  int32_t num_left, offset, info = 0;
+
+  if (size < 4 || memcmp(data, "APS2", 4) != 0) {
+    vrtld_set_error("`%s`: Invalid packed relocation table", mod->name);
+    return -1;
+  }
+
+  if (aps2_sleb128(&p, end, &num_left) || aps2_sleb128(&p, end, &offset))
+    goto _truncated;
+
+  while (num_left > 0) {
+    int32_t group_size, group_flags, group_offset_delta = 0, val;
+    if (aps2_sleb128(&p, end, &group_size) || aps2_sleb128(&p, end, &group_flags) || group_size <= 0)
+      goto _truncated;
+    if (group_flags & APS2_GROUP_HAS_ADDEND) {
+      vrtld_set_error("`%s`: Packed relocations with addends are not supported", mod->name);
+      return -1;
+    }
+    if ((group_flags & APS2_GROUPED_BY_OFFSET_DELTA) && aps2_sleb128(&p, end, &group_offset_delta))
+      goto _truncated;
+    if ((group_flags & APS2_GROUPED_BY_INFO) && aps2_sleb128(&p, end, &info))
+      goto _truncated;
+
+    for (int32_t i = 0; i < group_size && num_left > 0; ++i, --num_left) {
+      if (group_flags & APS2_GROUPED_BY_OFFSET_DELTA) {
+        offset += group_offset_delta;
+      } else {
+        if (aps2_sleb128(&p, end, &val)) goto _truncated;
+        offset += val;
+      }
+      if (!(group_flags & APS2_GROUPED_BY_INFO)) {
+        if (aps2_sleb128(&p, end, &info)) goto _truncated;
+      }
+      batch[num_batch].r_offset = offset;
+      batch[num_batch].r_info = info;
+      if (++num_batch == APS2_BATCH) {
+        const int ret = process_relocs(mod, memo, batch, num_batch, imports_only, ignore_undef);
+        if (ret < 0) return ret;
+        num_failed += ret;
+        num_batch = 0;
+      }
+    }
+  }
+
+  if (num_batch) {
+    const int ret = process_relocs(mod, memo, batch, num_batch, imports_only, ignore_undef);
+    if (ret < 0) return ret;
+    num_failed += ret;
+  }
+
+  return num_failed;
+
+_truncated:
+  vrtld_set_error("`%s`: Truncated packed relocation table", mod->name);
+  return -1;
+}
+
 static int process_target2_relocs(dso_t *mod, const Elf32_Rel *rels, const size_t num_rels) {
   uint32_t target2_type = R_ARM_REL32; // vita native
   if (vrtld_init_flags() & VRTLD_TARGET2_IS_ABS)
@@ -81,17 +412,17 @@ static int process_target2_relocs(dso_t *mod, const Elf32_Rel *rels, const size_
       continue;
 
     // on the Vita TARGET2 relocs are treated as REL32, so we need to turn these into REL32
-    intptr_t *ptr = (intptr_t *)((uintptr_t)mod->base + rels[j].r_offset);
+    int32_t *ptr = (int32_t *)((uintptr_t)mod->base + rels[j].r_offset);
     uint8_t *target = NULL;
     switch (target2_type) {
       case R_ARM_ABS32:
         // ptr points to an absolute address, turn it into a relative
-        target = *(uint8_t **)ptr;
+        target = (uint8_t *)(uintptr_t)*(Elf32_Addr *)ptr;
         break;
       case R_ARM_GOT_PREL:
         // ptr points to an offset to a GOT slot, which has already been filled in by process_relocs()
         if (*ptr) {
-          target = *(uint8_t **)((uint8_t *)ptr + *ptr);
+          target = (uint8_t *)(uintptr_t)*(Elf32_Addr *)((uint8_t *)ptr + *ptr);
         }
         break;
       default:
@@ -99,9 +430,10 @@ static int process_target2_relocs(dso_t *mod, const Elf32_Rel *rels, const size_
     }
 
     if (target) {
-      const intptr_t result = target - (uint8_t *)ptr;
+      const int32_t result = target - (uint8_t *)ptr;
       // these usually point to rodata, so we need to resort to this to bypass memory protection
-      kuKernelCpuUnrestrictedMemcpy(ptr, &result, sizeof(result));
+      plat_write_protected(ptr, &result, sizeof(result));
+      mod->stats.relocs[VRTLD_RELOC_TARGET2]++;
     }
   }
 
@@ -111,11 +443,18 @@ static int process_target2_relocs(dso_t *mod, const Elf32_Rel *rels, const size_
 int vrtld_relocate(dso_t *mod, const int ignore_undef, const int imports_only) {
   Elf32_Rel *rel = NULL;
   Elf32_Rel *jmprel = NULL;
+  Elf32_Word *relr = NULL;
+  uint8_t *aps2 = NULL;
+  uintptr_t *pltgot = NULL;
+  int bind_now = !(mod->flags & VRTLD_LAZY);
   uint32_t pltrel = 0;
   size_t relsz = 0;
+  size_t relcount = 0;
+  size_t relrsz = 0;
+  size_t aps2sz = 0;
   size_t pltrelsz = 0;
 
-  // find REL and JMPREL
+  // find REL, RELR, packed REL and JMPREL
   for (Elf32_Dyn *dyn = mod->dynamic; dyn->d_tag != DT_NULL; dyn++) {
     switch (dyn->d_tag) {
       case DT_REL:
@@ -124,6 +463,21 @@ int vrtld_relocate(dso_t *mod, const int ignore_undef, const int imports_only) {
       case DT_RELSZ:
         relsz = dyn->d_un.d_val;
         break;
+      case DT_RELCOUNT:
+        relcount = dyn->d_un.d_val;
+        break;
+      case DT_RELR:
+        relr = (Elf32_Word *)(mod->base + dyn->d_un.d_ptr);
+        break;
+      case DT_RELRSZ:
+        relrsz = dyn->d_un.d_val;
+        break;
+      case DT_ANDROID_REL:
+        aps2 = (uint8_t *)(mod->base + dyn->d_un.d_ptr);
+        break;
+      case DT_ANDROID_RELSZ:
+        aps2sz = dyn->d_un.d_val;
+        break;
       case DT_JMPREL:
         // TODO: don't assume REL
         jmprel = (Elf32_Rel *)(mod->base + dyn->d_un.d_ptr);
@@ -134,25 +488,72 @@ int vrtld_relocate(dso_t *mod, const int ignore_undef, const int imports_only) {
       case DT_PLTRELSZ:
         pltrelsz = dyn->d_un.d_val;
         break;
+      case DT_PLTGOT:
+        pltgot = (uintptr_t *)(mod->base + dyn->d_un.d_ptr);
+        break;
+      case DT_BIND_NOW:
+        bind_now = 1;
+        break;
+      case DT_FLAGS:
+        if (dyn->d_un.d_val & DF_BIND_NOW)
+          bind_now = 1;
+        break;
       default:
         break;
     }
   }
 
+  // each import only needs to be looked up once, no matter how many relocs refer to it;
+  // if there's no memory for this, just look everything up every time
+  reloc_memo_t *memo = calloc(mod->num_dynsym, sizeof(*memo));
+
+  // if the results are cached on disk, the memo is going to be prefilled with them
+  const int use_cache = memo && !imports_only && (vrtld_init_flags() & VRTLD_RELOC_CACHE);
+  const int cache_hit = use_cache && rcache_load(mod, memo) == 0;
+
+  if (relr && relrsz && !imports_only) {
+    DEBUG_PRINTF("`%s`: processing RELR@%p size %u\n", mod->name, relr, (unsigned)relrsz);
+    process_relr(mod, relr, relrsz / sizeof(Elf32_Word));
+  }
+
+  if (aps2 && aps2sz) {
+    DEBUG_PRINTF("`%s`: processing packed REL@%p size %u\n", mod->name, aps2, (unsigned)aps2sz);
+    // if there are any unresolved imports, bail unless it's the final relocation pass
+    if (process_aps2_relocs(mod, memo, aps2, aps2sz, imports_only, ignore_undef))
+      goto err_free_memo;
+  }
+
   if (rel && relsz) {
-    DEBUG_PRINTF("`%s`: processing REL@%p size %u\n", mod->name, rel, relsz);
+    size_t num_rel = relsz / sizeof(Elf32_Rel);
+    if (relcount > num_rel)
+      relcount = num_rel;
+    // the linker puts all RELATIVE relocs first and counts them in DT_RELCOUNT;
+    // those don't refer to any symbols, so they can be done separately in one go
+    if (relcount) {
+      if (!imports_only) {
+        DEBUG_PRINTF("`%s`: processing %u RELATIVE relocs@%p\n", mod->name, (unsigned)relcount, rel);
+        process_relative_relocs(mod, rel, relcount);
+      }
+      rel += relcount;
+      num_rel -= relcount;
+    }
+    DEBUG_PRINTF("`%s`: processing REL@%p count %u\n", mod->name, rel, (unsigned)num_rel);
     // if there are any unresolved imports, bail unless it's the final relocation pass
-    if (process_relocs(mod, rel, relsz / sizeof(Elf32_Rel), imports_only, ignore_undef))
-      return -1;
+    if (process_relocs(mod, memo, rel, num_rel, imports_only, ignore_undef))
+      goto err_free_memo;
   }
 
   if (jmprel && pltrelsz && pltrel) {
     // TODO: support DT_RELA?
-    if (pltrel == DT_REL) {
-      DEBUG_PRINTF("`%s`: processing JMPREL@%p size %u\n", mod->name, jmprel, pltrelsz);
+    if (pltrel == DT_REL && !bind_now && pltgot && !imports_only) {
+      DEBUG_PRINTF("`%s`: deferring JMPREL@%p size %u\n", mod->name, jmprel, (unsigned)pltrelsz);
+      if (process_lazy_relocs(mod, memo, jmprel, pltrelsz / sizeof(Elf32_Rel), pltgot, ignore_undef))
+        goto err_free_memo;
+    } else if (pltrel == DT_REL) {
+      DEBUG_PRINTF("`%s`: processing JMPREL@%p size %u\n", mod->name, jmprel, (unsigned)pltrelsz);
       // if there are any unresolved imports, bail unless it's the final relocation pass
-      if (process_relocs(mod, jmprel, pltrelsz / sizeof(Elf32_Rel), imports_only, ignore_undef))
-        return -1;
+      if (process_relocs(mod, memo, jmprel, pltrelsz / sizeof(Elf32_Rel), imports_only, ignore_undef))
+        goto err_free_memo;
     } else {
       DEBUG_PRINTF("`%s`: DT_JMPREL has unsupported type %08x\n", mod->name, pltrel);
     }
@@ -168,7 +569,19 @@ int vrtld_relocate(dso_t *mod, const int ignore_undef, const int imports_only) {
     mod->num_extab_rel = 0;
   }
 
+  DEBUG_PRINTF("`%s`: %u symbol lookups saved by memoization, %u by the reloc cache\n", mod->name,
+    mod->stats.lookups_saved, mod->stats.lookups_cached);
+
+  if (use_cache && !cache_hit)
+    rcache_save(mod, memo);
+
+  free(memo);
+
   mod->flags |= MOD_RELOCATED;
 
   return 0;
+
+err_free_memo:
+  free(memo);
+  return -1;
 }
@@ -2,4 +2,11 @@
 
 #include "common.h"
 
+// results of global lookups for the undefined symbols of the module being relocated, indexed by symno
+typedef struct reloc_memo {
+  uintptr_t symval;
+  uint32_t resolved;
+  uint32_t cached;   // came from the reloc cache rather than a lookup
+} reloc_memo_t;
+
 int vrtld_relocate(dso_t *mod, const int ignore_undef, const int imports_only);
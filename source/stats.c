@@ -0,0 +1,118 @@
+#include <string.h>
+
+#include "common.h"
+#include "vrtld.h"
+#include "util.h"
+#include "loader.h"
+#include "gsym.h"
+#include "vma.h"
+#include "stats.h"
+
+// counters of modules that have been unloaded
+static vrtld_module_stats_t stats_retired;
+
+static void stats_accumulate(vrtld_module_stats_t *dst, const vrtld_module_stats_t *src) {
+  for (int i = 0; i < VRTLD_NUM_PHASES; ++i)
+    dst->time_us[i] += src->time_us[i];
+  for (int i = 0; i < VRTLD_NUM_RELOC_TYPES; ++i)
+    dst->relocs[i] += src->relocs[i];
+  for (int i = 0; i < VRTLD_NUM_SOURCES; ++i)
+    dst->lookup_hits[i] += src->lookup_hits[i];
+  dst->lookup_misses += src->lookup_misses;
+  dst->lookups_saved += src->lookups_saved;
+  dst->lookups_cached += src->lookups_cached;
+}
+
+static inline void stats_count_chain(uint32_t *hist, const uint32_t len) {
+  hist[(len < VRTLD_STATS_CHAIN_HIST) ? len : VRTLD_STATS_CHAIN_HIST - 1]++;
+}
+
+void stats_retire(const dso_t *mod) {
+  stats_accumulate(&stats_retired, &mod->stats);
+}
+
+void stats_reset(void) {
+  memset(&stats_retired, 0, sizeof(stats_retired));
+}
+
+void stats_chain_hist(const dso_t *mod, uint32_t *hist) {
+  memset(hist, 0, sizeof(*hist) * VRTLD_STATS_CHAIN_HIST);
+
+  if (mod->gnuhashtab) {
+    const uint32_t nbucket = mod->gnuhashtab[0];
+    const uint32_t symoffset = mod->gnuhashtab[1];
+    const uint32_t bloom_size = mod->gnuhashtab[2];
+    const uint32_t *buckets = &mod->gnuhashtab[4 + bloom_size];
+    const uint32_t *chain = &buckets[nbucket];
+    for (uint32_t b = 0; b < nbucket; ++b) {
+      uint32_t len = 0;
+      if (buckets[b] >= symoffset) {
+        // the lowest bit marks the end of a chain
+        for (uint32_t i = buckets[b]; ; ++i) {
+          ++len;
+          if (chain[i - symoffset] & 1)
+            break;
+        }
+      }
+      stats_count_chain(hist, len);
+    }
+  } else if (mod->hashtab) {
+    const uint32_t nbucket = mod->hashtab[0];
+    const uint32_t nchain = mod->hashtab[1];
+    const uint32_t *buckets = &mod->hashtab[2];
+    const uint32_t *chain = &buckets[nbucket];
+    for (uint32_t b = 0; b < nbucket; ++b) {
+      uint32_t len = 0;
+      for (uint32_t i = buckets[b]; i && i < nchain && len < nchain; i = chain[i])
+        ++len;
+      stats_count_chain(hist, len);
+    }
+  }
+}
+
+void vrtld_get_stats(vrtld_stats_t *out) {
+  if (!out) {
+    vrtld_set_error("vrtld_get_stats(): NULL arg");
+    return;
+  }
+
+  memset(out, 0, sizeof(*out));
+
+  vrtld_loader_lock();
+
+  out->total = stats_retired;
+  for (const dso_t *mod = &vrtld_dsolist; mod; mod = mod->next) {
+    stats_accumulate(&out->total, &mod->stats);
+    if (mod != &vrtld_dsolist)
+      out->num_modules++;
+  }
+
+  gsym_chain_hist(out->total.chain_hist, VRTLD_STATS_CHAIN_HIST);
+
+  vma_stats_t vma;
+  vma_get_stats(&vma);
+  out->vma_total = vma.total;
+  out->vma_used = vma.used;
+  out->vma_largest_free = vma.largest_free;
+  out->vma_free_blocks = vma.num_free;
+
+  vrtld_loader_unlock();
+
+  vrtld_get_exidx_cache_stats(&out->exidx_cache_hits, &out->exidx_cache_misses);
+}
+
+int vrtld_get_module_stats(void *handle, vrtld_module_stats_t *out) {
+  if (!handle || !out) {
+    vrtld_set_error("vrtld_get_module_stats(): NULL args");
+    return -1;
+  }
+
+  const dso_t *mod = handle;
+
+  vrtld_loader_lock();
+  *out = mod->stats;
+  stats_chain_hist(mod, out->chain_hist);
+  vrtld_loader_unlock();
+
+  return 0;
+}
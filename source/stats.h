@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "common.h"
+
+// loader statistics; module counters are only touched by whoever is loading the module,
+// and the totals are only summed up when someone asks for them
+
+static inline uint64_t stats_now(void) {
+  return plat_time_us();
+}
+
+static inline void stats_add_time(dso_t *mod, const int phase, const uint64_t start) {
+  mod->stats.time_us[phase] += stats_now() - start;
+}
+
+// adds the counters of a module that's going away to the totals
+void stats_retire(const dso_t *mod);
+void stats_reset(void);
+
+void stats_chain_hist(const dso_t *mod, uint32_t *hist);
@@ -0,0 +1,379 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "vrtld.h"
+#include "util.h"
+#include "lookup.h"
+#include "tls.h"
+
+// argument of __tls_get_addr(), filled in by DTPMOD32 and DTPOFF32
+typedef struct tls_index {
+  Elf32_Word module;
+  Elf32_Word offset;
+} tls_index_t;
+
+typedef struct tls_slot {
+  const dso_t *mod;
+  uint32_t gen; // bumped every time the id is taken or given back
+} tls_slot_t;
+
+typedef struct tls_dtv {
+  void *block;  // the module's block for this thread
+  void *alloc;  // what has to be freed for it, unless it's in the static area
+  uint32_t gen; // generation of the module id the block belongs to
+} tls_dtv_t;
+
+// per-thread state, followed by the static area that the thread pointer points into
+typedef struct tls_thread {
+  void *tp;
+  uint32_t epoch;
+  tls_dtv_t dtv[TLS_MAX_MODULES];
+} tls_thread_t;
+
+// guards everything below; only taken when a thread sets up or touches a module's block the first time
+static pthread_mutex_t tls_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static tls_slot_t tls_slots[TLS_MAX_MODULES];
+
+// layout of the static area; it can only grow until the first thread gets its copy of it
+static uint32_t tls_static_size = TLS_TCB_SIZE;
+static uint32_t tls_static_align = TLS_TCB_SIZE;
+static int tls_static_frozen = 0;
+
+// bumped by tls_quit() so that threads throw away their blocks
+static uint32_t tls_epoch = 1;
+
+static pthread_key_t tls_key;
+static pthread_once_t tls_key_once = PTHREAD_ONCE_INIT;
+static int tls_key_ok = 0;
+
+static void tls_thread_free(void *arg) {
+  tls_thread_t *t = arg;
+  for (uint32_t i = 0; i < TLS_MAX_MODULES; ++i)
+    free(t->dtv[i].alloc);
+  free(t);
+}
+
+static void tls_key_init(void) {
+  __atomic_store_n(&tls_key_ok, pthread_key_create(&tls_key, tls_thread_free) == 0, __ATOMIC_RELEASE);
+}
+
+// returns NULL if the thread can't get a TLS area, in which case it keeps the one it had
+static tls_thread_t *tls_thread_setup(tls_thread_t *old) {
+  pthread_once(&tls_key_once, tls_key_init);
+  if (!tls_key_ok) {
+    vrtld_set_error("Could not create TLS key");
+    return NULL;
+  }
+
+  pthread_mutex_lock(&tls_lock);
+
+  // the static area can't change anymore now that a thread has a copy of it
+  tls_static_frozen = 1;
+
+  const uint32_t align = tls_static_align;
+  tls_thread_t *t = calloc(1, sizeof(*t) + align + tls_static_size);
+  if (!t) {
+    pthread_mutex_unlock(&tls_lock);
+    vrtld_set_error("Could not allocate %u bytes of static TLS", tls_static_size);
+    return NULL;
+  }
+
+  uint8_t *tp = (uint8_t *)ALIGN_UP((uintptr_t)(t + 1), (uintptr_t)align);
+  t->tp = tp;
+  t->epoch = tls_epoch;
+  // this is where the DTV pointer would go; nothing outside of here is supposed to look at it
+  *(void **)tp = t;
+
+  // the rest is already zeroed
+  for (uint32_t i = 0; i < TLS_MAX_MODULES; ++i) {
+    const dso_t *mod = tls_slots[i].mod;
+    if (mod && mod->tls_offset) {
+      memcpy(tp + mod->tls_offset, mod->tls_image, mod->tls_filesz);
+      t->dtv[i].block = tp + mod->tls_offset;
+      t->dtv[i].gen = tls_slots[i].gen;
+    }
+  }
+
+  pthread_mutex_unlock(&tls_lock);
+
+  if (pthread_setspecific(tls_key, t)) {
+    free(t);
+    vrtld_set_error("Could not set up TLS for thread %u", (unsigned)plat_thread_id());
+    return NULL;
+  }
+
+  // left over from before vrtld_quit()
+  if (old)
+    tls_thread_free(old);
+
+  return t;
+}
+
+static inline tls_thread_t *tls_thread(void) {
+  tls_thread_t *t = __atomic_load_n(&tls_key_ok, __ATOMIC_ACQUIRE) ? pthread_getspecific(tls_key) : NULL;
+  if (t && t->epoch == __atomic_load_n(&tls_epoch, __ATOMIC_RELAXED))
+    return t;
+  return tls_thread_setup(t);
+}
+
+// returns NULL if the module is gone or its block couldn't be allocated, in which case the old one is kept
+static void *tls_block_alloc(tls_thread_t *t, const uint32_t modid) {
+  tls_dtv_t *d = &t->dtv[modid - 1];
+  void *block = NULL;
+  void *alloc = NULL;
+
+  pthread_mutex_lock(&tls_lock);
+
+  const dso_t *mod = tls_slots[modid - 1].mod;
+  if (!mod) {
+    pthread_mutex_unlock(&tls_lock);
+    vrtld_set_error("TLS access to module id %u, which is not loaded", modid);
+    return NULL;
+  }
+
+  if (mod->tls_offset) {
+    block = (uint8_t *)t->tp + mod->tls_offset;
+  } else {
+    const uint32_t align = mod->tls_align ? mod->tls_align : 1;
+    alloc = malloc(mod->tls_memsz + align);
+    if (!alloc) {
+      pthread_mutex_unlock(&tls_lock);
+      vrtld_set_error("`%s`: Could not allocate %u bytes of TLS", mod->name, mod->tls_memsz);
+      return NULL;
+    }
+    block = (void *)ALIGN_UP((uintptr_t)alloc, (uintptr_t)align);
+    memcpy(block, mod->tls_image, mod->tls_filesz);
+    memset((uint8_t *)block + mod->tls_filesz, 0, mod->tls_memsz - mod->tls_filesz);
+  }
+
+  const uint32_t gen = tls_slots[modid - 1].gen;
+
+  pthread_mutex_unlock(&tls_lock);
+
+  // whatever was there belonged to a module that has been unloaded since
+  free(d->alloc);
+  d->alloc = alloc;
+  d->block = block;
+  d->gen = gen;
+
+  return block;
+}
+
+static inline void *tls_block(tls_thread_t *t, const uint32_t modid) {
+  if (modid - 1 >= TLS_MAX_MODULES) {
+    vrtld_set_error("TLS access to invalid module id %u", modid);
+    return NULL;
+  }
+  const tls_dtv_t *d = &t->dtv[modid - 1];
+  if (d->block && d->gen == __atomic_load_n(&tls_slots[modid - 1].gen, __ATOMIC_RELAXED))
+    return d->block;
+  return tls_block_alloc(t, modid);
+}
+
+// the module code that calls the helpers below can't be told that something went wrong
+static void tls_fatal(void) {
+  fprintf(stderr, "vrtld: %s\n", vrtld_dlerror());
+  abort();
+}
+
+void *vrtld_tls_read_tp(void) __attribute__((used));
+
+void *vrtld_tls_read_tp(void) {
+  tls_thread_t *t = tls_thread();
+  if (!t)
+    tls_fatal();
+  return t->tp;
+}
+
+#ifdef __arm__
+
+// unlike normal functions, __aeabi_read_tp() may only clobber r0, ip, lr and the flags
+__attribute__((naked)) void vrtld_aeabi_read_tp(void) {
+  __asm__ volatile (
+    "push {r1-r3, lr}\n"
+    "vpush {d0-d7}\n"
+    "vpush {d16-d31}\n"
+    "bl vrtld_tls_read_tp\n"
+    "vpop {d16-d31}\n"
+    "vpop {d0-d7}\n"
+    "pop {r1-r3, pc}\n"
+  );
+}
+
+#endif
+
+static void *tls_get_addr_builtin(const tls_index_t *ti) {
+  tls_thread_t *t = tls_thread();
+  uint8_t *block = t ? tls_block(t, ti->module) : NULL;
+  if (!block)
+    tls_fatal();
+  return block + ti->offset;
+}
+
+void *tls_get_addr(const dso_t *mod, const uint32_t offset) {
+  if (!mod->tls_modid)
+    return NULL;
+  tls_thread_t *t = tls_thread();
+  uint8_t *block = t ? tls_block(t, mod->tls_modid) : NULL;
+  return block ? block + offset : NULL;
+}
+
+static const vrtld_export_t tls_builtins[] = {
+  { "__tls_get_addr", (void *)&tls_get_addr_builtin },
+#ifdef __arm__
+  { "__aeabi_read_tp", (void *)&vrtld_aeabi_read_tp },
+#endif
+};
+
+void *tls_builtin_lookup(const char *symname) {
+  for (size_t i = 0; i < sizeof(tls_builtins) / sizeof(*tls_builtins); ++i) {
+    if (!strcmp(symname, tls_builtins[i].name))
+      return tls_builtins[i].addr_rx;
+  }
+  return NULL;
+}
+
+int tls_register(dso_t *mod) {
+  const uint32_t align = mod->tls_align ? mod->tls_align : 1;
+  if (align & (align - 1)) {
+    vrtld_set_error("`%s`: invalid TLS alignment %u", mod->name, align);
+    return -1;
+  }
+
+  pthread_mutex_lock(&tls_lock);
+
+  uint32_t i = 0;
+  while (i < TLS_MAX_MODULES && tls_slots[i].mod)
+    ++i;
+
+  if (i == TLS_MAX_MODULES) {
+    pthread_mutex_unlock(&tls_lock);
+    vrtld_set_error("`%s`: too many modules with TLS loaded (max %u)", mod->name, TLS_MAX_MODULES);
+    return -1;
+  }
+
+  // static blocks are never given back, since every thread has a copy of the area
+  if (!tls_static_frozen) {
+    mod->tls_offset = ALIGN_UP(tls_static_size, align);
+    tls_static_size = mod->tls_offset + mod->tls_memsz;
+    if (align > tls_static_align)
+      tls_static_align = align;
+  }
+
+  tls_slots[i].mod = mod;
+  __atomic_store_n(&tls_slots[i].gen, tls_slots[i].gen + 1, __ATOMIC_RELAXED);
+  mod->tls_modid = i + 1;
+
+  pthread_mutex_unlock(&tls_lock);
+
+  DEBUG_PRINTF("`%s`: TLS module id %u, static block offset 0x%x\n", mod->name, mod->tls_modid, mod->tls_offset);
+
+  return 0;
+}
+
+void tls_unregister(dso_t *mod) {
+  if (!mod->tls_modid)
+    return;
+
+  pthread_mutex_lock(&tls_lock);
+  tls_slot_t *slot = &tls_slots[mod->tls_modid - 1];
+  slot->mod = NULL;
+  __atomic_store_n(&slot->gen, slot->gen + 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&tls_lock);
+
+  mod->tls_modid = 0;
+}
+
+void tls_quit(void) {
+  pthread_mutex_lock(&tls_lock);
+  for (uint32_t i = 0; i < TLS_MAX_MODULES; ++i) {
+    tls_slots[i].mod = NULL;
+    __atomic_store_n(&tls_slots[i].gen, tls_slots[i].gen + 1, __ATOMIC_RELAXED);
+  }
+  tls_static_size = TLS_TCB_SIZE;
+  tls_static_align = TLS_TCB_SIZE;
+  tls_static_frozen = 0;
+  __atomic_store_n(&tls_epoch, tls_epoch + 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&tls_lock);
+}
+
+static inline int tls_defined_in(const dso_t *mod, const char *symname, const Elf32_Sym **out_sym) {
+  if (!mod->tls_modid)
+    return 0;
+  const Elf32_Sym *sym = vrtld_lookup_sym(mod, symname);
+  if (!sym || sym->st_shndx == SHN_UNDEF || ELF32_ST_TYPE(sym->st_info) != STT_TLS)
+    return 0;
+  *out_sym = sym;
+  return 1;
+}
+
+// TLS symbols don't have addresses, so they're not in the global symbol table
+static const dso_t *tls_find_def(const dso_t *mod, const char *symname, const Elf32_Sym **out_sym) {
+  // look in what it depends on first, then in everything that's GLOBAL
+  for (uint32_t i = 0; i < mod->num_deps; ++i) {
+    if (tls_defined_in(mod->deps[i], symname, out_sym))
+      return mod->deps[i];
+  }
+  for (const dso_t *p = vrtld_dsolist.next; p; p = p->next) {
+    if ((p->flags & VRTLD_GLOBAL) && tls_defined_in(p, symname, out_sym))
+      return p;
+  }
+  return NULL;
+}
+
+int tls_relocate(dso_t *mod, Elf32_Addr *ptr, const int type, const uint32_t symno, const int ignore_undef) {
+  // no symbol means the module's own block
+  const dso_t *def = mod;
+  Elf32_Addr value = 0;
+
+  if (symno) {
+    const Elf32_Sym *sym = &mod->dynsym[symno];
+    if (sym->st_shndx == SHN_UNDEF) {
+      const char *symname = mod->dynstrtab + sym->st_name;
+      const int weak = (ELF32_ST_BIND(sym->st_info) == STB_WEAK);
+      def = tls_find_def(mod, symname, &sym);
+      if (!def) {
+        if (weak || ignore_undef) {
+          DEBUG_PRINTF("`%s`: ignoring resolution failure for TLS symbol `%s`%s\n", mod->name, symname, weak ? " (weak)" : "");
+          return 0;
+        }
+        vrtld_set_error("`%s`: Could not resolve TLS symbol: `%s`", mod->name, symname);
+        return 1;
+      }
+    }
+    value = sym->st_value;
+  }
+
+  if (!def->tls_modid) {
+    vrtld_set_error("`%s`: TLS relocation refers to `%s`, which has no TLS segment", mod->name, def->name);
+    return -1;
+  }
+
+  switch (type) {
+    case R_ARM_TLS_DTPMOD32:
+      *ptr = def->tls_modid;
+      break;
+    case R_ARM_TLS_DTPOFF32:
+      *ptr += value;
+      break;
+    case R_ARM_TLS_TPOFF32:
+      if (!def->tls_offset) {
+        vrtld_set_error("`%s`: initial-exec TLS access to `%s`, which was loaded after TLS was first used; "
+          "build it with -ftls-model=global-dynamic", mod->name, def->name);
+        return -1;
+      }
+      *ptr += def->tls_offset + value;
+      break;
+    default:
+      vrtld_set_error("`%s`: Unknown TLS relocation type: %d", mod->name, type);
+      return -1;
+  }
+
+  mod->stats.relocs[VRTLD_RELOC_TLS]++;
+
+  return 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "common.h"
+
+// thread-local storage for modules with a PT_TLS segment
+//
+// ARM uses TLS variant I: the thread pointer points to an 8 byte TCB that is followed by the static
+// TLS blocks. Modules that are loaded before any thread touches TLS get a block there, so their
+// variables are at a fixed offset from the thread pointer; everything loaded after that gets its
+// blocks allocated per thread on first access through __tls_get_addr().
+//
+// The thread pointer comes from __aeabi_read_tp(), so modules have to be built with -mtp=soft.
+
+#ifndef PT_TLS
+#define PT_TLS 7
+#endif
+
+#ifndef STT_TLS
+#define STT_TLS 6
+#endif
+
+#ifndef R_ARM_TLS_DTPMOD32
+#define R_ARM_TLS_DTPMOD32 17
+#define R_ARM_TLS_DTPOFF32 18
+#define R_ARM_TLS_TPOFF32  19
+#endif
+
+// size of the TCB at the thread pointer
+#define TLS_TCB_SIZE 8
+// how many modules with TLS can be loaded at the same time
+#define TLS_MAX_MODULES 64
+
+// assigns a module id and, if it's still early enough, a static block
+int tls_register(dso_t *mod);
+void tls_unregister(dso_t *mod);
+// drops all the module ids and the static layout; blocks of live threads are replaced on next access
+void tls_quit(void);
+
+// handles R_ARM_TLS_DTPMOD32, R_ARM_TLS_DTPOFF32 and R_ARM_TLS_TPOFF32;
+// returns 1 if the symbol couldn't be resolved and -1 if the reloc can't be applied at all
+int tls_relocate(dso_t *mod, Elf32_Addr *ptr, const int type, const uint32_t symno, const int ignore_undef);
+
+// address of a TLS variable of mod for the calling thread
+void *tls_get_addr(const dso_t *mod, const uint32_t offset);
+
+// loader helpers that modules import, like __tls_get_addr(); these have the lowest precedence
+void *tls_builtin_lookup(const char *symname);
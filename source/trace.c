@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "vrtld.h"
+#include "util.h"
+#include "trace.h"
+
+#define TRACE_DEFAULT_CAPACITY 1024
+
+// events are recorded when they end, with their duration, so a ring that has wrapped
+// around never has half of an event in it
+typedef struct trace_event {
+  uint64_t ts;
+  uint32_t dur;
+  uint32_t tid;
+  uint32_t size;
+  int32_t index;
+  uint8_t type;
+  char arg[TRACE_ARG_LEN];
+} trace_event_t;
+
+static const char *trace_names[TRACE_NUM_TYPES] = {
+  "dso_load",
+  "vrtld_relocate",
+  "init_array",
+  "vrtld_dlsym",
+  "vrtld_dlclose",
+  "vrtld_dlsym_many",
+};
+
+// guards everything below; events are too rare to bother with anything lock-free
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void *trace_ring = NULL;
+static uint32_t trace_capacity;
+static uint32_t trace_head; // total number of events ever recorded
+
+void trace_end(const uint64_t start, const int type, const char *arg, const uint32_t size, const int32_t index) {
+  if (!start)
+    return;
+
+  const uint64_t now = stats_now();
+  const uint32_t tid = plat_thread_id();
+
+  pthread_mutex_lock(&trace_lock);
+
+  trace_event_t *ring = trace_ring;
+  if (ring) {
+    trace_event_t *ev = &ring[trace_head++ % trace_capacity];
+    ev->ts = start;
+    ev->dur = (uint32_t)(now - start);
+    ev->tid = tid;
+    ev->size = size;
+    ev->index = index;
+    ev->type = type;
+    if (arg)
+      snprintf(ev->arg, sizeof(ev->arg), "%s", arg);
+    else
+      ev->arg[0] = '\0';
+  }
+
+  pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_free(void) {
+  pthread_mutex_lock(&trace_lock);
+  free(trace_ring);
+  __atomic_store_n(&trace_ring, NULL, __ATOMIC_RELAXED);
+  trace_capacity = 0;
+  trace_head = 0;
+  pthread_mutex_unlock(&trace_lock);
+}
+
+int vrtld_trace_enable(unsigned int capacity) {
+  if (!capacity)
+    capacity = TRACE_DEFAULT_CAPACITY;
+
+  trace_event_t *ring = calloc(capacity, sizeof(*ring));
+  if (!ring) {
+    vrtld_set_error("vrtld_trace_enable(): could not allocate %u events", capacity);
+    return -1;
+  }
+
+  // starting over drops whatever was recorded before
+  pthread_mutex_lock(&trace_lock);
+  free(trace_ring);
+  trace_capacity = capacity;
+  trace_head = 0;
+  __atomic_store_n(&trace_ring, ring, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&trace_lock);
+
+  return 0;
+}
+
+void vrtld_trace_disable(void) {
+  trace_free();
+}
+
+typedef struct trace_writer {
+  vrtld_trace_write_t write;
+  void *userdata;
+  char buf[512];
+  uint32_t len;
+  int err;
+} trace_writer_t;
+
+static void trace_flush(trace_writer_t *w) {
+  if (w->len && !w->err && w->write(w->buf, w->len, w->userdata) < 0)
+    w->err = 1;
+  w->len = 0;
+}
+
+static void trace_putc(trace_writer_t *w, const char c) {
+  if (w->len == sizeof(w->buf))
+    trace_flush(w);
+  w->buf[w->len++] = c;
+}
+
+static void trace_puts(trace_writer_t *w, const char *s) {
+  while (*s)
+    trace_putc(w, *s++);
+}
+
+static void trace_put_string(trace_writer_t *w, const char *s) {
+  trace_putc(w, '"');
+  for (; *s; ++s) {
+    const unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      trace_putc(w, '\\');
+      trace_putc(w, c);
+    } else if (c < 0x20) {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+      trace_puts(w, esc);
+    } else {
+      trace_putc(w, c);
+    }
+  }
+  trace_putc(w, '"');
+}
+
+int vrtld_trace_dump(vrtld_trace_write_t write, void *userdata) {
+  if (!write) {
+    vrtld_set_error("vrtld_trace_dump(): NULL callback");
+    return -1;
+  }
+
+  trace_writer_t w = { .write = write, .userdata = userdata };
+  char tmp[128];
+
+  // copy the events out in order, so that the callback can take its time or even record more events
+  pthread_mutex_lock(&trace_lock);
+  const uint32_t count = (trace_head < trace_capacity) ? trace_head : trace_capacity;
+  trace_event_t *events = count ? malloc(count * sizeof(*events)) : NULL;
+  if (events) {
+    const trace_event_t *ring = trace_ring;
+    const uint32_t first = trace_head - count;
+    for (uint32_t i = 0; i < count; ++i)
+      events[i] = ring[(first + i) % trace_capacity];
+  }
+  pthread_mutex_unlock(&trace_lock);
+
+  if (count && !events) {
+    vrtld_set_error("vrtld_trace_dump(): could not allocate %u events", (unsigned)count);
+    return -1;
+  }
+
+  const uint32_t pid = plat_process_id();
+
+  trace_puts(&w, "{\"traceEvents\":[");
+  for (uint32_t i = 0; i < count && !w.err; ++i) {
+    const trace_event_t *ev = &events[i];
+    snprintf(tmp, sizeof(tmp), "%s\n{\"name\":\"%s\",\"cat\":\"vrtld\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%u,\"pid\":%u,\"tid\":%u,\"args\":{",
+      i ? "," : "", trace_names[ev->type], (unsigned long long)ev->ts, (unsigned)ev->dur, (unsigned)pid, (unsigned)ev->tid);
+    trace_puts(&w, tmp);
+    // the arg is a symbol name for dlsym and a module name for everything else
+    trace_puts(&w, (ev->type == TRACE_DLSYM) ? "\"symbol\":" : "\"module\":");
+    trace_put_string(&w, ev->arg);
+    // a batch lookup records how many names it resolved instead of a size
+    if (ev->type == TRACE_DLSYM_MANY) {
+      snprintf(tmp, sizeof(tmp), ",\"count\":%u", (unsigned)ev->size);
+      trace_puts(&w, tmp);
+    } else if (ev->size) {
+      snprintf(tmp, sizeof(tmp), ",\"size\":%u", (unsigned)ev->size);
+      trace_puts(&w, tmp);
+    }
+    if (ev->index >= 0) {
+      snprintf(tmp, sizeof(tmp), ",\"index\":%d", (int)ev->index);
+      trace_puts(&w, tmp);
+    }
+    trace_puts(&w, "}}");
+  }
+  trace_puts(&w, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  trace_flush(&w);
+
+  free(events);
+
+  if (w.err) {
+    vrtld_set_error("vrtld_trace_dump(): write callback failed");
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "stats.h"
+
+// opt-in ring buffer of load events, dumped as Chrome trace JSON
+
+// longest module or symbol name that is kept in an event, including the terminator
+#define TRACE_ARG_LEN 40
+
+enum trace_event_type {
+  TRACE_DSO_LOAD,
+  TRACE_RELOCATE,
+  TRACE_INIT,
+  TRACE_DLSYM,
+  TRACE_DLCLOSE,
+  TRACE_DLSYM_MANY,
+  TRACE_NUM_TYPES
+};
+
+extern void *trace_ring;
+
+static inline int trace_enabled(void) {
+  return __atomic_load_n(&trace_ring, __ATOMIC_RELAXED) != NULL;
+}
+
+// returns the start time of an event, or 0 if tracing is off
+static inline uint64_t trace_begin(void) {
+  return trace_enabled() ? stats_now() : 0;
+}
+
+// records an event that started at `start`; arg, size and index are optional (NULL, 0, -1)
+void trace_end(const uint64_t start, const int type, const char *arg, const uint32_t size, const int32_t index);
+
+void trace_free(void);
@@ -2,26 +2,62 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "util.h"
 
 #define MAX_ERROR 2048
 
-static char errbuf[MAX_ERROR];
-static const char *err = NULL;
+typedef struct vrtld_error {
+  const char *err;
+  char buf[MAX_ERROR];
+} vrtld_error_t;
+
+// every thread gets its own error state, allocated on its first error
+static pthread_key_t error_key;
+static pthread_once_t error_key_once = PTHREAD_ONCE_INIT;
+static int error_key_ok = 0;
+
+// shared by threads that couldn't get their own
+static vrtld_error_t error_fallback;
+
+static void error_key_init(void) {
+  error_key_ok = (pthread_key_create(&error_key, free) == 0);
+}
+
+static vrtld_error_t *error_get(const int create) {
+  pthread_once(&error_key_once, error_key_init);
+  if (!error_key_ok)
+    return &error_fallback;
+
+  vrtld_error_t *e = pthread_getspecific(error_key);
+  if (!e && create) {
+    e = calloc(1, sizeof(*e));
+    if (!e || pthread_setspecific(error_key, e)) {
+      free(e);
+      return &error_fallback;
+    }
+  }
+
+  return e;
+}
 
 void vrtld_set_error(const char *fmt, ...) {
+  vrtld_error_t *e = error_get(1);
   va_list args;
   va_start(args, fmt);
-  vsnprintf(errbuf, sizeof(errbuf), fmt, args);
+  vsnprintf(e->buf, sizeof(e->buf), fmt, args);
   va_end(args);
-  if (!err) err = errbuf;
-  DEBUG_PRINTF("vrtld error: %s\n", err);
+  if (!e->err) e->err = e->buf;
+  DEBUG_PRINTF("vrtld error: %s\n", e->err);
 }
 
 const char *vrtld_dlerror(void) {
-  const char *ret = err;
-  err = NULL;
+  // don't allocate anything for threads that never had an error
+  vrtld_error_t *e = error_get(0);
+  if (!e) return NULL;
+  const char *ret = e->err;
+  e->err = NULL;
   return ret;
 }
 
@@ -48,3 +84,96 @@ uint32_t vrtld_elf_hash(const uint8_t *name) {
   }
   return h;
 }
+
+uint32_t vrtld_gnu_hash(const uint8_t *name) {
+  uint32_t h = 5381;
+  while (*name)
+    h = (h << 5) + h + *name++;
+  return h;
+}
+
+// XXH64; only used for identifying content, not for lookups
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t xxh_rotl64(const uint64_t x, const int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t xxh_read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, const uint64_t input) {
+  acc += input * XXH_PRIME64_2;
+  acc = xxh_rotl64(acc, 31);
+  return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge_round(uint64_t acc, const uint64_t val) {
+  acc ^= xxh_round(0, val);
+  return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+// h is the seed, so hashes of several pieces can be chained
+uint64_t vrtld_hash64(uint64_t h, const void *data, const size_t size) {
+  const uint8_t *p = data;
+  const uint8_t *end = p + size;
+  const uint64_t seed = h;
+
+  if (size >= 32) {
+    uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    uint64_t v2 = seed + XXH_PRIME64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - XXH_PRIME64_1;
+    for (; p + 32 <= end; p += 32) {
+      v1 = xxh_round(v1, xxh_read64(p));
+      v2 = xxh_round(v2, xxh_read64(p + 8));
+      v3 = xxh_round(v3, xxh_read64(p + 16));
+      v4 = xxh_round(v4, xxh_read64(p + 24));
+    }
+    h = xxh_rotl64(v1, 1) + xxh_rotl64(v2, 7) + xxh_rotl64(v3, 12) + xxh_rotl64(v4, 18);
+    h = xxh_merge_round(h, v1);
+    h = xxh_merge_round(h, v2);
+    h = xxh_merge_round(h, v3);
+    h = xxh_merge_round(h, v4);
+  } else {
+    h = seed + XXH_PRIME64_5;
+  }
+
+  h += size;
+
+  for (; p + 8 <= end; p += 8) {
+    h ^= xxh_round(0, xxh_read64(p));
+    h = xxh_rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+  }
+  if (p + 4 <= end) {
+    h ^= (uint64_t)xxh_read32(p) * XXH_PRIME64_1;
+    h = xxh_rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    h ^= *p * XXH_PRIME64_5;
+    h = xxh_rotl64(h, 11) * XXH_PRIME64_1;
+  }
+
+  // avalanche
+  h ^= h >> 33;
+  h *= XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH_PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
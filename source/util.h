@@ -7,16 +7,21 @@
 #ifdef DEBUG
 #define DEBUG_PRINTF(...) fprintf(stderr, __VA_ARGS__)
 #else
-#define DEBUG_PRINTF(...)
+#define DEBUG_PRINTF(...) do { } while (0)
 #endif
 
 #define ALIGN_UP(x, align) (((x) + ((align) - 1)) & ~((align) - 1))
 #define ALIGN_DN(x, align) (((x) / (align)) * (align))
 #define ALIGN_PAGE 0x1000
 
-void vrtld_set_error(const char *fmt, ...);
+void vrtld_set_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
 
 char *vrtld_strdup(const char *s);
 void *vrtld_memdup(const void *src, const size_t size);
 
+// seed for the first vrtld_hash64() in a chain
+#define VRTLD_HASH64_INIT 0
+
 uint32_t vrtld_elf_hash(const uint8_t *name);
+uint32_t vrtld_gnu_hash(const uint8_t *name);
+uint64_t vrtld_hash64(uint64_t h, const void *data, const size_t size);
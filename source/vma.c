@@ -4,32 +4,109 @@
 
 #include "vma.h"
 #include "util.h"
+#include "platform.h"
 
-// a simple stack allocator for the virtual address space
+// a best-fit allocator for the virtual address space; free blocks are kept sorted
+// by address and coalesced with their neighbours when something is freed
 
 #define VMA_ALIGNMENT ALIGN_PAGE
-#define VMA_MAX_ALLOCS 256
+#define VMA_MIN_CAPACITY 32
+
+typedef struct vma_block {
+  uintptr_t ptr;
+  uint32_t size;
+} vma_block_t;
+
+typedef struct vma_list {
+  vma_block_t *blocks;
+  uint32_t len;
+  uint32_t cap;
+} vma_list_t;
 
 static uintptr_t vma_base;
-static uintptr_t vma_ptr;
-static uintptr_t vma_lastptr;
 static uint32_t vma_size;
-static uint32_t vma_left;
+static uint32_t vma_used;
+static int vma_reserved;
 
-static struct {
-  uintptr_t ptr; // 0 means this has been marked as free
-  uint32_t size;
-} vma_allocs[VMA_MAX_ALLOCS];
+static vma_list_t vma_freelist; // free blocks
+static vma_list_t vma_allocs;   // live allocations, also sorted by address
+
+static int vma_list_reserve(vma_list_t *list, const uint32_t len) {
+  if (len <= list->cap)
+    return 0;
+  uint32_t cap = list->cap ? list->cap : VMA_MIN_CAPACITY;
+  while (cap < len)
+    cap *= 2;
+  vma_block_t *blocks = realloc(list->blocks, cap * sizeof(*blocks));
+  if (!blocks)
+    return -1;
+  list->blocks = blocks;
+  list->cap = cap;
+  return 0;
+}
+
+// index of the first block that starts at or after ptr
+static uint32_t vma_list_lower_bound(const vma_list_t *list, const uintptr_t ptr) {
+  uint32_t lo = 0, hi = list->len;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    if (list->blocks[mid].ptr < ptr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static void vma_list_insert(vma_list_t *list, const uint32_t i, const uintptr_t ptr, const uint32_t size) {
+  memmove(&list->blocks[i + 1], &list->blocks[i], (list->len - i) * sizeof(*list->blocks));
+  list->blocks[i].ptr = ptr;
+  list->blocks[i].size = size;
+  list->len++;
+}
+
+static void vma_list_remove(vma_list_t *list, const uint32_t i) {
+  memmove(&list->blocks[i], &list->blocks[i + 1], (list->len - i - 1) * sizeof(*list->blocks));
+  list->len--;
+}
+
+int vma_init(const uintptr_t start, const uintptr_t end) {
+  vma_quit();
+
+  vma_base = ALIGN_UP(start, VMA_ALIGNMENT);
+  vma_size = (end > vma_base) ? ALIGN_DN(end - vma_base, VMA_ALIGNMENT) : 0;
+  vma_used = 0;
+
+  if (!vma_size || vma_list_reserve(&vma_freelist, 1)) {
+    DEBUG_PRINTF("vma_init(): invalid window 0x%08x - 0x%08x\n", (unsigned)start, (unsigned)end);
+    return -1;
+  }
+
+  if (plat_reserve_window(vma_base, vma_base + vma_size) < 0) {
+    DEBUG_PRINTF("vma_init(): could not reserve window 0x%08x - 0x%08x\n", (unsigned)vma_base, (unsigned)(vma_base + vma_size));
+    vma_size = 0;
+    return -1;
+  }
+  vma_reserved = 1;
 
-static uint32_t vma_numallocs;
+  // the whole window is one big free block
+  vma_list_insert(&vma_freelist, 0, vma_base, vma_size);
 
-void vma_init(void) {
-  vma_base = VRTLD_VMA_START;
-  vma_ptr = vma_lastptr = vma_base;
-  vma_size = vma_left = VRTLD_VMA_END - vma_base;
-  vma_numallocs = 0;
-  memset(vma_allocs, 0, sizeof(vma_allocs));
-  DEBUG_PRINTF("vma_init(): vma_base=0x%08x vma_size=0x%08x\n", vma_base, vma_size);
+  DEBUG_PRINTF("vma_init(): vma_base=0x%08x vma_size=0x%08x\n", (unsigned)vma_base, (unsigned)vma_size);
+
+  return 0;
+}
+
+void vma_quit(void) {
+  if (vma_reserved) {
+    plat_release_window(vma_base, vma_base + vma_size);
+    vma_reserved = 0;
+  }
+  free(vma_freelist.blocks);
+  free(vma_allocs.blocks);
+  memset(&vma_freelist, 0, sizeof(vma_freelist));
+  memset(&vma_allocs, 0, sizeof(vma_allocs));
+  vma_used = 0;
 }
 
 void *vma_alloc(size_t size) {
@@ -40,27 +117,41 @@ void *vma_alloc(size_t size) {
     return 0;
   }
 
-  if (vma_left < size) {
-    DEBUG_PRINTF("vma_alloc(): failed to alloc %u bytes\n", size);
+  // find the smallest free block that fits
+  uint32_t best = vma_freelist.len;
+  for (uint32_t i = 0; i < vma_freelist.len; ++i) {
+    const uint32_t bsize = vma_freelist.blocks[i].size;
+    if (bsize >= size && (best == vma_freelist.len || bsize < vma_freelist.blocks[best].size)) {
+      best = i;
+      if (bsize == size)
+        break; // can't do any better than that
+    }
+  }
+
+  if (best == vma_freelist.len) {
+    DEBUG_PRINTF("vma_alloc(): failed to alloc %u bytes, %u free\n", (unsigned)size, (unsigned)(vma_size - vma_used));
     return 0;
   }
 
-  if (vma_numallocs == VMA_MAX_ALLOCS) {
-    DEBUG_PRINTF("vma_alloc(): MAX_ALLOCS reached\n");
+  if (vma_list_reserve(&vma_allocs, vma_allocs.len + 1)) {
+    DEBUG_PRINTF("vma_alloc(): could not grow allocation table\n");
     return 0;
   }
 
-  vma_lastptr = vma_ptr;
-  vma_ptr += size;
-  vma_left -= size;
+  // carve it out of the start of the free block
+  vma_block_t *blk = &vma_freelist.blocks[best];
+  const uintptr_t ptr = blk->ptr;
+  blk->ptr += size;
+  blk->size -= size;
+  if (blk->size == 0)
+    vma_list_remove(&vma_freelist, best);
 
-  const uint32_t i = vma_numallocs++;
-  vma_allocs[i].size = size;
-  vma_allocs[i].ptr = vma_lastptr;
+  vma_list_insert(&vma_allocs, vma_list_lower_bound(&vma_allocs, ptr), ptr, size);
+  vma_used += size;
 
-  DEBUG_PRINTF("vma_alloc(): allocated %u bytes at 0x%08x, %u free\n", size, vma_lastptr, vma_left);
+  DEBUG_PRINTF("vma_alloc(): allocated %u bytes at 0x%08x, %u free\n", (unsigned)size, (unsigned)ptr, (unsigned)(vma_size - vma_used));
 
-  return (void *)vma_lastptr;
+  return (void *)ptr;
 }
 
 void vma_free(void *vptr) {
@@ -69,43 +160,50 @@ void vma_free(void *vptr) {
   if (!ptr)
     return; // no-op
 
-  if (vma_numallocs == 0) {
-    DEBUG_PRINTF("vma_free(): nothing to free\n");
+  const uint32_t ai = vma_list_lower_bound(&vma_allocs, ptr);
+  if (ai == vma_allocs.len || vma_allocs.blocks[ai].ptr != ptr) {
+    DEBUG_PRINTF("vma_free(): tried to free unknown pointer 0x%08x\n", (unsigned)ptr);
     return;
   }
 
-  if (ptr == vma_lastptr) {
-    // this was the top of the stack; dealloc it and everything that's marked as free below it
-    const int top = vma_numallocs - 1;
-    vma_allocs[top].ptr = 0; // mark top as free
-    for (int i = top; i >= 0; --i) {
-      if (vma_allocs[i].ptr) {
-        // found a live alloc, restore to that point
-        vma_lastptr = vma_allocs[i].ptr;
-        vma_ptr = vma_lastptr + vma_allocs[i].size;
-        DEBUG_PRINTF("vma_free(): resetting to last alloc of %u bytes at 0x%08x, %u free\n", vma_allocs[i].size, vma_lastptr, vma_left);
-        return;
-      } else {
-        DEBUG_PRINTF("vma_free(): chain-freeing %u bytes\n", vma_allocs[i].size);
-        vma_left += vma_allocs[i].size;
-        vma_allocs[i].size = 0;
-      }
-    }
-    // didn't find any live allocs, clear the state
-    DEBUG_PRINTF("vma_free(): resetting to base state\n");
-    vma_lastptr = vma_ptr = vma_base;
-    vma_left = vma_size;
-    return;
+  const uint32_t size = vma_allocs.blocks[ai].size;
+
+  // see if this can be merged with the free blocks on either side
+  const uint32_t fi = vma_list_lower_bound(&vma_freelist, ptr);
+  vma_block_t *prev = fi > 0 ? &vma_freelist.blocks[fi - 1] : NULL;
+  vma_block_t *next = fi < vma_freelist.len ? &vma_freelist.blocks[fi] : NULL;
+  const int merge_prev = prev && prev->ptr + prev->size == ptr;
+  const int merge_next = next && ptr + size == next->ptr;
+
+  if (merge_prev && merge_next) {
+    prev->size += size + next->size;
+    vma_list_remove(&vma_freelist, fi);
+  } else if (merge_prev) {
+    prev->size += size;
+  } else if (merge_next) {
+    next->ptr = ptr;
+    next->size += size;
+  } else if (vma_list_reserve(&vma_freelist, vma_freelist.len + 1) == 0) {
+    vma_list_insert(&vma_freelist, fi, ptr, size);
+  } else {
+    // can't track it; the range stays reserved, but at least the allocation is gone
+    DEBUG_PRINTF("vma_free(): could not grow free list, leaking %u bytes at 0x%08x\n", (unsigned)size, (unsigned)ptr);
   }
 
-  // not the top of the stack; just find it and mark as free
-  for (uint32_t i = 0; i < vma_numallocs; ++i) {
-    if (vma_allocs[i].ptr == ptr) {
-      DEBUG_PRINTF("vma_free(): marking %u bytes at 0x%08x as free\n", vma_allocs[i].size, vma_allocs[i].ptr);
-      vma_allocs[i].ptr = 0;
-      return;
-    }
-  }
+  vma_list_remove(&vma_allocs, ai);
+  vma_used -= size;
+
+  DEBUG_PRINTF("vma_free(): freed %u bytes at 0x%08x, %u free in %u blocks\n", (unsigned)size, (unsigned)ptr, (unsigned)(vma_size - vma_used), (unsigned)vma_freelist.len);
+}
 
-  DEBUG_PRINTF("vma_free(): tried to free unknown pointer 0x%08x\n", ptr);
+void vma_get_stats(vma_stats_t *out) {
+  out->total = vma_size;
+  out->used = vma_used;
+  out->num_allocs = vma_allocs.len;
+  out->num_free = vma_freelist.len;
+  out->largest_free = 0;
+  for (uint32_t i = 0; i < vma_freelist.len; ++i) {
+    if (vma_freelist.blocks[i].size > out->largest_free)
+      out->largest_free = vma_freelist.blocks[i].size;
+  }
 }
@@ -1,11 +1,22 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
-// approximate borders of the free virtual address space we can use
+// default borders of the free virtual address space we can use
 #define VRTLD_VMA_START 0x98000000
 #define VRTLD_VMA_END   0xA2000000
 
-void vma_init(void);
+typedef struct vma_stats {
+  uint32_t total;        // size of the window
+  uint32_t used;         // bytes allocated
+  uint32_t largest_free; // largest allocation that can currently succeed
+  uint32_t num_allocs;   // live allocations
+  uint32_t num_free;     // free blocks; more than one means the window is fragmented
+} vma_stats_t;
+
+int vma_init(const uintptr_t start, const uintptr_t end);
+void vma_quit(void);
 void *vma_alloc(size_t size);
 void vma_free(void *vptr);
+void vma_get_stats(vma_stats_t *out);
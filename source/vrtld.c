@@ -1,16 +1,24 @@
 #include <stdio.h>
 #include <string.h>
-#include <vitasdk.h>
 
 #include "common.h"
 #include "util.h"
 #include "loader.h"
 #include "exports.h"
 #include "vma.h"
+#include "gsym.h"
+#include "lookup.h"
+#include "async.h"
+#include "stats.h"
+#include "tls.h"
 #include "vrtld.h"
 
 static int init_flags = 0;
 
+// virtual address window for modules
+static uintptr_t vma_start = VRTLD_VMA_START;
+static uintptr_t vma_end = VRTLD_VMA_END;
+
 // the main module is the head and is never unloaded
 dso_t vrtld_dsolist = {
   "$main",
@@ -19,25 +27,33 @@ dso_t vrtld_dsolist = {
   .flags = MOD_MAPPED | MOD_RELOCATED | MOD_INITIALIZED,
 };
 
-static int check_kubridge(void) {
-  int search_unk[2];
-  return _vshKernelSearchModuleByName("kubridge", search_unk);
-}
-
 int vrtld_init(const unsigned int flags) {
-  if (check_kubridge() < 0) {
-    vrtld_set_error("kubridge not detected");
-    return -1;
-  }
+  if (plat_init() < 0)
+    return -1; // error is already set
 
   init_flags = VRTLD_INITIALIZED | flags;
 
-  // initialize virtual memory "allocator"
-  vma_init();
+  // start counting from scratch
+  stats_reset();
+  memset(&vrtld_dsolist.stats, 0, sizeof(vrtld_dsolist.stats));
+
+  // initialize virtual memory allocator
+  if (vma_init(vma_start, vma_end) < 0) {
+    vrtld_set_error("invalid address window 0x%08x - 0x%08x", (unsigned)vma_start, (unsigned)vma_end);
+    init_flags = 0;
+    return -1;
+  }
 
   // check if there's any user-defined exports
   vrtld_set_main_exports(NULL, 0);
 
+  // index the override exports, if any
+  gsym_add_overrides();
+
+  // index the main module's SCE exports if we're going to use them
+  if (!(flags & VRTLD_NO_SCE_EXPORTS))
+    vrtld_sce_exports_init();
+
   // clear error flag
   vrtld_dlerror();
 
@@ -54,9 +70,58 @@ void vrtld_quit(void) {
     return;
   }
 
+  vrtld_async_quit();
   vrtld_unload_all();
+  tls_quit();
+  vrtld_sce_exports_free();
+  vma_quit();
 
   init_flags = 0;
 
   vrtld_dlerror(); // clear error flag
 }
+
+int vrtld_set_address_window(void *start, const unsigned int size) {
+  const uintptr_t ustart = start ? (uintptr_t)start : VRTLD_VMA_START;
+  const uintptr_t uend = start ? ustart + size : VRTLD_VMA_END;
+
+  if (uend <= ustart) {
+    vrtld_set_error("invalid address window 0x%08x - 0x%08x", (unsigned)ustart, (unsigned)uend);
+    return -1;
+  }
+
+  // nothing can be loading while the window moves, including async tickets that haven't got to it yet
+  vrtld_loader_lock();
+
+  if (init_flags) {
+    // can only move the window if there's nothing in it
+    if (vrtld_dsolist.next || vrtld_async_busy()) {
+      vrtld_loader_unlock();
+      vrtld_set_error("cannot change address window while modules are loaded or loading");
+      return -1;
+    }
+    if (vma_init(ustart, uend) < 0) {
+      vma_init(vma_start, vma_end);
+      vrtld_loader_unlock();
+      vrtld_set_error("invalid address window 0x%08x - 0x%08x", (unsigned)ustart, (unsigned)uend);
+      return -1;
+    }
+  }
+
+  vma_start = ustart;
+  vma_end = uend;
+
+  vrtld_loader_unlock();
+
+  return 0;
+}
+
+void vrtld_get_address_window_stats(unsigned int *out_free, unsigned int *out_largest_free, unsigned int *out_free_blocks) {
+  vma_stats_t stats;
+  vrtld_vma_lock();
+  vma_get_stats(&stats);
+  vrtld_vma_unlock();
+  if (out_free) *out_free = stats.total - stats.used;
+  if (out_largest_free) *out_largest_free = stats.largest_free;
+  if (out_free_blocks) *out_free_blocks = stats.num_free;
+}
@@ -0,0 +1,600 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <vrtld.h>
+
+#include "elfgen.h"
+
+// loader benchmarks on synthetic modules; every section prints a CSV header followed by its rows,
+// and sections are separated by an empty line
+
+#define BENCH_MAX_SAMPLES 4096
+#define BENCH_PROVIDER_SYMS 2000
+
+typedef struct bench_ctx {
+  FILE *out;
+  char dir[256];
+  int quick;
+  uint32_t rng;
+} bench_ctx_t;
+
+typedef struct bench_section {
+  const char *name;
+  void (*run)(bench_ctx_t *ctx);
+} bench_section_t;
+
+static uint64_t samples[BENCH_MAX_SAMPLES];
+
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint32_t bench_rand(bench_ctx_t *ctx) {
+  // xorshift32; the numbers only have to be the same every run
+  ctx->rng ^= ctx->rng << 13;
+  ctx->rng ^= ctx->rng >> 17;
+  ctx->rng ^= ctx->rng << 5;
+  return ctx->rng;
+}
+
+static int bench_cmp(const void *a, const void *b) {
+  const uint64_t x = *(const uint64_t *)a;
+  const uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// prints n,min,p50,p90,p99,max of the first n samples, followed by end
+static void bench_report_fmt(FILE *out, const uint32_t n, const char *end) {
+  qsort(samples, n, sizeof(*samples), bench_cmp);
+  fprintf(out, "%u,%llu,%llu,%llu,%llu,%llu%s", n,
+    (unsigned long long)samples[0], (unsigned long long)samples[n * 50 / 100], (unsigned long long)samples[n * 90 / 100],
+    (unsigned long long)samples[n * 99 / 100], (unsigned long long)samples[n - 1], end);
+}
+
+static inline void bench_report(FILE *out, const uint32_t n) {
+  bench_report_fmt(out, n, "\n");
+}
+
+static const char *bench_path(const bench_ctx_t *ctx, char *buf, const size_t size, const char *name) {
+  snprintf(buf, size, "%s/%s", ctx->dir, name);
+  return buf;
+}
+
+static int bench_gen(const bench_ctx_t *ctx, const char *name, const elfgen_opts_t *opts, elfgen_layout_t *layout) {
+  char path[512];
+  if (elfgen_write(bench_path(ctx, path, sizeof(path), name), opts, layout)) {
+    fprintf(stderr, "bench: could not generate `%s`\n", name);
+    return -1;
+  }
+  return 0;
+}
+
+static void *bench_open(const bench_ctx_t *ctx, const char *name) {
+  char path[512];
+  void *h = vrtld_dlopen(bench_path(ctx, path, sizeof(path), name), VRTLD_GLOBAL);
+  if (!h)
+    fprintf(stderr, "bench: could not load `%s`: %s\n", name, vrtld_dlerror());
+  return h;
+}
+
+/* latency: dlopen, dlsym hit and miss, dladdr and dlclose for each hash style */
+
+static const char *latency_hash_names[] = { "none", "sysv", "gnu" };
+
+static void bench_latency_case(bench_ctx_t *ctx, const int hash, const uint32_t num_syms) {
+  const uint32_t iters = ctx->quick ? 16 : 256;
+  const uint32_t lookups = ctx->quick ? 256 : BENCH_MAX_SAMPLES;
+  const char *hname = latency_hash_names[hash == ELFGEN_HASH_GNU ? 2 : hash];
+  char modname[64], path[512], symname[64];
+  elfgen_layout_t layout;
+
+  // a typical mix: everything is relocated, and about a quarter of the module is imports
+  const elfgen_opts_t opts = {
+    .prefix = "_ZN5bench6module6export",
+    .num_syms = num_syms,
+    .hash = hash,
+    .num_relative = num_syms * 2,
+    .num_abs32 = num_syms / 4,
+    .import_prefix = "bench_prov_",
+    .num_imports = num_syms / 4 < BENCH_PROVIDER_SYMS ? num_syms / 4 : BENCH_PROVIDER_SYMS,
+    .num_glob_dat = num_syms / 8,
+    .num_jump_slot = num_syms / 4,
+  };
+  snprintf(modname, sizeof(modname), "latency_%s_%u.so", hname, num_syms);
+  if (bench_gen(ctx, modname, &opts, &layout))
+    return;
+  bench_path(ctx, path, sizeof(path), modname);
+
+  // full load and unload
+  static uint64_t close_samples[BENCH_MAX_SAMPLES];
+  for (uint32_t i = 0; i < iters; ++i) {
+    const uint64_t t0 = bench_now_ns();
+    void *h = vrtld_dlopen(path, VRTLD_GLOBAL);
+    const uint64_t t1 = bench_now_ns();
+    if (!h) {
+      fprintf(stderr, "bench: dlopen(`%s`) failed: %s\n", modname, vrtld_dlerror());
+      return;
+    }
+    vrtld_dlclose(h);
+    samples[i] = t1 - t0;
+    close_samples[i] = bench_now_ns() - t1;
+  }
+  fprintf(ctx->out, "%s,%u,dlopen,", hname, num_syms);
+  bench_report(ctx->out, iters);
+  memcpy(samples, close_samples, iters * sizeof(*samples));
+  fprintf(ctx->out, "%s,%u,dlclose,", hname, num_syms);
+  bench_report(ctx->out, iters);
+
+  void *h = vrtld_dlopen(path, VRTLD_GLOBAL);
+  if (!h) {
+    fprintf(stderr, "bench: dlopen(`%s`) failed: %s\n", modname, vrtld_dlerror());
+    return;
+  }
+
+  for (uint32_t i = 0; i < lookups; ++i) {
+    snprintf(symname, sizeof(symname), "%s%u", opts.prefix, bench_rand(ctx) % num_syms);
+    const uint64_t t0 = bench_now_ns();
+    vrtld_dlsym(h, symname);
+    samples[i] = bench_now_ns() - t0;
+  }
+  fprintf(ctx->out, "%s,%u,dlsym_hit,", hname, num_syms);
+  bench_report(ctx->out, lookups);
+
+  for (uint32_t i = 0; i < lookups; ++i) {
+    snprintf(symname, sizeof(symname), "%s%u", "_ZN5bench6module7missing", bench_rand(ctx) % num_syms);
+    const uint64_t t0 = bench_now_ns();
+    vrtld_dlsym(h, symname);
+    samples[i] = bench_now_ns() - t0;
+  }
+  vrtld_dlerror();
+  fprintf(ctx->out, "%s,%u,dlsym_miss,", hname, num_syms);
+  bench_report(ctx->out, lookups);
+
+  char *base = vrtld_get_base(h);
+  vrtld_dl_info_t info;
+  for (uint32_t i = 0; i < lookups; ++i) {
+    // somewhere inside a random export
+    void *addr = base + layout.text + (bench_rand(ctx) % (num_syms * 4));
+    const uint64_t t0 = bench_now_ns();
+    vrtld_dladdr(addr, &info);
+    samples[i] = bench_now_ns() - t0;
+  }
+  fprintf(ctx->out, "%s,%u,dladdr,", hname, num_syms);
+  bench_report(ctx->out, lookups);
+
+  vrtld_dlclose(h);
+}
+
+static void bench_latency(bench_ctx_t *ctx) {
+  static const uint32_t sizes[] = { 1000, 10000 };
+  static const int hashes[] = { ELFGEN_HASH_NONE, ELFGEN_HASH_SYSV, ELFGEN_HASH_GNU };
+
+  // everything imports from this one
+  const elfgen_opts_t prov = { .prefix = "bench_prov_", .num_syms = BENCH_PROVIDER_SYMS, .hash = ELFGEN_HASH_GNU };
+  if (bench_gen(ctx, "latency_provider.so", &prov, NULL))
+    return;
+  void *ph = bench_open(ctx, "latency_provider.so");
+  if (!ph)
+    return;
+
+  fprintf(ctx->out, "hash,syms,op,n,min_ns,p50_ns,p90_ns,p99_ns,max_ns\n");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); ++s) {
+    for (size_t i = 0; i < sizeof(hashes) / sizeof(*hashes); ++i)
+      bench_latency_case(ctx, hashes[i], ctx->quick ? sizes[s] / 10 : sizes[s]);
+  }
+
+  vrtld_dlclose(ph);
+}
+
+/* relative: R_ARM_RELATIVE relocs through the DT_RELCOUNT kernel and through the generic path */
+
+static void bench_relative(bench_ctx_t *ctx) {
+  const uint32_t iters = ctx->quick ? 4 : 64;
+  const uint32_t num_relocs = ctx->quick ? 20000 : 200000;
+  static const char *paths[] = { "relcount", "generic" };
+
+  fprintf(ctx->out, "path,relocs,n,min_us,p50_us,p90_us,p99_us,max_us,mrelocs_per_s\n");
+
+  for (int no_relcount = 0; no_relcount < 2; ++no_relcount) {
+    const elfgen_opts_t opts = {
+      .prefix = "bench_rel_",
+      .num_syms = 16,
+      .hash = ELFGEN_HASH_GNU,
+      .num_relative = num_relocs,
+      .no_relcount = no_relcount,
+    };
+    char modname[64], path[512];
+    snprintf(modname, sizeof(modname), "relative_%s.so", paths[no_relcount]);
+    if (bench_gen(ctx, modname, &opts, NULL))
+      return;
+    bench_path(ctx, path, sizeof(path), modname);
+
+    // only the relocation phase counts, reading the file would drown it out
+    for (uint32_t i = 0; i < iters; ++i) {
+      void *h = vrtld_dlopen(path, VRTLD_LOCAL);
+      if (!h) {
+        fprintf(stderr, "bench: dlopen(`%s`) failed: %s\n", modname, vrtld_dlerror());
+        return;
+      }
+      vrtld_module_stats_t st;
+      vrtld_get_module_stats(h, &st);
+      samples[i] = st.time_us[VRTLD_PHASE_RELOC];
+      vrtld_dlclose(h);
+    }
+
+    fprintf(ctx->out, "%s,%u,", paths[no_relcount], num_relocs);
+    bench_report_fmt(ctx->out, iters, ",");
+    // the samples are sorted now
+    const uint64_t p50 = samples[iters * 50 / 100];
+    fprintf(ctx->out, "%.1f\n", p50 ? (double)num_relocs / p50 : 0.0);
+  }
+}
+
+/* modules: address to module lookups with lots of modules loaded */
+
+static void bench_modules_case(bench_ctx_t *ctx, const uint32_t num_mods) {
+  const uint32_t lookups = ctx->quick ? 256 : BENCH_MAX_SAMPLES;
+  void **handles = calloc(num_mods, sizeof(*handles));
+  uint8_t **bases = calloc(num_mods, sizeof(*bases));
+  elfgen_layout_t layout;
+  char modname[64];
+
+  if (!handles || !bases)
+    goto out;
+
+  for (uint32_t m = 0; m < num_mods; ++m) {
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "bench_m%u_", m);
+    const elfgen_opts_t opts = { .prefix = prefix, .num_syms = 64, .hash = ELFGEN_HASH_GNU, .num_relative = 64 };
+    snprintf(modname, sizeof(modname), "modules_%u.so", m);
+    if (bench_gen(ctx, modname, &opts, &layout) || !(handles[m] = bench_open(ctx, modname)))
+      goto out;
+    bases[m] = vrtld_get_base(handles[m]);
+  }
+
+  vrtld_dl_info_t info;
+
+  // address maps are built on first use, get that out of the way
+  for (uint32_t m = 0; m < num_mods; ++m)
+    vrtld_dladdr(bases[m] + layout.text, &info);
+
+  // a different module every time, so the last hit doesn't help
+  for (uint32_t i = 0; i < lookups; ++i) {
+    void *addr = bases[bench_rand(ctx) % num_mods] + layout.text + (bench_rand(ctx) % (64 * 4));
+    const uint64_t t0 = bench_now_ns();
+    vrtld_dladdr(addr, &info);
+    samples[i] = bench_now_ns() - t0;
+  }
+  fprintf(ctx->out, "%u,dladdr_random,", num_mods);
+  bench_report(ctx->out, lookups);
+
+  // the same module over and over, like an unwinder walking one stack
+  uint8_t *hot = bases[num_mods / 2];
+  for (uint32_t i = 0; i < lookups; ++i) {
+    void *addr = hot + layout.text + (bench_rand(ctx) % (64 * 4));
+    const uint64_t t0 = bench_now_ns();
+    vrtld_dladdr(addr, &info);
+    samples[i] = bench_now_ns() - t0;
+  }
+  fprintf(ctx->out, "%u,dladdr_same,", num_mods);
+  bench_report(ctx->out, lookups);
+
+  // not in any module
+  for (uint32_t i = 0; i < lookups; ++i) {
+    void *addr = (uint8_t *)&info + (bench_rand(ctx) % 64);
+    const uint64_t t0 = bench_now_ns();
+    vrtld_dladdr(addr, &info);
+    samples[i] = bench_now_ns() - t0;
+  }
+  vrtld_dlerror();
+  fprintf(ctx->out, "%u,dladdr_miss,", num_mods);
+  bench_report(ctx->out, lookups);
+
+  for (uint32_t i = 0; i < lookups; ++i) {
+    void *base = bases[bench_rand(ctx) % num_mods];
+    const uint64_t t0 = bench_now_ns();
+    vrtld_get_handle(base);
+    samples[i] = bench_now_ns() - t0;
+  }
+  fprintf(ctx->out, "%u,get_handle,", num_mods);
+  bench_report(ctx->out, lookups);
+
+out:
+  for (uint32_t m = 0; handles && m < num_mods; ++m) {
+    if (handles[m])
+      vrtld_dlclose(handles[m]);
+  }
+  free(handles);
+  free(bases);
+}
+
+static void bench_modules(bench_ctx_t *ctx) {
+  static const uint32_t counts[] = { 4, 64, 256 };
+  fprintf(ctx->out, "modules,op,n,min_ns,p50_ns,p90_ns,p99_ns,max_ns\n");
+  for (size_t i = 0; i < sizeof(counts) / sizeof(*counts); ++i)
+    bench_modules_case(ctx, ctx->quick ? counts[i] / 4 + 1 : counts[i]);
+}
+
+/* churn: modules of mixed sizes loaded and unloaded at random, tracking address window fragmentation */
+
+#define CHURN_FILES 64
+#define CHURN_LIVE  24
+
+static void bench_churn(bench_ctx_t *ctx) {
+  const uint32_t rounds = ctx->quick ? 256 : 20000;
+  const uint32_t report_every = rounds / 16;
+  void *live[CHURN_FILES] = { NULL };
+  uint32_t num_live = 0;
+  uint32_t failed = 0;
+  char modname[64];
+
+  // sizes from 4KB to 2MB, mostly small ones like real libraries
+  for (uint32_t f = 0; f < CHURN_FILES; ++f) {
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "bench_c%u_", f);
+    const uint32_t shift = 12 + (bench_rand(ctx) % 10) * (bench_rand(ctx) % 2);
+    const elfgen_opts_t opts = {
+      .prefix = prefix,
+      .num_syms = 32,
+      .hash = ELFGEN_HASH_GNU,
+      .num_relative = 32,
+      .bss_size = (1u << shift) + (bench_rand(ctx) % (1u << shift)),
+    };
+    snprintf(modname, sizeof(modname), "churn_%u.so", f);
+    if (bench_gen(ctx, modname, &opts, NULL))
+      return;
+  }
+
+  fprintf(ctx->out, "round,live,vma_used_kb,vma_free_kb,largest_free_kb,free_blocks,fragmentation,failed\n");
+
+  for (uint32_t r = 1; r <= rounds; ++r) {
+    const uint32_t f = bench_rand(ctx) % CHURN_FILES;
+    if (live[f]) {
+      vrtld_dlclose(live[f]);
+      live[f] = NULL;
+      --num_live;
+    } else if (num_live < CHURN_LIVE) {
+      snprintf(modname, sizeof(modname), "churn_%u.so", f);
+      char path[512];
+      live[f] = vrtld_dlopen(bench_path(ctx, path, sizeof(path), modname), VRTLD_LOCAL);
+      if (live[f])
+        ++num_live;
+      else
+        ++failed;
+    }
+
+    if (r % report_every == 0 || r == rounds) {
+      vrtld_stats_t st;
+      vrtld_get_stats(&st);
+      // share of the free space that can't be used for the largest possible allocation
+      const uint32_t free_space = st.vma_total - st.vma_used;
+      const double frag = free_space ? 1.0 - (double)st.vma_largest_free / free_space : 0.0;
+      fprintf(ctx->out, "%u,%u,%u,%u,%u,%u,%.4f,%u\n", r, num_live, st.vma_used / 1024, free_space / 1024,
+        st.vma_largest_free / 1024, st.vma_free_blocks, frag, failed);
+    }
+  }
+
+  for (uint32_t f = 0; f < CHURN_FILES; ++f) {
+    if (live[f])
+      vrtld_dlclose(live[f]);
+  }
+}
+
+/* deps: a generated DT_NEEDED DAG loaded one module at a time versus all at once through its root */
+
+#define DEPS_FANOUT 2
+
+static void deps_name(char *buf, const size_t size, const uint32_t level, const uint32_t i) {
+  snprintf(buf, size, "deps_%u_%u.so", level, i);
+}
+
+static void bench_deps_case(bench_ctx_t *ctx, const uint32_t levels, const uint32_t width) {
+  const uint32_t iters = ctx->quick ? 2 : 32;
+  const uint32_t num_mods = levels * width;
+  void **handles = calloc(num_mods, sizeof(*handles));
+  char names[DEPS_FANOUT][64];
+  const char *needed[DEPS_FANOUT];
+  char modname[64];
+  char path[512];
+
+  if (!handles)
+    return;
+
+  // every module needs DEPS_FANOUT neighbours on the next level, so the graph shares most of its nodes
+  for (uint32_t l = 0; l < levels; ++l) {
+    for (uint32_t i = 0; i < width; ++i) {
+      char prefix[48];
+      snprintf(prefix, sizeof(prefix), "bench_d%u_%u_%u_", width, l, i);
+      const uint32_t num_needed = (l + 1 < levels) ? DEPS_FANOUT : 0;
+      for (uint32_t n = 0; n < num_needed; ++n) {
+        deps_name(names[n], sizeof(names[n]), l + 1, (i + n) % width);
+        needed[n] = names[n];
+      }
+      const elfgen_opts_t opts = {
+        .prefix = prefix,
+        .num_syms = 256,
+        .hash = ELFGEN_HASH_GNU,
+        .num_relative = 16384,
+        .num_abs32 = 1024,
+        .needed = needed,
+        .num_needed = num_needed,
+      };
+      deps_name(modname, sizeof(modname), l, i);
+      if (bench_gen(ctx, modname, &opts, NULL))
+        goto out;
+    }
+  }
+
+  // the root needs the whole first level
+  const char **root_needed = calloc(width, sizeof(*root_needed));
+  char (*root_names)[64] = calloc(width, sizeof(*root_names));
+  int gen_failed = !root_needed || !root_names;
+  for (uint32_t i = 0; !gen_failed && i < width; ++i) {
+    deps_name(root_names[i], sizeof(root_names[i]), 0, i);
+    root_needed[i] = root_names[i];
+  }
+  if (!gen_failed) {
+    const elfgen_opts_t opts = { .prefix = "bench_droot_", .num_syms = 16, .hash = ELFGEN_HASH_GNU, .needed = root_needed, .num_needed = width };
+    gen_failed = bench_gen(ctx, "deps_root.so", &opts, NULL);
+  }
+  free(root_needed);
+  free(root_names);
+  if (gen_failed)
+    goto out;
+
+  vrtld_stats_t st;
+  vrtld_get_stats(&st);
+  const uint32_t base_modules = st.num_modules;
+
+  // deepest level first, so that every dlopen() reads exactly one file
+  for (uint32_t it = 0; it < iters; ++it) {
+    const uint64_t t0 = bench_now_ns();
+    for (uint32_t l = levels; l-- > 0; ) {
+      for (uint32_t i = 0; i < width; ++i) {
+        deps_name(modname, sizeof(modname), l, i);
+        if (!(handles[l * width + i] = bench_open(ctx, modname)))
+          goto out;
+      }
+    }
+    void *root = bench_open(ctx, "deps_root.so");
+    samples[it] = bench_now_ns() - t0;
+    if (!root)
+      goto out;
+    vrtld_get_stats(&st);
+    if (st.num_modules != base_modules + num_mods + 1)
+      fprintf(stderr, "bench: %u modules loaded, expected %u\n", st.num_modules - base_modules, num_mods + 1);
+    vrtld_dlclose(root);
+    for (uint32_t m = 0; m < num_mods; ++m) {
+      vrtld_dlclose(handles[m]);
+      handles[m] = NULL;
+    }
+  }
+  fprintf(ctx->out, "%u,%u,sequential,", levels, width);
+  bench_report(ctx->out, iters);
+
+  // one dlopen() that reads each level in parallel
+  for (uint32_t it = 0; it < iters; ++it) {
+    const uint64_t t0 = bench_now_ns();
+    void *root = vrtld_dlopen(bench_path(ctx, path, sizeof(path), "deps_root.so"), VRTLD_GLOBAL);
+    samples[it] = bench_now_ns() - t0;
+    if (!root) {
+      fprintf(stderr, "bench: could not load `deps_root.so`: %s\n", vrtld_dlerror());
+      goto out;
+    }
+    vrtld_dlclose(root);
+  }
+  fprintf(ctx->out, "%u,%u,parallel,", levels, width);
+  bench_report(ctx->out, iters);
+
+out:
+  for (uint32_t m = 0; m < num_mods; ++m) {
+    if (handles[m])
+      vrtld_dlclose(handles[m]);
+  }
+  free(handles);
+}
+
+static void bench_deps(bench_ctx_t *ctx) {
+  static const uint32_t shapes[][2] = { { 2, 4 }, { 4, 8 }, { 8, 16 } };
+  vrtld_set_search_path(ctx->dir);
+  fprintf(ctx->out, "levels,width,mode,n,min_ns,p50_ns,p90_ns,p99_ns,max_ns\n");
+  for (size_t i = 0; i < sizeof(shapes) / sizeof(*shapes); ++i)
+    bench_deps_case(ctx, shapes[i][0], ctx->quick ? shapes[i][1] / 4 + 1 : shapes[i][1]);
+  vrtld_set_search_path(NULL);
+}
+
+static const bench_section_t sections[] = {
+  { "latency", bench_latency },
+  { "relative", bench_relative },
+  { "modules", bench_modules },
+  { "churn", bench_churn },
+  { "deps", bench_deps },
+};
+
+static void bench_cleanup(const char *dir) {
+  DIR *d = opendir(dir);
+  if (!d)
+    return;
+  char path[512];
+  for (struct dirent *ent; (ent = readdir(d)) != NULL; ) {
+    if (ent->d_name[0] == '.')
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+    unlink(path);
+  }
+  closedir(d);
+  rmdir(dir);
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "usage: %s [-q] [-o out.csv] [section...]\n  -q  fewer iterations, for checking that it works\nsections:", argv0);
+  for (size_t i = 0; i < sizeof(sections) / sizeof(*sections); ++i)
+    fprintf(stderr, " %s", sections[i].name);
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+  bench_ctx_t ctx = { .out = stdout, .rng = 0x12345678 };
+  const char *outpath = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "qo:h")) != -1) {
+    switch (opt) {
+      case 'q': ctx.quick = 1; break;
+      case 'o': outpath = optarg; break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  snprintf(ctx.dir, sizeof(ctx.dir), "%s/vrtld_bench.XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+  if (!mkdtemp(ctx.dir)) {
+    perror("bench: mkdtemp");
+    return 1;
+  }
+
+  if (outpath && !(ctx.out = fopen(outpath, "w"))) {
+    perror("bench: fopen");
+    bench_cleanup(ctx.dir);
+    return 1;
+  }
+
+  if (vrtld_init(0) < 0) {
+    fprintf(stderr, "bench: vrtld_init() failed: %s\n", vrtld_dlerror());
+    bench_cleanup(ctx.dir);
+    return 1;
+  }
+
+  int ret = 0;
+  int first = 1;
+  for (size_t i = 0; i < sizeof(sections) / sizeof(*sections); ++i) {
+    int want = (optind == argc);
+    for (int a = optind; a < argc && !want; ++a)
+      want = !strcmp(argv[a], sections[i].name);
+    if (!want)
+      continue;
+    if (!first)
+      fprintf(ctx.out, "\n");
+    first = 0;
+    fprintf(stderr, "bench: running `%s`\n", sections[i].name);
+    sections[i].run(&ctx);
+  }
+
+  if (first) {
+    usage(argv[0]);
+    ret = 1;
+  }
+
+  vrtld_quit();
+
+  if (ctx.out != stdout)
+    fclose(ctx.out);
+  bench_cleanup(ctx.dir);
+
+  return ret;
+}
@@ -0,0 +1,439 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <elf.h>
+
+#include "elfgen.h"
+
+#define EG_PAGE 0x1000
+#define EG_ALIGN(x, align) (((x) + ((align) - 1)) & ~((uint32_t)(align) - 1))
+
+// the first word of every export, just so that it's not all zeroes
+#define EG_BX_LR 0xE12FFF1E
+
+enum eg_section {
+  EG_SHN_NULL,
+  EG_SHN_DYNSYM,
+  EG_SHN_DYNSTR,
+  EG_SHN_HASH,
+  EG_SHN_GNU_HASH,
+  EG_SHN_REL_DYN,
+  EG_SHN_REL_PLT,
+  EG_SHN_TEXT,
+  EG_SHN_TDATA,
+  EG_SHN_DYNAMIC,
+  EG_SHN_DATA,
+  EG_SHN_BSS,
+  EG_SHN_SHSTRTAB,
+  EG_NUM_SECTIONS
+};
+
+static const char *eg_section_names[EG_NUM_SECTIONS] = {
+  "", ".dynsym", ".dynstr", ".hash", ".gnu.hash", ".rel.dyn", ".rel.plt",
+  ".text", ".tdata", ".dynamic", ".data", ".bss", ".shstrtab",
+};
+
+typedef struct eg_strtab {
+  char *data;
+  uint32_t len;
+  uint32_t cap;
+  int err;
+} eg_strtab_t;
+
+typedef struct eg_hashed {
+  uint32_t hash;
+  uint32_t bucket;
+  uint32_t item; // TLS symbols first, then exports
+} eg_hashed_t;
+
+static uint32_t eg_strtab_add(eg_strtab_t *tab, const char *s) {
+  const uint32_t len = strlen(s) + 1;
+  if (tab->len + len > tab->cap) {
+    uint32_t cap = tab->cap ? tab->cap : 256;
+    while (cap < tab->len + len)
+      cap *= 2;
+    char *data = realloc(tab->data, cap);
+    if (!data) {
+      tab->err = 1;
+      return 0;
+    }
+    tab->data = data;
+    tab->cap = cap;
+  }
+  memcpy(tab->data + tab->len, s, len);
+  tab->len += len;
+  return tab->len - len;
+}
+
+static uint32_t eg_elf_hash(const char *name) {
+  uint32_t h = 0, g;
+  for (const uint8_t *p = (const uint8_t *)name; *p; ++p) {
+    h = (h << 4) + *p;
+    if ((g = (h & 0xf0000000)) != 0)
+      h ^= g >> 24;
+    h &= 0x0fffffff;
+  }
+  return h;
+}
+
+static uint32_t eg_gnu_hash(const char *name) {
+  uint32_t h = 5381;
+  for (const uint8_t *p = (const uint8_t *)name; *p; ++p)
+    h = (h << 5) + h + *p;
+  return h;
+}
+
+// roughly what binutils picks: the largest of these that isn't bigger than the symbol count
+static uint32_t eg_bucket_count(const uint32_t nsyms) {
+  static const uint32_t counts[] = {
+    1, 3, 17, 37, 67, 97, 131, 197, 263, 521, 1031, 2053, 4099, 8209, 16411, 32771, 65537, 131101, 262147
+  };
+  uint32_t best = 1;
+  for (size_t i = 0; i < sizeof(counts) / sizeof(*counts) && counts[i] <= nsyms; ++i)
+    best = counts[i];
+  return best;
+}
+
+static int eg_hashed_cmp(const void *a, const void *b) {
+  const eg_hashed_t *ha = a;
+  const eg_hashed_t *hb = b;
+  if (ha->bucket != hb->bucket)
+    return (ha->bucket < hb->bucket) ? -1 : 1;
+  return (ha->item < hb->item) ? -1 : (ha->item > hb->item);
+}
+
+static void eg_put32(uint8_t *image, const uint32_t ofs, const uint32_t val) {
+  memcpy(image + ofs, &val, sizeof(val));
+}
+
+int elfgen_write(const char *path, const elfgen_opts_t *opts, elfgen_layout_t *out_layout) {
+  const uint32_t num_tls = opts->tls_memsz ? opts->num_tls_syms : 0;
+  const uint32_t num_hashed = num_tls + opts->num_syms;
+  const uint32_t num_dynsym = 1 + opts->num_imports + num_hashed;
+  const uint32_t symoffset = 1 + opts->num_imports;
+  const int has_sysv = (opts->hash & ELFGEN_HASH_SYSV) != 0;
+  const int has_gnu = (opts->hash & ELFGEN_HASH_GNU) != 0;
+  const uint32_t tls_align = opts->tls_align ? opts->tls_align : 4;
+  const uint32_t tls_got_words = num_tls * (opts->tls_tpoff ? 1 : 2);
+  const uint32_t num_rel = opts->num_relative + opts->num_abs32 + opts->num_glob_dat + tls_got_words;
+  char name[256];
+  int ret = -1;
+
+  if ((opts->num_abs32 && !opts->num_syms) || ((opts->num_glob_dat || opts->num_jump_slot) && !opts->num_imports)
+      || (opts->num_tls_syms && !opts->tls_memsz) || opts->tls_filesz > opts->tls_memsz || (tls_align & (tls_align - 1))) {
+    fprintf(stderr, "elfgen: `%s`: inconsistent options\n", path);
+    return -1;
+  }
+
+  eg_strtab_t str = { 0 };
+  eg_hashed_t *hashed = calloc(num_hashed + 1, sizeof(*hashed));
+  uint32_t *sym_name = calloc(num_dynsym, sizeof(*sym_name));
+  uint32_t *needed_name = calloc(opts->num_needed + 1, sizeof(*needed_name));
+  uint32_t *item_symidx = calloc(num_hashed + 1, sizeof(*item_symidx));
+  uint8_t *image = NULL;
+  FILE *f = NULL;
+  if (!hashed || !sym_name || !needed_name || !item_symidx)
+    goto out;
+
+  // names; symbol 0 gets the empty string at offset 0
+  eg_strtab_add(&str, "");
+  for (uint32_t i = 0; i < opts->num_needed; ++i)
+    needed_name[i] = eg_strtab_add(&str, opts->needed[i]);
+  for (uint32_t i = 0; i < opts->num_imports; ++i) {
+    snprintf(name, sizeof(name), "%s%u", opts->import_prefix, i);
+    sym_name[1 + i] = eg_strtab_add(&str, name);
+  }
+  for (uint32_t i = 0; i < num_hashed; ++i) {
+    if (i < num_tls)
+      snprintf(name, sizeof(name), "%stls%u", opts->prefix, i);
+    else
+      snprintf(name, sizeof(name), "%s%u", opts->prefix, i - num_tls);
+    hashed[i].item = i;
+    hashed[i].hash = eg_gnu_hash(name);
+    // hashed symbols are named through their item for now, and moved to their final index below
+    item_symidx[i] = eg_strtab_add(&str, name);
+  }
+  if (str.err)
+    goto out;
+
+  // with a GNU hash table the defined symbols have to be sorted by bucket
+  const uint32_t gnu_nbucket = eg_bucket_count(num_hashed);
+  if (has_gnu) {
+    for (uint32_t i = 0; i < num_hashed; ++i)
+      hashed[i].bucket = hashed[i].hash % gnu_nbucket;
+    qsort(hashed, num_hashed, sizeof(*hashed), eg_hashed_cmp);
+  }
+  for (uint32_t i = 0; i < num_hashed; ++i)
+    sym_name[symoffset + i] = item_symidx[hashed[i].item];
+  for (uint32_t i = 0; i < num_hashed; ++i)
+    item_symidx[hashed[i].item] = symoffset + i;
+
+  // bloom filter size, the same way binutils does it
+  uint32_t maskbitslog2 = 1;
+  while ((1u << maskbitslog2) <= num_hashed)
+    ++maskbitslog2;
+  if (maskbitslog2 < 5)
+    maskbitslog2 = 5;
+  const uint32_t maskwords = (1u << maskbitslog2) / 32;
+  const uint32_t sysv_nbucket = eg_bucket_count(num_dynsym);
+
+  uint32_t num_dyn = opts->num_needed + 6 + 1; // SYMTAB, STRTAB, STRSZ, SYMENT, PLTGOT, NULL + spare
+  num_dyn += has_sysv + has_gnu;
+  num_dyn += num_rel ? 3 : 0; // REL, RELSZ, RELENT
+  num_dyn += (opts->num_relative && !opts->no_relcount) ? 1 : 0;
+  num_dyn += opts->num_jump_slot ? 3 : 0; // JMPREL, PLTRELSZ, PLTREL
+
+  const uint32_t num_phdr = 3 + (opts->tls_memsz ? 1 : 0);
+
+  // read-only segment
+  uint32_t ofs = sizeof(Elf32_Ehdr) + num_phdr * sizeof(Elf32_Phdr);
+  const uint32_t dynsym_ofs = EG_ALIGN(ofs, 4);
+  const uint32_t dynstr_ofs = dynsym_ofs + num_dynsym * sizeof(Elf32_Sym);
+  ofs = EG_ALIGN(dynstr_ofs + str.len, 4);
+  const uint32_t hash_ofs = ofs;
+  const uint32_t hash_size = has_sysv ? (2 + sysv_nbucket + num_dynsym) * 4 : 0;
+  const uint32_t gnuhash_ofs = hash_ofs + hash_size;
+  const uint32_t gnuhash_size = has_gnu ? (4 + maskwords + gnu_nbucket + num_hashed) * 4 : 0;
+  const uint32_t rel_ofs = gnuhash_ofs + gnuhash_size;
+  const uint32_t jmprel_ofs = rel_ofs + num_rel * sizeof(Elf32_Rel);
+  const uint32_t text_ofs = EG_ALIGN(jmprel_ofs + opts->num_jump_slot * sizeof(Elf32_Rel), 16);
+  const uint32_t text_size = opts->num_syms ? opts->num_syms * 4 : 4;
+  const uint32_t end0 = text_ofs + text_size;
+
+  // read-write segment
+  const uint32_t seg1 = EG_ALIGN(end0, EG_PAGE);
+  const uint32_t tdata_ofs = EG_ALIGN(seg1, tls_align);
+  const uint32_t dynamic_ofs = EG_ALIGN(tdata_ofs + opts->tls_filesz, 8);
+  const uint32_t data_ofs = EG_ALIGN(dynamic_ofs + num_dyn * sizeof(Elf32_Dyn), 16);
+  const uint32_t relative_ofs = data_ofs;
+  const uint32_t abs32_ofs = relative_ofs + opts->num_relative * 4;
+  const uint32_t got_ofs = abs32_ofs + opts->num_abs32 * 4;
+  const uint32_t tls_got_ofs = got_ofs + (3 + opts->num_glob_dat + opts->num_jump_slot) * 4;
+  const uint32_t end1 = tls_got_ofs + tls_got_words * 4;
+  const uint32_t end1_mem = end1 + opts->bss_size;
+
+  // section names and headers go after everything else
+  uint32_t shstr_size = 0;
+  uint32_t shstr_name[EG_NUM_SECTIONS];
+  for (int i = 0; i < EG_NUM_SECTIONS; ++i) {
+    shstr_name[i] = shstr_size;
+    shstr_size += strlen(eg_section_names[i]) + 1;
+  }
+  const uint32_t shstr_ofs = end1;
+  const uint32_t shdr_ofs = EG_ALIGN(shstr_ofs + shstr_size, 4);
+  const uint32_t file_size = shdr_ofs + EG_NUM_SECTIONS * sizeof(Elf32_Shdr);
+
+  image = calloc(1, file_size);
+  if (!image)
+    goto out;
+
+  Elf32_Ehdr *ehdr = (Elf32_Ehdr *)image;
+  memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+  ehdr->e_ident[EI_CLASS] = ELFCLASS32;
+  ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr->e_type = ET_DYN;
+  ehdr->e_machine = EM_ARM;
+  ehdr->e_version = EV_CURRENT;
+  ehdr->e_flags = EF_ARM_EABI_VER5;
+  ehdr->e_phoff = sizeof(Elf32_Ehdr);
+  ehdr->e_shoff = shdr_ofs;
+  ehdr->e_ehsize = sizeof(Elf32_Ehdr);
+  ehdr->e_phentsize = sizeof(Elf32_Phdr);
+  ehdr->e_phnum = num_phdr;
+  ehdr->e_shentsize = sizeof(Elf32_Shdr);
+  ehdr->e_shnum = EG_NUM_SECTIONS;
+  ehdr->e_shstrndx = EG_SHN_SHSTRTAB;
+
+  // file offsets are the same as addresses everywhere
+  Elf32_Phdr *phdr = (Elf32_Phdr *)(image + ehdr->e_phoff);
+  phdr[0] = (Elf32_Phdr){ PT_LOAD, 0, 0, 0, end0, end0, PF_R | PF_X, EG_PAGE };
+  phdr[1] = (Elf32_Phdr){ PT_LOAD, seg1, seg1, seg1, end1 - seg1, end1_mem - seg1, PF_R | PF_W, EG_PAGE };
+  phdr[2] = (Elf32_Phdr){ PT_DYNAMIC, dynamic_ofs, dynamic_ofs, dynamic_ofs, num_dyn * sizeof(Elf32_Dyn), num_dyn * sizeof(Elf32_Dyn), PF_R | PF_W, 4 };
+  if (opts->tls_memsz)
+    phdr[3] = (Elf32_Phdr){ PT_TLS, tdata_ofs, tdata_ofs, tdata_ofs, opts->tls_filesz, opts->tls_memsz, PF_R, tls_align };
+
+  // symbols
+  Elf32_Sym *dynsym = (Elf32_Sym *)(image + dynsym_ofs);
+  for (uint32_t i = 0; i < opts->num_imports; ++i) {
+    Elf32_Sym *sym = &dynsym[1 + i];
+    sym->st_name = sym_name[1 + i];
+    sym->st_info = ELF32_ST_INFO(opts->weak_imports ? STB_WEAK : STB_GLOBAL, STT_NOTYPE);
+    sym->st_shndx = SHN_UNDEF;
+  }
+  for (uint32_t item = 0; item < num_hashed; ++item) {
+    const uint32_t idx = item_symidx[item];
+    Elf32_Sym *sym = &dynsym[idx];
+    sym->st_name = sym_name[idx];
+    sym->st_size = 4;
+    if (item < num_tls) {
+      sym->st_value = elfgen_tls_sym_offset(opts, item);
+      sym->st_info = ELF32_ST_INFO(STB_GLOBAL, STT_TLS);
+      sym->st_shndx = EG_SHN_TDATA;
+    } else {
+      const uint32_t n = item - num_tls;
+      sym->st_value = text_ofs + n * 4;
+      sym->st_info = ELF32_ST_INFO(STB_GLOBAL, (n & 1) ? STT_OBJECT : STT_FUNC);
+      sym->st_shndx = EG_SHN_TEXT;
+    }
+  }
+  memcpy(image + dynstr_ofs, str.data, str.len);
+
+  if (has_sysv) {
+    uint32_t *tab = (uint32_t *)(image + hash_ofs);
+    uint32_t *bucket = &tab[2];
+    uint32_t *chain = &bucket[sysv_nbucket];
+    tab[0] = sysv_nbucket;
+    tab[1] = num_dynsym;
+    // insert back to front, so that every chain ends up in symbol order
+    for (uint32_t i = num_dynsym - 1; i > 0; --i) {
+      const uint32_t b = eg_elf_hash(str.data + dynsym[i].st_name) % sysv_nbucket;
+      chain[i] = bucket[b];
+      bucket[b] = i;
+    }
+  }
+
+  if (has_gnu) {
+    uint32_t *tab = (uint32_t *)(image + gnuhash_ofs);
+    uint32_t *bloom = &tab[4];
+    uint32_t *bucket = &bloom[maskwords];
+    uint32_t *chain = &bucket[gnu_nbucket];
+    tab[0] = gnu_nbucket;
+    tab[1] = symoffset;
+    tab[2] = maskwords;
+    tab[3] = maskbitslog2;
+    for (uint32_t i = 0; i < num_hashed; ++i) {
+      const uint32_t h = hashed[i].hash;
+      bloom[(h / 32) & (maskwords - 1)] |= (1u << (h % 32)) | (1u << ((h >> maskbitslog2) % 32));
+      if (!bucket[hashed[i].bucket])
+        bucket[hashed[i].bucket] = symoffset + i;
+      const int last = (i + 1 == num_hashed) || hashed[i + 1].bucket != hashed[i].bucket;
+      chain[i] = (h & ~1u) | (last ? 1 : 0);
+    }
+  }
+
+  // code; nothing is ever going to run it
+  for (uint32_t i = 0; i < opts->num_syms; ++i)
+    eg_put32(image, text_ofs + i * 4, EG_BX_LR);
+
+  // data and relocs
+  Elf32_Rel *rel = (Elf32_Rel *)(image + rel_ofs);
+  for (uint32_t i = 0; i < opts->num_relative; ++i, ++rel) {
+    const uint32_t where = relative_ofs + i * 4;
+    eg_put32(image, where, text_ofs + (opts->num_syms ? (i % opts->num_syms) * 4 : 0));
+    *rel = (Elf32_Rel){ where, ELF32_R_INFO(0, R_ARM_RELATIVE) };
+  }
+  for (uint32_t i = 0; i < opts->num_abs32; ++i, ++rel) {
+    const uint32_t symidx = item_symidx[num_tls + i % opts->num_syms];
+    *rel = (Elf32_Rel){ abs32_ofs + i * 4, ELF32_R_INFO(symidx, R_ARM_ABS32) };
+  }
+  for (uint32_t i = 0; i < opts->num_glob_dat; ++i, ++rel)
+    *rel = (Elf32_Rel){ got_ofs + (3 + i) * 4, ELF32_R_INFO(1 + i % opts->num_imports, R_ARM_GLOB_DAT) };
+  for (uint32_t i = 0; i < num_tls; ++i) {
+    const uint32_t symidx = item_symidx[i];
+    if (opts->tls_tpoff) {
+      *rel++ = (Elf32_Rel){ tls_got_ofs + i * 4, ELF32_R_INFO(symidx, R_ARM_TLS_TPOFF32) };
+    } else {
+      *rel++ = (Elf32_Rel){ tls_got_ofs + i * 8, ELF32_R_INFO(symidx, R_ARM_TLS_DTPMOD32) };
+      *rel++ = (Elf32_Rel){ tls_got_ofs + i * 8 + 4, ELF32_R_INFO(symidx, R_ARM_TLS_DTPOFF32) };
+    }
+  }
+
+  // lazy slots point to PLT0 until they're bound, which is the start of .text here
+  Elf32_Rel *jmprel = (Elf32_Rel *)(image + jmprel_ofs);
+  eg_put32(image, got_ofs, dynamic_ofs);
+  for (uint32_t i = 0; i < opts->num_jump_slot; ++i) {
+    const uint32_t where = got_ofs + (3 + opts->num_glob_dat + i) * 4;
+    eg_put32(image, where, text_ofs);
+    jmprel[i] = (Elf32_Rel){ where, ELF32_R_INFO(1 + i % opts->num_imports, R_ARM_JUMP_SLOT) };
+  }
+
+  for (uint32_t i = 0; i < opts->tls_filesz; ++i)
+    image[tdata_ofs + i] = elfgen_tls_byte(i);
+
+  Elf32_Dyn *dyn = (Elf32_Dyn *)(image + dynamic_ofs);
+  for (uint32_t i = 0; i < opts->num_needed; ++i)
+    *dyn++ = (Elf32_Dyn){ DT_NEEDED, { needed_name[i] } };
+  if (has_sysv)
+    *dyn++ = (Elf32_Dyn){ DT_HASH, { hash_ofs } };
+  if (has_gnu)
+    *dyn++ = (Elf32_Dyn){ DT_GNU_HASH, { gnuhash_ofs } };
+  *dyn++ = (Elf32_Dyn){ DT_SYMTAB, { dynsym_ofs } };
+  *dyn++ = (Elf32_Dyn){ DT_STRTAB, { dynstr_ofs } };
+  *dyn++ = (Elf32_Dyn){ DT_STRSZ, { str.len } };
+  *dyn++ = (Elf32_Dyn){ DT_SYMENT, { sizeof(Elf32_Sym) } };
+  if (num_rel) {
+    *dyn++ = (Elf32_Dyn){ DT_REL, { rel_ofs } };
+    *dyn++ = (Elf32_Dyn){ DT_RELSZ, { num_rel * sizeof(Elf32_Rel) } };
+    *dyn++ = (Elf32_Dyn){ DT_RELENT, { sizeof(Elf32_Rel) } };
+  }
+  if (opts->num_relative && !opts->no_relcount)
+    *dyn++ = (Elf32_Dyn){ DT_RELCOUNT, { opts->num_relative } };
+  if (opts->num_jump_slot) {
+    *dyn++ = (Elf32_Dyn){ DT_JMPREL, { jmprel_ofs } };
+    *dyn++ = (Elf32_Dyn){ DT_PLTRELSZ, { opts->num_jump_slot * sizeof(Elf32_Rel) } };
+    *dyn++ = (Elf32_Dyn){ DT_PLTREL, { DT_REL } };
+  }
+  *dyn++ = (Elf32_Dyn){ DT_PLTGOT, { got_ofs } };
+  *dyn = (Elf32_Dyn){ DT_NULL, { 0 } };
+
+  // the loader finds the symbol and hash tables through these
+  Elf32_Shdr *shdr = (Elf32_Shdr *)(image + shdr_ofs);
+  const struct { uint32_t type, flags, addr, size, link, align, entsize; } sections[EG_NUM_SECTIONS] = {
+    [EG_SHN_DYNSYM]   = { SHT_DYNSYM, SHF_ALLOC, dynsym_ofs, num_dynsym * sizeof(Elf32_Sym), EG_SHN_DYNSTR, 4, sizeof(Elf32_Sym) },
+    [EG_SHN_DYNSTR]   = { SHT_STRTAB, SHF_ALLOC, dynstr_ofs, str.len, 0, 1, 0 },
+    [EG_SHN_HASH]     = { has_sysv ? SHT_HASH : SHT_NULL, SHF_ALLOC, hash_ofs, hash_size, EG_SHN_DYNSYM, 4, 4 },
+    [EG_SHN_GNU_HASH] = { has_gnu ? SHT_GNU_HASH : SHT_NULL, SHF_ALLOC, gnuhash_ofs, gnuhash_size, EG_SHN_DYNSYM, 4, 0 },
+    [EG_SHN_REL_DYN]  = { SHT_REL, SHF_ALLOC, rel_ofs, num_rel * sizeof(Elf32_Rel), EG_SHN_DYNSYM, 4, sizeof(Elf32_Rel) },
+    [EG_SHN_REL_PLT]  = { SHT_REL, SHF_ALLOC, jmprel_ofs, opts->num_jump_slot * sizeof(Elf32_Rel), EG_SHN_DYNSYM, 4, sizeof(Elf32_Rel) },
+    [EG_SHN_TEXT]     = { SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, text_ofs, text_size, 0, 16, 0 },
+    [EG_SHN_TDATA]    = { opts->tls_memsz ? SHT_PROGBITS : SHT_NULL, SHF_ALLOC | SHF_WRITE | SHF_TLS, tdata_ofs, opts->tls_filesz, 0, tls_align, 0 },
+    [EG_SHN_DYNAMIC]  = { SHT_DYNAMIC, SHF_ALLOC | SHF_WRITE, dynamic_ofs, num_dyn * sizeof(Elf32_Dyn), EG_SHN_DYNSTR, 4, sizeof(Elf32_Dyn) },
+    [EG_SHN_DATA]     = { SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, data_ofs, end1 - data_ofs, 0, 16, 0 },
+    [EG_SHN_BSS]      = { SHT_NOBITS, SHF_ALLOC | SHF_WRITE, end1, opts->bss_size, 0, 4, 0 },
+    [EG_SHN_SHSTRTAB] = { SHT_STRTAB, 0, 0, shstr_size, 0, 1, 0 },
+  };
+  for (int i = 1; i < EG_NUM_SECTIONS; ++i) {
+    // sections that aren't there keep their slot, but get no name so that the loader ignores them
+    shdr[i].sh_name = (sections[i].type == SHT_NULL) ? 0 : shstr_name[i];
+    shdr[i].sh_type = sections[i].type;
+    shdr[i].sh_flags = sections[i].flags;
+    shdr[i].sh_addr = sections[i].addr;
+    shdr[i].sh_offset = (i == EG_SHN_SHSTRTAB) ? shstr_ofs : sections[i].addr;
+    shdr[i].sh_size = sections[i].size;
+    shdr[i].sh_link = sections[i].link;
+    shdr[i].sh_addralign = sections[i].align;
+    shdr[i].sh_entsize = sections[i].entsize;
+  }
+  for (int i = 0; i < EG_NUM_SECTIONS; ++i)
+    memcpy(image + shstr_ofs + shstr_name[i], eg_section_names[i], strlen(eg_section_names[i]) + 1);
+
+  f = fopen(path, "wb");
+  if (!f || fwrite(image, file_size, 1, f) != 1) {
+    fprintf(stderr, "elfgen: could not write `%s`\n", path);
+    goto out;
+  }
+
+  if (out_layout) {
+    out_layout->text = text_ofs;
+    out_layout->relative = relative_ofs;
+    out_layout->abs32 = abs32_ofs;
+    out_layout->got = got_ofs;
+    out_layout->tls_got = tls_got_ofs;
+    out_layout->tls_image = tdata_ofs;
+    out_layout->size = end1_mem;
+  }
+
+  ret = 0;
+
+out:
+  if (f && fclose(f))
+    ret = -1;
+  free(image);
+  free(item_symidx);
+  free(needed_name);
+  free(sym_name);
+  free(hashed);
+  free(str.data);
+  return ret;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+// generates synthetic ARM ET_DYN modules for the host tests and benchmarks; they can be mapped,
+// relocated and looked up, but there's nothing in them that could actually run
+
+enum elfgen_hash {
+  ELFGEN_HASH_NONE = 0,
+  ELFGEN_HASH_SYSV = 1,
+  ELFGEN_HASH_GNU  = 2,
+  ELFGEN_HASH_BOTH = ELFGEN_HASH_SYSV | ELFGEN_HASH_GNU,
+};
+
+typedef struct elfgen_opts {
+  const char *prefix;         // exports are named <prefix><n> and alternate between functions and objects
+  uint32_t num_syms;          // number of exports
+  int hash;                   // enum elfgen_hash
+  uint32_t num_relative;      // R_ARM_RELATIVE relocs, all at the start of .rel.dyn
+  int no_relcount;            // don't count them in DT_RELCOUNT
+  uint32_t num_abs32;         // R_ARM_ABS32 relocs against the module's own exports, round robin
+  const char *import_prefix;  // imports are named <import_prefix><n>
+  uint32_t num_imports;       // number of undefined symbols
+  int weak_imports;           // make them weak, so that missing ones don't fail the load
+  uint32_t num_glob_dat;      // R_ARM_GLOB_DAT relocs against the imports, round robin
+  uint32_t num_jump_slot;     // R_ARM_JUMP_SLOT relocs against the imports, in DT_JMPREL
+  const char *const *needed;  // DT_NEEDED entries
+  uint32_t num_needed;
+  uint32_t bss_size;          // zero initialized space at the end of the data segment
+  uint32_t tls_filesz;        // initialized part of the TLS block, see elfgen_tls_byte()
+  uint32_t tls_memsz;         // size of the TLS block; 0 means no PT_TLS
+  uint32_t tls_align;
+  uint32_t num_tls_syms;      // STT_TLS exports named <prefix>tls<n>, spread evenly over the block
+  int tls_tpoff;              // access them through R_ARM_TLS_TPOFF32 instead of DTPMOD32 and DTPOFF32
+} elfgen_opts_t;
+
+// where things ended up, relative to the module base
+typedef struct elfgen_layout {
+  uint32_t text;      // export n is at text + 4 * n
+  uint32_t relative;  // words fixed up by R_ARM_RELATIVE; word n initially holds text + 4 * (n % num_syms)
+  uint32_t abs32;     // words fixed up by R_ARM_ABS32; word n points to export n % num_syms
+  uint32_t got;       // 3 reserved words, then the GLOB_DAT slots, then the JUMP_SLOT slots
+  uint32_t tls_got;   // a DTPMOD32/DTPOFF32 pair or a TPOFF32 word per TLS symbol
+  uint32_t tls_image; // PT_TLS image
+  uint32_t size;      // end of the last segment
+} elfgen_layout_t;
+
+static inline uint8_t elfgen_tls_byte(const uint32_t ofs) {
+  return (uint8_t)(ofs * 7 + 1);
+}
+
+// offset of TLS symbol n from the start of the block
+static inline uint32_t elfgen_tls_sym_offset(const elfgen_opts_t *opts, const uint32_t n) {
+  return (opts->tls_memsz / opts->num_tls_syms * n) & ~3u;
+}
+
+// out_layout is optional; returns 0 on success
+int elfgen_write(const char *path, const elfgen_opts_t *opts, elfgen_layout_t *out_layout);
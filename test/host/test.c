@@ -0,0 +1,54 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <vrtld.h>
+
+#include "test.h"
+
+int test_failed = 0;
+char test_dir[256];
+
+int test_init(const unsigned int flags) {
+  const char *tmp = getenv("TMPDIR");
+  snprintf(test_dir, sizeof(test_dir), "%s/vrtld_test.XXXXXX", tmp ? tmp : "/tmp");
+  if (!mkdtemp(test_dir)) {
+    perror("test: mkdtemp");
+    return -1;
+  }
+
+  if (vrtld_init(flags) < 0) {
+    fprintf(stderr, "test: vrtld_init() failed: %s\n", vrtld_dlerror());
+    return -1;
+  }
+
+  return 0;
+}
+
+int test_finish(void) {
+  vrtld_quit();
+
+  DIR *d = opendir(test_dir);
+  if (d) {
+    char path[512];
+    for (struct dirent *ent; (ent = readdir(d)) != NULL; ) {
+      if (ent->d_name[0] == '.')
+        continue;
+      snprintf(path, sizeof(path), "%s/%s", test_dir, ent->d_name);
+      unlink(path);
+    }
+    closedir(d);
+    rmdir(test_dir);
+  }
+
+  if (test_failed)
+    fprintf(stderr, "test: FAILED\n");
+  return test_failed ? 1 : 0;
+}
+
+const char *test_path(const char *name) {
+  static char path[512];
+  snprintf(path, sizeof(path), "%s/%s", test_dir, name);
+  return path;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdio.h>
+
+// minimal checks for the host tests; a test program fails if any check did
+
+extern int test_failed;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      test_failed = 1; \
+    } \
+  } while (0)
+
+#define CHECK_EQ_HEX(a, b) do { \
+    const unsigned long long check_a_ = (unsigned long long)(a); \
+    const unsigned long long check_b_ = (unsigned long long)(b); \
+    if (check_a_ != check_b_) { \
+      fprintf(stderr, "%s:%d: check failed: %s == %s (0x%llx != 0x%llx)\n", __FILE__, __LINE__, #a, #b, check_a_, check_b_); \
+      test_failed = 1; \
+    } \
+  } while (0)
+
+// generated modules go in here
+extern char test_dir[256];
+
+// makes test_dir and calls vrtld_init(flags); returns 0 on success
+int test_init(const unsigned int flags);
+// calls vrtld_quit() and removes test_dir; returns the exit code
+int test_finish(void);
+// test_dir/name
+const char *test_path(const char *name);
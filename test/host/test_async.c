@@ -0,0 +1,84 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <vrtld.h>
+
+#include "elfgen.h"
+#include "test.h"
+
+// modules loaded with vrtld_dlopen_async() can't be found by searches through every module
+// or bound to by other modules until vrtld_async_finish() has run their constructors
+
+static void test_hidden_until_finished(void) {
+  elfgen_layout_t layout;
+  const elfgen_opts_t opts = { .prefix = "async_", .num_syms = 8, .hash = ELFGEN_HASH_GNU, .num_relative = 8 };
+  CHECK(elfgen_write(test_path("async.so"), &opts, &layout) == 0);
+
+  vrtld_async_t *ticket = vrtld_dlopen_async(test_path("async.so"), VRTLD_GLOBAL, NULL, NULL);
+  CHECK(ticket != NULL);
+  if (!ticket)
+    return;
+  CHECK(vrtld_async_wait(ticket) == 1);
+
+  // it already has its address space
+  CHECK(vrtld_set_address_window((void *)0x60000000, 0x1000000) < 0);
+  CHECK(vrtld_dlerror() != NULL);
+
+  // loaded and relocated, but not initialized yet, so nothing can bind to it
+  elfgen_layout_t user_layout;
+  const elfgen_opts_t user_opts = {
+    .prefix = "async_user_",
+    .num_syms = 2,
+    .hash = ELFGEN_HASH_GNU,
+    .import_prefix = "async_",
+    .num_imports = 4,
+    .weak_imports = 1,
+    .num_glob_dat = 4,
+  };
+  CHECK(elfgen_write(test_path("async_user.so"), &user_opts, &user_layout) == 0);
+  void *user = vrtld_dlopen(test_path("async_user.so"), VRTLD_LOCAL);
+  CHECK(user != NULL);
+  if (user) {
+    CHECK_EQ_HEX(((uint32_t *)((uint8_t *)vrtld_get_base(user) + user_layout.got))[6], 0);
+    CHECK(vrtld_dlclose(user) == 0);
+  }
+  CHECK(vrtld_dlsym(NULL, "async_3") == NULL);
+  CHECK(vrtld_dlerror() != NULL);
+  static const char *names[] = { "async_1", "async_2" };
+  void *out[2];
+  unsigned int missing = 0;
+  CHECK(vrtld_dlsym_many(NULL, names, out, 2, &missing) == 2);
+  CHECK(missing == 3);
+
+  void *h = vrtld_async_finish(ticket);
+  CHECK(h != NULL);
+  if (!h)
+    return;
+
+  uint8_t *base = vrtld_get_base(h);
+  CHECK(vrtld_dlsym(NULL, "async_3") == base + layout.text + 12);
+  CHECK(vrtld_dlsym_many(NULL, names, out, 2, &missing) == 0);
+  CHECK(out[0] == base + layout.text + 4);
+  CHECK(out[1] == base + layout.text + 8);
+  user = vrtld_dlopen(test_path("async_user.so"), VRTLD_LOCAL);
+  CHECK(user != NULL);
+  if (user) {
+    CHECK_EQ_HEX(((uint32_t *)((uint8_t *)vrtld_get_base(user) + user_layout.got))[6], (uintptr_t)base + layout.text + 12);
+    CHECK(vrtld_dlclose(user) == 0);
+  }
+
+  CHECK(vrtld_dlclose(h) == 0);
+
+  // nothing is loaded or loading anymore
+  CHECK(vrtld_set_address_window((void *)0x60000000, 0x1000000) == 0);
+  CHECK(vrtld_set_address_window(NULL, 0) == 0);
+}
+
+int main(void) {
+  if (test_init(0) < 0)
+    return 1;
+
+  test_hidden_until_finished();
+
+  return test_finish();
+}
@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <vrtld.h>
+
+#include "elfgen.h"
+#include "test.h"
+
+// loads generated DT_NEEDED graphs: shared dependencies are loaded once and released with the root,
+// dependencies of LOCAL modules stay out of everyone else's way, and cycles fail the load without
+// leaving anything behind
+
+static int gen(const char *name, const char *prefix, const char *const *needed, const uint32_t num_needed) {
+  const elfgen_opts_t opts = {
+    .prefix = prefix,
+    .num_syms = 8,
+    .hash = ELFGEN_HASH_GNU,
+    .num_relative = 8,
+    .needed = needed,
+    .num_needed = num_needed,
+  };
+  return elfgen_write(test_path(name), &opts, NULL);
+}
+
+static uint32_t num_modules(void) {
+  vrtld_stats_t st;
+  vrtld_get_stats(&st);
+  return st.num_modules;
+}
+
+static void test_diamond(void) {
+  static const char *top_needed[] = { "left.so", "right.so" };
+  static const char *side_needed[] = { "bottom.so" };
+  CHECK(gen("top.so", "top_", top_needed, 2) == 0);
+  CHECK(gen("left.so", "left_", side_needed, 1) == 0);
+  CHECK(gen("right.so", "right_", side_needed, 1) == 0);
+  CHECK(gen("bottom.so", "bottom_", NULL, 0) == 0);
+
+  const uint32_t before = num_modules();
+  void *h = vrtld_dlopen(test_path("top.so"), VRTLD_GLOBAL);
+  CHECK(h != NULL);
+  if (!h) {
+    fprintf(stderr, "dlopen: %s\n", vrtld_dlerror());
+    return;
+  }
+  CHECK(num_modules() == before + 4);
+  CHECK(vrtld_dlsym(NULL, "bottom_3") != NULL);
+
+  // already loaded as a dependency
+  void *bottom = vrtld_dlopen(test_path("bottom.so"), VRTLD_GLOBAL);
+  CHECK(bottom != NULL);
+  CHECK(num_modules() == before + 4);
+  CHECK(vrtld_dlclose(bottom) == 0);
+
+  CHECK(vrtld_dlclose(h) == 0);
+  CHECK(num_modules() == before);
+  CHECK(vrtld_dlsym(NULL, "bottom_3") == NULL);
+  vrtld_dlerror();
+}
+
+// imports ldep_0 and ldep_1, weakly if it doesn't need ldep.so
+static int gen_importer(const char *name, const char *prefix, const int needs_ldep, elfgen_layout_t *layout) {
+  static const char *needed[] = { "ldep.so" };
+  const elfgen_opts_t opts = {
+    .prefix = prefix,
+    .num_syms = 4,
+    .hash = ELFGEN_HASH_GNU,
+    .import_prefix = "ldep_",
+    .num_imports = 2,
+    .weak_imports = !needs_ldep,
+    .num_glob_dat = 2,
+    .needed = needs_ldep ? needed : NULL,
+    .num_needed = needs_ldep ? 1 : 0,
+  };
+  return elfgen_write(test_path(name), &opts, layout);
+}
+
+static const uint32_t *got_of(void *h, const elfgen_layout_t *layout) {
+  return (const uint32_t *)((uint8_t *)vrtld_get_base(h) + layout->got);
+}
+
+static void test_local(void) {
+  elfgen_layout_t dep_layout, layout, other_layout;
+  CHECK(elfgen_write(test_path("ldep.so"), &(elfgen_opts_t){ .prefix = "ldep_", .num_syms = 8, .hash = ELFGEN_HASH_GNU }, &dep_layout) == 0);
+  CHECK(gen_importer("lroot.so", "lroot_", 1, &layout) == 0);
+  CHECK(gen_importer("lother.so", "lother_", 0, &other_layout) == 0);
+
+  // the root gets its imports from its own dependencies...
+  void *root = vrtld_dlopen(test_path("lroot.so"), VRTLD_LOCAL);
+  CHECK(root != NULL);
+  if (!root) {
+    fprintf(stderr, "dlopen: %s\n", vrtld_dlerror());
+    return;
+  }
+  void *dep = vrtld_dlopen(test_path("ldep.so"), VRTLD_LOCAL);
+  CHECK(dep != NULL);
+  const uintptr_t dep_text = (uintptr_t)vrtld_get_base(dep) + dep_layout.text;
+  CHECK_EQ_HEX(got_of(root, &layout)[3], dep_text);
+  CHECK_EQ_HEX(got_of(root, &layout)[4], dep_text + 4);
+
+  // ...but nobody else can see them
+  void *other = vrtld_dlopen(test_path("lother.so"), VRTLD_GLOBAL);
+  CHECK(other != NULL);
+  if (other) {
+    CHECK_EQ_HEX(got_of(other, &other_layout)[3], 0);
+    CHECK(vrtld_dlclose(other) == 0);
+  }
+
+  // until the root is opened GLOBAL again, which takes its dependencies along
+  void *again = vrtld_dlopen(test_path("lroot.so"), VRTLD_GLOBAL);
+  CHECK(again == root);
+  other = vrtld_dlopen(test_path("lother.so"), VRTLD_GLOBAL);
+  CHECK(other != NULL);
+  if (other) {
+    CHECK_EQ_HEX(got_of(other, &other_layout)[3], dep_text);
+    CHECK(vrtld_dlclose(other) == 0);
+  }
+
+  if (again)
+    CHECK(vrtld_dlclose(again) == 0);
+  if (dep)
+    CHECK(vrtld_dlclose(dep) == 0);
+  CHECK(vrtld_dlclose(root) == 0);
+}
+
+static void test_cycle(void) {
+  // a -> b -> c -> b, found on the third level
+  static const char *a_needed[] = { "cyc_b.so" };
+  static const char *b_needed[] = { "cyc_c.so" };
+  static const char *c_needed[] = { "cyc_b.so" };
+  CHECK(gen("cyc_a.so", "cyc_a_", a_needed, 1) == 0);
+  CHECK(gen("cyc_b.so", "cyc_b_", b_needed, 1) == 0);
+  CHECK(gen("cyc_c.so", "cyc_c_", c_needed, 1) == 0);
+
+  const uint32_t before = num_modules();
+  CHECK(vrtld_dlopen(test_path("cyc_a.so"), VRTLD_GLOBAL) == NULL);
+  const char *err = vrtld_dlerror();
+  CHECK(err && strstr(err, "cyc_b.so") && strstr(err, "cyc_c.so"));
+  CHECK(num_modules() == before);
+  CHECK(vrtld_dlsym(NULL, "cyc_b_0") == NULL);
+  vrtld_dlerror();
+
+  // a module that needs itself
+  static const char *self_needed[] = { "self.so" };
+  CHECK(gen("self.so", "self_", self_needed, 1) == 0);
+  CHECK(vrtld_dlopen(test_path("self.so"), VRTLD_GLOBAL) == NULL);
+  CHECK(vrtld_dlerror() != NULL);
+  CHECK(num_modules() == before);
+
+  // nothing of the failed load is cached, so the same graph loads once the cycle is broken
+  CHECK(gen("cyc_c.so", "cyc_c_", NULL, 0) == 0);
+  void *h = vrtld_dlopen(test_path("cyc_a.so"), VRTLD_GLOBAL);
+  CHECK(h != NULL);
+  CHECK(num_modules() == before + 3);
+  if (h)
+    CHECK(vrtld_dlclose(h) == 0);
+  CHECK(num_modules() == before);
+}
+
+int main(void) {
+  if (test_init(0) < 0)
+    return 1;
+
+  vrtld_set_search_path(test_dir);
+
+  test_diamond();
+  test_local();
+  test_cycle();
+
+  vrtld_set_search_path(NULL);
+
+  return test_finish();
+}
@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vrtld.h>
+
+#include "common.h"
+#include "util.h"
+#include "lookup.h"
+#include "elfgen.h"
+#include "test.h"
+
+// GNU and SysV hash lookups have to find exactly the same symbols, both in the raw tables
+// and through dlsym() in modules that only have one kind of table or none at all
+
+#define NUM_SYMS 3000
+#define NUM_IMPORTS 64
+#define NUM_MISSES 3000
+
+static char names[NUM_SYMS + NUM_IMPORTS + NUM_MISSES][32];
+
+static const elfgen_opts_t base_opts = {
+  .prefix = "hash_exp_",
+  .num_syms = NUM_SYMS,
+  .import_prefix = "hash_imp_",
+  .num_imports = NUM_IMPORTS,
+  .weak_imports = 1,
+  .num_glob_dat = NUM_IMPORTS,
+};
+
+static void test_hash_functions(void) {
+  // reference values from the usual implementations
+  CHECK_EQ_HEX(vrtld_gnu_hash((const uint8_t *)""), 0x00001505);
+  CHECK_EQ_HEX(vrtld_gnu_hash((const uint8_t *)"printf"), 0x156b2bb8);
+  CHECK_EQ_HEX(vrtld_gnu_hash((const uint8_t *)"flapenguin.me"), 0x8ae9f18e);
+  CHECK_EQ_HEX(vrtld_elf_hash((const uint8_t *)""), 0x00000000);
+  CHECK_EQ_HEX(vrtld_elf_hash((const uint8_t *)"printf"), 0x077905a6);
+  CHECK_EQ_HEX(vrtld_elf_hash((const uint8_t *)"flapenguin.me"), 0x03987915);
+}
+
+static inline const Elf32_Sym *defined(const Elf32_Sym *sym) {
+  // SysV tables also hash the imports, GNU ones never do
+  return (sym && sym->st_shndx != SHN_UNDEF) ? sym : NULL;
+}
+
+static void test_tables(void) {
+  elfgen_opts_t opts = base_opts;
+  opts.hash = ELFGEN_HASH_BOTH;
+  CHECK(elfgen_write(test_path("hash_both.so"), &opts, NULL) == 0);
+
+  dso_t *mod = vrtld_dlopen(test_path("hash_both.so"), VRTLD_LOCAL);
+  CHECK(mod != NULL);
+  if (!mod)
+    return;
+  CHECK(mod->hashtab != NULL && mod->gnuhashtab != NULL);
+  if (!mod->hashtab || !mod->gnuhashtab) {
+    vrtld_dlclose(mod);
+    return;
+  }
+
+  uint32_t found = 0;
+  for (uint32_t i = 0; i < sizeof(names) / sizeof(*names); ++i) {
+    const char *name = names[i];
+    const Elf32_Sym *gsym = vrtld_gnu_hashtab_lookup_hashed(mod->dynstrtab, mod->dynsym, mod->gnuhashtab, name,
+      vrtld_gnu_hash((const uint8_t *)name));
+    const Elf32_Sym *esym = vrtld_elf_hashtab_lookup_hashed(mod->dynstrtab, mod->dynsym, mod->hashtab, name,
+      vrtld_elf_hash((const uint8_t *)name));
+    if (defined(gsym) != defined(esym)) {
+      fprintf(stderr, "`%s`: GNU lookup found %p, SysV lookup found %p\n", name, (void *)gsym, (void *)esym);
+      test_failed = 1;
+    }
+    if (gsym) {
+      CHECK(!strcmp(mod->dynstrtab + gsym->st_name, name));
+      ++found;
+    }
+  }
+  CHECK(found == NUM_SYMS);
+
+  vrtld_dlclose(mod);
+}
+
+static void test_dlsym(void) {
+  static const int hashes[] = { ELFGEN_HASH_NONE, ELFGEN_HASH_SYSV, ELFGEN_HASH_GNU, ELFGEN_HASH_BOTH };
+  static const char *modnames[] = { "hash_none.so", "hash_sysv.so", "hash_gnu.so", "hash_both2.so" };
+  elfgen_layout_t layout;
+
+  for (size_t h = 0; h < sizeof(hashes) / sizeof(*hashes); ++h) {
+    elfgen_opts_t opts = base_opts;
+    opts.hash = hashes[h];
+    CHECK(elfgen_write(test_path(modnames[h]), &opts, &layout) == 0);
+
+    void *handle = vrtld_dlopen(test_path(modnames[h]), VRTLD_LOCAL);
+    CHECK(handle != NULL);
+    if (!handle)
+      continue;
+
+    const uint8_t *base = vrtld_get_base(handle);
+    uint32_t bad = 0;
+    for (uint32_t i = 0; i < sizeof(names) / sizeof(*names); ++i) {
+      const char *name = names[i];
+      const void *expect = (i < NUM_SYMS) ? base + layout.text + 4 * i : NULL;
+      const void *addr = vrtld_dlsym(handle, name);
+      // the pre-hashed path is what dlsym_many and the relocator use
+      vrtld_hashed_name_t hn = { name, vrtld_gnu_hash((const uint8_t *)name), vrtld_elf_hash((const uint8_t *)name) };
+      const void *addr_hashed = vrtld_lookup_hashed(handle, &hn);
+      if (addr != expect || addr_hashed != expect) {
+        if (bad++ < 8)
+          fprintf(stderr, "%s: `%s`: expected %p, dlsym found %p, hashed lookup found %p\n", modnames[h], name, expect, addr, addr_hashed);
+        test_failed = 1;
+      }
+    }
+    vrtld_dlerror();
+
+    vrtld_dlclose(handle);
+  }
+}
+
+int main(void) {
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < NUM_SYMS; ++i)
+    snprintf(names[n++], sizeof(*names), "hash_exp_%u", i);
+  for (uint32_t i = 0; i < NUM_IMPORTS; ++i)
+    snprintf(names[n++], sizeof(*names), "hash_imp_%u", i);
+  // near misses: same prefix, and numbers just out of range
+  for (uint32_t i = 0; i < NUM_MISSES; ++i)
+    snprintf(names[n++], sizeof(*names), (i & 1) ? "hash_exp_%u" : "hash_xep_%u", NUM_SYMS + i);
+
+  test_hash_functions();
+
+  if (test_init(0) < 0)
+    return 1;
+
+  test_tables();
+  test_dlsym();
+
+  return test_finish();
+}
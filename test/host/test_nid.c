@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "nid.h"
+#include "test.h"
+
+// NIDs are the first 4 bytes of SHA-1(name), read big endian; the index is built from the
+// same export tables the Vita keeps in the main module
+
+// same layout as the one in nid.c, with host pointers
+typedef struct sce_module_exports {
+  uint16_t size;
+  uint8_t  lib_version[2];
+  uint16_t attribute;
+  uint16_t num_functions;
+  uint16_t num_vars;
+  uint16_t unk;
+  uint32_t num_tls_vars;
+  uint32_t lib_nid;
+  char     *lib_name;
+  uint32_t *nid_table;
+  void     **entry_table;
+} sce_module_exports_t;
+
+static void test_nid_for_name(void) {
+  static const struct { const char *name; uint32_t nid; } known[] = {
+    { "", 0xda39a3ee },
+    { "abc", 0xa9993e36 },
+    { "printf", 0xdf39b4ca },
+    // bytes with the top bit set
+    { "\xc3\xa9t\xc3\xa9", 0x64d0cbc5 },
+    // the padding has to spill into a second block from 56 bytes on
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 0x84983e44 },
+  };
+  // names of one repeated character, with lengths around the block boundaries
+  static const struct { char c; uint32_t len; uint32_t nid; } filled[] = {
+    { 'x', 55, 0xcef734ba },
+    { 'y', 63, 0xb31b2f10 },
+    { 'z', 64, 0x668cd5ae },
+    { 'w', 65, 0xa7aec0fd },
+  };
+
+  for (size_t i = 0; i < sizeof(known) / sizeof(*known); ++i) {
+    CHECK_EQ_HEX(nid_for_name(known[i].name), known[i].nid);
+    // second time around it comes from the cache
+    CHECK_EQ_HEX(nid_for_name(known[i].name), known[i].nid);
+  }
+
+  char buf[128];
+  for (size_t i = 0; i < sizeof(filled) / sizeof(*filled); ++i) {
+    memset(buf, filled[i].c, filled[i].len);
+    buf[filled[i].len] = '\0';
+    CHECK_EQ_HEX(nid_for_name(buf), filled[i].nid);
+    CHECK_EQ_HEX(nid_for_name(buf), filled[i].nid);
+  }
+
+  // long mangled names are cached too; ones that only differ at the end or in length can't be mixed up
+  char longname[131];
+  for (int i = 0; i < 10; ++i)
+    memcpy(longname + i * 13, "_ZN3foo3barEv", 13);
+  longname[130] = '\0';
+  for (int i = 0; i < 2; ++i) {
+    CHECK_EQ_HEX(nid_for_name(longname), 0x7718c5fe);
+    longname[129] = 'w';
+    CHECK_EQ_HEX(nid_for_name(longname), 0xa69de0f3);
+    longname[129] = 'v';
+    longname[117] = '\0';
+    CHECK_EQ_HEX(nid_for_name(longname), 0x71b9712a);
+    longname[117] = '_';
+  }
+}
+
+static int funcs[6];
+static int vars[3];
+
+static void test_index(void) {
+  static uint32_t nids_a[] = { 0x30000000, 0x10000000, 0x20000000, 0x40000000 };
+  static void *entries_a[] = { &funcs[0], &funcs[1], &funcs[2], &vars[0] };
+  // 0x20000000 is exported twice; the earlier one has to win
+  static uint32_t nids_b[] = { 0x20000000, 0x50000000, 0xffffffff, 0x00000001, 0x60000000 };
+  static void *entries_b[] = { &funcs[3], &funcs[4], &funcs[5], &vars[1], &vars[2] };
+
+  // the tables are laid out back to back and walked by their size field
+  sce_module_exports_t tables[2];
+  memset(tables, 0, sizeof(tables));
+  tables[0].size = sizeof(tables[0]);
+  tables[0].num_functions = 3;
+  tables[0].num_vars = 1;
+  tables[0].nid_table = nids_a;
+  tables[0].entry_table = entries_a;
+  tables[1].size = sizeof(tables[1]);
+  tables[1].num_functions = 3;
+  tables[1].num_vars = 2;
+  tables[1].nid_table = nids_b;
+  tables[1].entry_table = entries_b;
+
+  const uintptr_t start = (uintptr_t)&tables[0];
+  const uintptr_t end = (uintptr_t)&tables[2];
+
+  CHECK(nid_index_build(start, end) == 0);
+  CHECK(nid_index_count() == 9);
+  for (uint32_t i = 0; i < 4; ++i)
+    CHECK(nid_index_find(nids_a[i]) == entries_a[i]);
+  for (uint32_t i = 1; i < 5; ++i)
+    CHECK(nid_index_find(nids_b[i]) == entries_b[i]);
+  CHECK(nid_index_find(0x20000000) == &funcs[2]);
+  CHECK(nid_index_find(0x00000000) == NULL);
+  CHECK(nid_index_find(0x20000001) == NULL);
+  CHECK(nid_index_find(0xfffffffe) == NULL);
+
+  // same content, same fingerprint
+  const uint64_t h = nid_index_hash(0);
+  CHECK(nid_index_build(start, end) == 0);
+  CHECK(nid_index_hash(0) == h);
+
+  // a zero size ends the walk
+  tables[1].size = 0;
+  CHECK(nid_index_build(start, end) == 0);
+  CHECK(nid_index_count() == 4);
+  CHECK(nid_index_find(0x50000000) == NULL);
+  CHECK(nid_index_find(0x20000000) == &funcs[2]);
+  CHECK(nid_index_hash(0) != h);
+
+  // nothing at all
+  CHECK(nid_index_build(start, start) == 0);
+  CHECK(nid_index_count() == 0);
+  CHECK(nid_index_find(0x10000000) == NULL);
+
+  nid_index_free();
+  CHECK(nid_index_count() == 0);
+}
+
+int main(void) {
+  test_nid_for_name();
+  test_index();
+  if (test_failed)
+    fprintf(stderr, "test: FAILED\n");
+  return test_failed ? 1 : 0;
+}
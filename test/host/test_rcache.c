@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vrtld.h>
+
+#include "util.h"
+#include "elfgen.h"
+#include "test.h"
+
+// the reloc cache has to survive unrelated modules coming and going, but not changes to the
+// modules it was resolved against or to the GLOBAL modules that are searched before them
+
+static void test_hash64(void) {
+  // XXH64 reference values
+  CHECK_EQ_HEX(vrtld_hash64(0, "", 0), 0xef46db3751d8e999ULL);
+  CHECK_EQ_HEX(vrtld_hash64(0, "a", 1), 0xd24ec4f1a98c6e5bULL);
+  CHECK_EQ_HEX(vrtld_hash64(0, "abc", 3), 0x44bc2cf5ad770999ULL);
+
+  // every tail length and the 32 byte stripes, with and without a seed
+  static const struct { uint32_t len; uint64_t h0, h1; } vec[] = {
+    { 3, 0x56e6957632a487f9ULL, 0x5acb303e78133c22ULL },
+    { 8, 0x3da5c7aa269683e0ULL, 0x758848f033fa76a2ULL },
+    { 15, 0xae2a37eb9357caa7ULL, 0xa18d5c90d722cee3ULL },
+    { 32, 0x8d57d6a4671cc43dULL, 0x184ebcf3745cd46cULL },
+    { 33, 0x62c9fd21ed857664ULL, 0x52fac3c981f3cc2eULL },
+    { 101, 0xfbfdf3fa1a53bc7fULL, 0xb2e6ae8b80290301ULL },
+  };
+  uint8_t data[101];
+  for (uint32_t i = 0; i < sizeof(data); ++i)
+    data[i] = (uint8_t)(i * 31 + 7);
+  for (size_t i = 0; i < sizeof(vec) / sizeof(*vec); ++i) {
+    CHECK_EQ_HEX(vrtld_hash64(0, data, vec[i].len), vec[i].h0);
+    CHECK_EQ_HEX(vrtld_hash64(0x9e3779b97f4a7c15ULL, data, vec[i].len), vec[i].h1);
+  }
+}
+
+static int gen(const char *name, const char *prefix, const uint32_t num_syms, const char *import_prefix,
+  const uint32_t num_imports, const int weak, elfgen_layout_t *layout) {
+  const elfgen_opts_t opts = {
+    .prefix = prefix,
+    .num_syms = num_syms,
+    .hash = ELFGEN_HASH_GNU,
+    .import_prefix = import_prefix,
+    .num_imports = num_imports,
+    .weak_imports = weak,
+    .num_glob_dat = num_imports,
+  };
+  return elfgen_write(test_path(name), &opts, layout);
+}
+
+// opens a module and tells whether its imports came from the cache
+static void *open_cached(const char *name, int *out_hit) {
+  void *h = vrtld_dlopen(test_path(name), VRTLD_LOCAL);
+  CHECK(h != NULL);
+  if (!h) {
+    fprintf(stderr, "dlopen(`%s`): %s\n", name, vrtld_dlerror());
+    *out_hit = -1;
+    return NULL;
+  }
+  vrtld_module_stats_t st;
+  CHECK(vrtld_get_module_stats(h, &st) == 0);
+  *out_hit = st.lookup_hits[VRTLD_SOURCE_MODULE] == 0 && st.lookup_misses == 0 && st.lookups_cached > 0;
+  // the cache and the in-memory memo are counted apart
+  CHECK(*out_hit ? st.lookups_saved == 0 : st.lookups_cached == 0);
+  return h;
+}
+
+static void check_got(void *h, const elfgen_layout_t *layout, void *prov, const char *prefix, const uint32_t num) {
+  const uint32_t *got = (const uint32_t *)((uint8_t *)vrtld_get_base(h) + layout->got) + 3;
+  char name[64];
+  for (uint32_t i = 0; i < num; ++i) {
+    snprintf(name, sizeof(name), "%s%u", prefix, i);
+    CHECK_EQ_HEX(got[i], prov ? (uintptr_t)vrtld_dlsym(prov, name) : 0);
+  }
+}
+
+static void test_providers(void) {
+  elfgen_layout_t layout;
+  int hit;
+
+  CHECK(gen("rc_prov.so", "rc_prov_", 64, NULL, 0, 0, NULL) == 0);
+  CHECK(gen("rc_other.so", "rc_other_", 64, NULL, 0, 0, NULL) == 0);
+  CHECK(gen("rc_filler.so", "rc_fillr_", 64, NULL, 0, 0, NULL) == 0);
+  CHECK(gen("rc_interp.so", "rc_prov_", 64, NULL, 0, 0, NULL) == 0);
+  CHECK(gen("rc_user.so", "rc_user_", 8, "rc_prov_", 32, 0, &layout) == 0);
+
+  void *prov = vrtld_dlopen(test_path("rc_prov.so"), VRTLD_GLOBAL);
+  CHECK(prov != NULL);
+  // keeps the spot that rc_other.so is going to take, so that rc_user.so stays where it is
+  void *filler = vrtld_dlopen(test_path("rc_filler.so"), VRTLD_LOCAL);
+  CHECK(filler != NULL);
+
+  // first time around there's no cache yet
+  void *user = open_cached("rc_user.so", &hit);
+  CHECK(hit == 0);
+  CHECK(access(test_path("rc_user.so.vrc"), F_OK) == 0);
+  check_got(user, &layout, prov, "rc_prov_", 32);
+  void *const user_base = vrtld_get_base(user);
+  vrtld_dlclose(user);
+  vrtld_dlclose(filler);
+
+  // an unrelated LOCAL module doesn't matter
+  void *other = vrtld_dlopen(test_path("rc_other.so"), VRTLD_LOCAL);
+  CHECK(other != NULL);
+  user = open_cached("rc_user.so", &hit);
+  CHECK(hit == 1);
+  check_got(user, &layout, prov, "rc_prov_", 32);
+  vrtld_dlclose(user);
+  vrtld_dlclose(other);
+
+  // a newer GLOBAL module that defines the same symbols takes precedence over the provider,
+  // even though the provider itself hasn't changed
+  void *interp = vrtld_dlopen(test_path("rc_interp.so"), VRTLD_GLOBAL);
+  CHECK(interp != NULL);
+  user = open_cached("rc_user.so", &hit);
+  CHECK(vrtld_get_base(user) == user_base);
+  CHECK(hit == 0);
+  check_got(user, &layout, interp, "rc_prov_", 32);
+  vrtld_dlclose(user);
+  vrtld_dlclose(interp);
+
+  // and once it's gone, the imports go back to the provider
+  user = open_cached("rc_user.so", &hit);
+  CHECK(hit == 0);
+  check_got(user, &layout, prov, "rc_prov_", 32);
+  vrtld_dlclose(user);
+
+  // the provider changes in place: same size, same address, different content
+  vrtld_dlclose(prov);
+  elfgen_opts_t popts = { .prefix = "rc_prov_", .num_syms = 64, .hash = ELFGEN_HASH_GNU, .bss_size = 4 };
+  CHECK(elfgen_write(test_path("rc_prov.so"), &popts, NULL) == 0);
+  prov = vrtld_dlopen(test_path("rc_prov.so"), VRTLD_GLOBAL);
+  CHECK(prov != NULL);
+  user = open_cached("rc_user.so", &hit);
+  CHECK(hit == 0);
+  check_got(user, &layout, prov, "rc_prov_", 32);
+  vrtld_dlclose(user);
+
+  // and the rewritten cache is good again
+  user = open_cached("rc_user.so", &hit);
+  CHECK(hit == 1);
+  vrtld_dlclose(user);
+
+  vrtld_dlclose(prov);
+}
+
+static void test_misses(void) {
+  elfgen_layout_t layout;
+  int hit;
+
+  // nothing provides these yet, so any GLOBAL module loaded later could
+  CHECK(gen("rc_weak.so", "rc_weak_", 8, "rc_late_", 4, 1, &layout) == 0);
+  CHECK(gen("rc_late.so", "rc_late_", 4, NULL, 0, 0, NULL) == 0);
+  CHECK(gen("rc_filler2.so", "rc_fill_", 4, NULL, 0, 0, NULL) == 0);
+
+  void *filler = vrtld_dlopen(test_path("rc_filler2.so"), VRTLD_LOCAL);
+  CHECK(filler != NULL);
+
+  void *user = open_cached("rc_weak.so", &hit);
+  CHECK(hit == 0);
+  check_got(user, &layout, NULL, "rc_late_", 4);
+  vrtld_dlclose(user);
+
+  user = open_cached("rc_weak.so", &hit);
+  CHECK(hit == 1);
+  check_got(user, &layout, NULL, "rc_late_", 4);
+  vrtld_dlclose(user);
+  vrtld_dlclose(filler);
+
+  // same address, but now the imports can be found
+  void *late = vrtld_dlopen(test_path("rc_late.so"), VRTLD_GLOBAL);
+  CHECK(late != NULL);
+  user = open_cached("rc_weak.so", &hit);
+  CHECK(hit == 0);
+  if (user) {
+    check_got(user, &layout, late, "rc_late_", 4);
+    vrtld_dlclose(user);
+  }
+  vrtld_dlclose(late);
+}
+
+int main(void) {
+  test_hash64();
+
+  if (test_init(VRTLD_RELOC_CACHE) < 0)
+    return 1;
+
+  test_providers();
+  test_misses();
+
+  return test_finish();
+}
@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <elf.h>
+#include <vrtld.h>
+
+#include "platform.h"
+#include "util.h"
+#include "elfgen.h"
+#include "test.h"
+
+// exercises the Linux platform backend, a full load of a generated module against main exports,
+// prebuilt main symbol tables and a trace dump
+
+static int host_var = 1234;
+
+static int host_fn(int x) {
+  return x + host_var;
+}
+
+static void test_platform(void) {
+  // the window has to be addressable by ELF32 relocs
+  CHECK(plat_reserve_window(0x100000000ULL, 0x100010000ULL) < 0);
+
+  const uintptr_t start = 0x60000000;
+  const uintptr_t end = start + 0x10000;
+  CHECK(plat_reserve_window(start, end) == 0);
+  void *page = (void *)(start + 0x1000);
+  const plat_block_t blk = plat_map(page, 0x2000, PLAT_PROT_RX);
+  CHECK(blk != 0);
+  if (blk) {
+    const uint32_t word = 0xdeadbeef;
+    plat_write_protected(page, &word, sizeof(word));
+    CHECK_EQ_HEX(*(uint32_t *)page, word);
+    plat_flush_caches(page, 0x2000);
+    plat_unmap(blk, page, 0x2000);
+  }
+  // can't map over a window that isn't there anymore, but also can't reserve it twice
+  CHECK(plat_reserve_window(start, end) < 0);
+  plat_release_window(start, end);
+
+  uintptr_t exp_start, exp_end;
+  CHECK(plat_main_exports(&exp_start, &exp_end) < 0);
+
+  CHECK(plat_thread_id() == (uint32_t)gettid());
+  CHECK(plat_process_id() == (uint32_t)getpid());
+  const uint64_t t0 = plat_time_us();
+  usleep(2000);
+  CHECK(plat_time_us() - t0 >= 2000);
+}
+
+static void test_load(void) {
+  static const vrtld_export_t exports[] = {
+    { "smoke_host_0", (void *)host_fn },
+    { "smoke_host_1", (void *)&host_var },
+  };
+  CHECK(vrtld_set_main_exports(exports, 2) == 0);
+
+  // too far away to be relocated against
+  static const vrtld_export_t far_exports[] = {
+    { "smoke_far", (void *)0x123456789ULL },
+  };
+  CHECK(vrtld_set_main_exports(far_exports, 1) < 0);
+  const char *err = vrtld_dlerror();
+  CHECK(err && strstr(err, "smoke_far"));
+
+  elfgen_layout_t layout;
+  const elfgen_opts_t opts = {
+    .prefix = "smoke_mod_",
+    .num_syms = 16,
+    .hash = ELFGEN_HASH_GNU,
+    .num_relative = 8,
+    .num_abs32 = 8,
+    .import_prefix = "smoke_host_",
+    .num_imports = 2,
+    .num_glob_dat = 2,
+    .num_jump_slot = 2,
+    .bss_size = 0x3000,
+  };
+  CHECK(elfgen_write(test_path("smoke.so"), &opts, &layout) == 0);
+
+  void *h = vrtld_dlopen(test_path("smoke.so"), VRTLD_GLOBAL);
+  CHECK(h != NULL);
+  if (!h) {
+    fprintf(stderr, "dlopen: %s\n", vrtld_dlerror());
+    return;
+  }
+
+  uint8_t *base = vrtld_get_base(h);
+  CHECK((uintptr_t)base + layout.size <= UINT32_MAX);
+  CHECK(vrtld_get_handle(base) == h);
+
+  // imports went through the main exports, the rest got relocated by the base
+  const uint32_t *got = (const uint32_t *)(base + layout.got);
+  CHECK_EQ_HEX(got[3], (uintptr_t)host_fn);
+  CHECK_EQ_HEX(got[4], (uintptr_t)&host_var);
+  CHECK_EQ_HEX(got[5], (uintptr_t)host_fn);
+  CHECK_EQ_HEX(got[6], (uintptr_t)&host_var);
+  const uint32_t *rel = (const uint32_t *)(base + layout.relative);
+  const uint32_t *abs = (const uint32_t *)(base + layout.abs32);
+  for (uint32_t i = 0; i < 8; ++i) {
+    CHECK_EQ_HEX(rel[i], (uintptr_t)base + layout.text + 4 * i);
+    CHECK_EQ_HEX(abs[i], (uintptr_t)base + layout.text + 4 * i);
+  }
+  // bss got zeroed
+  const uint8_t *bss = base + layout.size - opts.bss_size;
+  int nonzero = 0;
+  for (uint32_t i = 0; i < opts.bss_size; ++i)
+    nonzero |= bss[i];
+  CHECK(!nonzero);
+
+  CHECK(vrtld_dlsym(h, "smoke_mod_5") == base + layout.text + 20);
+  CHECK(vrtld_dlsym(NULL, "smoke_mod_5") == base + layout.text + 20);
+  CHECK(vrtld_dlsym(NULL, "smoke_host_0") == (void *)host_fn);
+  CHECK(vrtld_dlsym(h, "smoke_mod_16") == NULL);
+  CHECK(vrtld_dlerror() != NULL);
+
+  vrtld_dl_info_t info;
+  CHECK(vrtld_dladdr(base + layout.text + 22, &info) != 0);
+  CHECK(info.dli_fbase == base);
+  CHECK(info.dli_sname && !strcmp(info.dli_sname, "smoke_mod_5"));
+  CHECK(info.dli_saddr == base + layout.text + 20);
+
+  CHECK(vrtld_dlclose(h) == 0);
+  CHECK(vrtld_dlsym(NULL, "smoke_mod_5") == NULL);
+}
+
+// a two bucket table like vrtld_add_exports() makes: smoke_tab_a hashes to bucket 0, smoke_tab_b to 1
+typedef struct smoke_symtab {
+  Elf32_Sym syms[3];
+  uint32_t gnuhash[4 + 1 + 2 + 2];
+} smoke_symtab_t;
+
+static const char smoke_strtab[] = "\0smoke_tab_a\0smoke_tab_b";
+
+static void smoke_symtab_init(smoke_symtab_t *st, vrtld_symtab_t *tab, const int swap) {
+  memset(st, 0, sizeof(*st));
+  const uint32_t names[2] = { swap ? 13 : 1, swap ? 1 : 13 };
+  for (uint32_t i = 0; i < 2; ++i) {
+    st->syms[i + 1].st_name = names[i];
+    st->syms[i + 1].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+    st->syms[i + 1].st_shndx = SHN_ABS;
+    st->syms[i + 1].st_value = (uintptr_t)&host_var + i;
+  }
+  st->gnuhash[0] = 2;      // nbuckets
+  st->gnuhash[1] = 1;      // symoffset
+  st->gnuhash[2] = 1;      // bloom words
+  st->gnuhash[4] = ~0u;    // everything might be in here
+  st->gnuhash[5] = 1;      // bucket 0
+  st->gnuhash[6] = 2;      // bucket 1
+  for (uint32_t i = 0; i < 2; ++i)
+    st->gnuhash[7 + i] = vrtld_gnu_hash((const uint8_t *)smoke_strtab + names[i]) | 1;
+  tab->symtab = st->syms;
+  tab->strtab = smoke_strtab;
+  tab->gnuhash = st->gnuhash;
+  tab->num_syms = 3;
+}
+
+static void test_main_symtab(void) {
+  // it's used as is until it's replaced
+  static smoke_symtab_t st;
+  static vrtld_symtab_t tab;
+  const char *err;
+
+  CHECK(vrtld_set_main_symtab(NULL) < 0);
+  CHECK(vrtld_dlerror() != NULL);
+
+  // symbols in the wrong buckets
+  smoke_symtab_init(&st, &tab, 1);
+  CHECK(vrtld_set_main_symtab(&tab) < 0);
+  err = vrtld_dlerror();
+  CHECK(err && strstr(err, "sorted"));
+
+  // the last chain doesn't end
+  smoke_symtab_init(&st, &tab, 0);
+  st.gnuhash[8] &= ~1u;
+  CHECK(vrtld_set_main_symtab(&tab) < 0);
+  CHECK(vrtld_dlerror() != NULL);
+
+  smoke_symtab_init(&st, &tab, 0);
+  CHECK(vrtld_set_main_symtab(&tab) == 0);
+  CHECK(vrtld_dlsym(NULL, "smoke_tab_a") == (void *)&host_var);
+  CHECK(vrtld_dlsym(NULL, "smoke_tab_b") == (uint8_t *)&host_var + 1);
+  CHECK(vrtld_set_main_exports(NULL, 0) < 0);
+  CHECK(vrtld_dlerror() != NULL);
+}
+
+typedef struct {
+  char buf[4096];
+  unsigned int len;
+} trace_out_t;
+
+static int trace_write(const void *data, unsigned int size, void *userdata) {
+  // the dump must not hold anything a lookup needs
+  vrtld_dlsym(NULL, "smoke_host_0");
+  trace_out_t *out = userdata;
+  if (size > sizeof(out->buf) - 1 - out->len)
+    size = sizeof(out->buf) - 1 - out->len;
+  memcpy(out->buf + out->len, data, size);
+  out->len += size;
+  out->buf[out->len] = '\0';
+  return 0;
+}
+
+static void test_trace(void) {
+  static const char *const names[] = { "smoke_host_0", "smoke_host_1" };
+  void *out[2];
+  CHECK(vrtld_trace_enable(4) == 0);
+  for (int i = 0; i < 6; ++i)
+    vrtld_dlsym(NULL, "smoke_host_0");
+  vrtld_dlsym_many(NULL, names, out, 2, NULL);
+  static trace_out_t dump;
+  CHECK(vrtld_trace_dump(trace_write, &dump) == 0);
+  CHECK(dump.len > 0);
+  CHECK(strstr(dump.buf, "\"symbol\":\"smoke_host_0\"") != NULL);
+  // a batch names the module it searched and how many names it got
+  const char *many = strstr(dump.buf, "\"name\":\"vrtld_dlsym_many\"");
+  CHECK(many != NULL);
+  CHECK(many && strstr(many, "\"module\":") != NULL);
+  CHECK(many && strstr(many, "\"count\":2") != NULL);
+  CHECK(many && strstr(many, "\"symbol\":") == NULL);
+  vrtld_trace_disable();
+}
+
+int main(void) {
+  test_platform();
+
+  if (test_init(0) < 0)
+    return 1;
+
+  test_load();
+  test_main_symtab();
+  test_trace();
+
+  return test_finish();
+}
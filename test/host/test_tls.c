@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <vrtld.h>
+
+#include "elfgen.h"
+#include "test.h"
+
+// TLS layout and per-thread blocks: modules loaded before the first TLS access get a static block,
+// the ones after that get dynamic blocks and can't use initial-exec relocs anymore
+
+#define TLS_SYMS 4
+
+// what modules see through __aeabi_read_tp()
+void *vrtld_tls_read_tp(void);
+
+static const elfgen_opts_t static_opts = {
+  .prefix = "tls_static_",
+  .num_syms = 4,
+  .hash = ELFGEN_HASH_GNU,
+  .tls_filesz = 40,
+  .tls_memsz = 100,
+  .tls_align = 32,
+  .num_tls_syms = TLS_SYMS,
+  .tls_tpoff = 1,
+};
+
+static const elfgen_opts_t dynamic_opts = {
+  .prefix = "tls_dynamic_",
+  .num_syms = 4,
+  .hash = ELFGEN_HASH_GNU,
+  .tls_filesz = 24,
+  .tls_memsz = 64,
+  .tls_align = 16,
+  .num_tls_syms = TLS_SYMS,
+};
+
+static void *static_h;
+static void *dynamic_h;
+
+static uint8_t *tls_var(void *h, const char *prefix, const uint32_t n) {
+  char name[64];
+  snprintf(name, sizeof(name), "%stls%u", prefix, n);
+  return vrtld_dlsym(h, name);
+}
+
+// the calling thread's copy of the block starts out as the PT_TLS image followed by zeroes
+static int tls_block_fresh(void *h, const elfgen_opts_t *opts) {
+  const uint8_t *block = tls_var(h, opts->prefix, 0);
+  if (!block)
+    return 0;
+  for (uint32_t i = 0; i < opts->tls_memsz; ++i) {
+    if (block[i] != (i < opts->tls_filesz ? elfgen_tls_byte(i) : 0))
+      return 0;
+  }
+  return 1;
+}
+
+static void test_static(void) {
+  elfgen_layout_t layout;
+  CHECK(elfgen_write(test_path("tls_static.so"), &static_opts, &layout) == 0);
+
+  static_h = vrtld_dlopen(test_path("tls_static.so"), VRTLD_GLOBAL);
+  CHECK(static_h != NULL);
+  if (!static_h) {
+    fprintf(stderr, "dlopen: %s\n", vrtld_dlerror());
+    return;
+  }
+
+  // TPOFF32 got the offset from the thread pointer, which has to be aligned for the block
+  const uint32_t *got = (const uint32_t *)((uint8_t *)vrtld_get_base(static_h) + layout.tls_got);
+  uint8_t *tp = vrtld_tls_read_tp();
+  CHECK(tp != NULL);
+  CHECK(got[0] % static_opts.tls_align == 0);
+  for (uint32_t n = 0; n < TLS_SYMS; ++n) {
+    CHECK_EQ_HEX(got[n] - got[0], elfgen_tls_sym_offset(&static_opts, n));
+    CHECK(tls_var(static_h, static_opts.prefix, n) == tp + got[n]);
+  }
+  CHECK((uintptr_t)tls_var(static_h, static_opts.prefix, 0) % static_opts.tls_align == 0);
+  CHECK(tls_block_fresh(static_h, &static_opts));
+}
+
+static void test_dynamic(void) {
+  elfgen_layout_t layout;
+  CHECK(elfgen_write(test_path("tls_dynamic.so"), &dynamic_opts, &layout) == 0);
+
+  // too late for a static block now
+  dynamic_h = vrtld_dlopen(test_path("tls_dynamic.so"), VRTLD_GLOBAL);
+  CHECK(dynamic_h != NULL);
+  if (!dynamic_h) {
+    fprintf(stderr, "dlopen: %s\n", vrtld_dlerror());
+    return;
+  }
+
+  const uint32_t *got = (const uint32_t *)((uint8_t *)vrtld_get_base(dynamic_h) + layout.tls_got);
+  uint8_t *block = tls_var(dynamic_h, dynamic_opts.prefix, 0);
+  CHECK(block != NULL);
+  CHECK((uintptr_t)block % dynamic_opts.tls_align == 0);
+  for (uint32_t n = 0; n < TLS_SYMS; ++n) {
+    CHECK(got[n * 2] != 0);
+    CHECK(got[n * 2] == got[0]);
+    CHECK_EQ_HEX(got[n * 2 + 1], elfgen_tls_sym_offset(&dynamic_opts, n));
+    CHECK(tls_var(dynamic_h, dynamic_opts.prefix, n) == block + got[n * 2 + 1]);
+  }
+  CHECK(tls_block_fresh(dynamic_h, &dynamic_opts));
+
+  // the same block every time
+  CHECK(tls_var(dynamic_h, dynamic_opts.prefix, 0) == block);
+}
+
+static void test_tpoff_rejected(void) {
+  elfgen_opts_t opts = static_opts;
+  opts.prefix = "tls_late_";
+  CHECK(elfgen_write(test_path("tls_late.so"), &opts, NULL) == 0);
+
+  CHECK(vrtld_dlopen(test_path("tls_late.so"), VRTLD_GLOBAL) == NULL);
+  const char *err = vrtld_dlerror();
+  CHECK(err && strstr(err, "initial-exec"));
+}
+
+typedef struct thread_result {
+  uint8_t *vars[2];
+  int fresh[2];
+} thread_result_t;
+
+static void *thread_main(void *arg) {
+  thread_result_t *res = arg;
+  res->fresh[0] = tls_block_fresh(static_h, &static_opts);
+  res->fresh[1] = tls_block_fresh(dynamic_h, &dynamic_opts);
+  res->vars[0] = tls_var(static_h, static_opts.prefix, 1);
+  res->vars[1] = tls_var(dynamic_h, dynamic_opts.prefix, 1);
+  return NULL;
+}
+
+static void test_threads(void) {
+  if (!static_h || !dynamic_h)
+    return;
+
+  // scribble over this thread's copies; the new thread has to start from the images anyway
+  uint8_t *vars[2] = { tls_var(static_h, static_opts.prefix, 1), tls_var(dynamic_h, dynamic_opts.prefix, 1) };
+  vars[0][0] = 0xaa;
+  vars[1][0] = 0xbb;
+
+  thread_result_t res = { { NULL, NULL }, { 0, 0 } };
+  pthread_t thread;
+  CHECK(pthread_create(&thread, NULL, thread_main, &res) == 0);
+  pthread_join(thread, NULL);
+
+  CHECK(res.fresh[0]);
+  CHECK(res.fresh[1]);
+  CHECK(res.vars[0] && res.vars[0] != vars[0]);
+  CHECK(res.vars[1] && res.vars[1] != vars[1]);
+  CHECK(vars[0][0] == 0xaa);
+  CHECK(vars[1][0] == 0xbb);
+}
+
+int main(void) {
+  if (test_init(0) < 0)
+    return 1;
+
+  test_static();
+  test_dynamic();
+  test_tpoff_rejected();
+  test_threads();
+
+  if (dynamic_h)
+    CHECK(vrtld_dlclose(dynamic_h) == 0);
+  if (static_h)
+    CHECK(vrtld_dlclose(static_h) == 0);
+
+  return test_finish();
+}
@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <psp2/kernel/processmgr.h>
+#define VRTLD_LIBDL_COMPAT
+#include <vrtld.h>
+
+#include "bench.h"
+
+#define BENCH_ITERS 256
+#define BENCH_MT_ITERS 4096
+#define BENCH_MT_MAX_THREADS 4
+#define BENCH_MT_STACK 0x10000
+
+static unsigned long long samples[BENCH_ITERS];
+
+static inline unsigned long long bench_now(void) {
+  return sceKernelGetProcessTimeWide();
+}
+
+static int bench_cmp(const void *a, const void *b) {
+  const unsigned long long x = *(const unsigned long long *)a;
+  const unsigned long long y = *(const unsigned long long *)b;
+  return (x > y) - (x < y);
+}
+
+static void bench_report(FILE *out, const char *op, const unsigned int n) {
+  qsort(samples, n, sizeof(*samples), bench_cmp);
+  fprintf(out, "%s,%u,%llu,%llu,%llu,%llu,%llu\n", op, n,
+    samples[0], samples[n * 50 / 100], samples[n * 90 / 100], samples[n * 99 / 100], samples[n - 1]);
+}
+
+typedef struct bench_mt {
+  void *lib;
+  void *sym;
+  unsigned int lookups;
+} bench_mt_t;
+
+static void *bench_mt_worker(void *arg) {
+  bench_mt_t *job = arg;
+  Dl_info info;
+  for (int i = 0; i < BENCH_MT_ITERS; ++i) {
+    job->lookups += dlsym(job->lib, "bruh") != NULL;
+    job->lookups += dlsym(RTLD_DEFAULT, "vrtld_bench_no_such_symbol") == NULL;
+    job->lookups += dladdr((char *)job->sym + 4, &info) != 0;
+  }
+  return NULL;
+}
+
+// lookups per millisecond with this many threads looking things up at once
+static void bench_mt_lookups(FILE *out, void *lib, void *sym, const int num_threads) {
+  pthread_t threads[BENCH_MT_MAX_THREADS];
+  bench_mt_t jobs[BENCH_MT_MAX_THREADS] = { 0 };
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, BENCH_MT_STACK);
+
+  const unsigned long long t0 = bench_now();
+  int n = 0;
+  for (; n < num_threads; ++n) {
+    jobs[n].lib = lib;
+    jobs[n].sym = sym;
+    if (pthread_create(&threads[n], &attr, bench_mt_worker, &jobs[n]))
+      break;
+  }
+  unsigned int lookups = 0;
+  for (int i = 0; i < n; ++i) {
+    pthread_join(threads[i], NULL);
+    lookups += jobs[i].lookups;
+  }
+  const unsigned long long dt = bench_now() - t0;
+
+  pthread_attr_destroy(&attr);
+
+  fprintf(out, "%d,%u,%llu,%llu\n", n, lookups, dt, dt ? lookups * 1000ULL / dt : 0);
+}
+
+void bench_run(const char *libpath, FILE *out) {
+  fprintf(stderr, "app: running benchmarks on `%s`\n", libpath);
+
+  // op,n,min_us,p50_us,p90_us,p99_us,max_us
+  fprintf(out, "op,n,min_us,p50_us,p90_us,p99_us,max_us\n");
+
+  // full load and unload; the library must not be open anywhere else for this
+  unsigned long long close_samples[BENCH_ITERS];
+  for (int i = 0; i < BENCH_ITERS; ++i) {
+    const unsigned long long t0 = bench_now();
+    void *h = dlopen(libpath, RTLD_GLOBAL);
+    const unsigned long long t1 = bench_now();
+    if (!h) {
+      fprintf(stderr, "app: bench: dlopen() failed: %s\n", dlerror());
+      return;
+    }
+    dlclose(h);
+    samples[i] = t1 - t0;
+    close_samples[i] = bench_now() - t1;
+  }
+  bench_report(out, "dlopen", BENCH_ITERS);
+  for (int i = 0; i < BENCH_ITERS; ++i)
+    samples[i] = close_samples[i];
+  bench_report(out, "dlclose", BENCH_ITERS);
+
+  void *lib = dlopen(libpath, RTLD_GLOBAL);
+  if (!lib) {
+    fprintf(stderr, "app: bench: dlopen() failed: %s\n", dlerror());
+    return;
+  }
+
+  // dlopen of something that's already loaded, which is just a refcount bump
+  for (int i = 0; i < BENCH_ITERS; ++i) {
+    const unsigned long long t0 = bench_now();
+    void *h = dlopen(libpath, RTLD_GLOBAL);
+    samples[i] = bench_now() - t0;
+    dlclose(h);
+  }
+  bench_report(out, "dlopen_loaded", BENCH_ITERS);
+
+  void *sym = NULL;
+  for (int i = 0; i < BENCH_ITERS; ++i) {
+    const unsigned long long t0 = bench_now();
+    sym = dlsym(lib, "bruh");
+    samples[i] = bench_now() - t0;
+  }
+  bench_report(out, "dlsym_hit", BENCH_ITERS);
+
+  for (int i = 0; i < BENCH_ITERS; ++i) {
+    const unsigned long long t0 = bench_now();
+    dlsym(RTLD_DEFAULT, "vrtld_bench_no_such_symbol");
+    samples[i] = bench_now() - t0;
+  }
+  bench_report(out, "dlsym_miss", BENCH_ITERS);
+
+  Dl_info info;
+  for (int i = 0; i < BENCH_ITERS; ++i) {
+    const unsigned long long t0 = bench_now();
+    dladdr((char *)sym + 4, &info);
+    samples[i] = bench_now() - t0;
+  }
+  bench_report(out, "dladdr", BENCH_ITERS);
+
+  // lookups shouldn't get in each other's way
+  fprintf(out, "threads,lookups,total_us,lookups_per_ms\n");
+  for (int n = 1; n <= BENCH_MT_MAX_THREADS; n *= 2)
+    bench_mt_lookups(out, lib, sym, n);
+
+  dlclose(lib);
+
+  // where the load time went, summed over all of the above
+  vrtld_stats_t stats;
+  vrtld_get_stats(&stats);
+  static const char *phases[VRTLD_NUM_PHASES] = { "io", "alloc", "copy", "reloc", "flush", "init" };
+  fprintf(out, "phase,total_us\n");
+  for (int i = 0; i < VRTLD_NUM_PHASES; ++i)
+    fprintf(out, "%s,%llu\n", phases[i], stats.total.time_us[i]);
+
+  dlerror(); // the miss benchmark leaves an error behind
+}
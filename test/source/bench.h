@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdio.h>
+
+void bench_run(const char *libpath, FILE *out);
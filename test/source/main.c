@@ -7,6 +7,9 @@
 
 #include "lib.h"
 #include "main.h"
+#ifdef WITH_BENCHMARKS
+#include "bench.h"
+#endif
 
 int test = 5643;
 
@@ -55,6 +58,19 @@ int main(int argc, const char **argv) {
   fprintf(stderr, "app: calling arse(wew lad)\n");
   arse_fn("wew lad");
 
+  dlclose(lib);
+  lib = NULL;
+
+#ifdef WITH_BENCHMARKS
+  // the benchmarks load and unload it on their own
+  FILE *bench_out = fopen("ux0:data/vrtld_bench.csv", "w");
+  bench_run("app0:/libtestlib.so", bench_out ? bench_out : stderr);
+  if (bench_out) {
+    fclose(bench_out);
+    fprintf(stderr, "app: benchmark results written to ux0:data/vrtld_bench.csv\n");
+  }
+#endif
+
   fprintf(stderr, "app: terminating in 3 sec\n");
 
   sleep(3);